@@ -0,0 +1,534 @@
+/*
+ * Copyright (C) 2003 Tim Angus
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "aggregate.h"
+#include "buffer.h"
+#include "comms.h"
+
+int                           aggregateInterval = 0;
+
+static aggThread_t            *threads = NULL;
+static pthread_mutex_t        threadsMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t          threadKey;
+static pthread_once_t         threadKeyOnce = PTHREAD_ONCE_INIT;
+static __thread aggThread_t   *localThread = NULL;
+
+/*
+===============
+initAggregation
+
+Decide whether to aggregate, once rtprof has said what it supports
+===============
+*/
+void initAggregation( void )
+{
+  char *env;
+
+  aggregateInterval = 0;
+
+  if( ( env = getenv( RTPROF_AGGREGATE ) ) == NULL || atoi( env ) <= 0 )
+    return;
+
+  if( protocolVersion < 2 ||
+      ( protocolCapabilities & ( CAP_SUMMARY | CAP_FUNCIDS ) ) !=
+      ( CAP_SUMMARY | CAP_FUNCIDS ) )
+  {
+    fprintf( stderr, "WARNING: rtprof does not accept snapshots; "
+                     "sending events instead\n" );
+    return;
+  }
+
+  aggregateInterval = atoi( env );
+}
+
+/*
+===============
+orphanThread
+
+Thread exit handler; the flusher frees the table after sending it
+===============
+*/
+static void orphanThread( void *thread )
+{
+  aggThread_t *t = (aggThread_t *)thread;
+
+  localThread = NULL;
+
+  //nothing can be left on the stack that matters now
+  free( t->frames );
+  free( t->index );
+  free( t->throttle );
+  t->frames = NULL;
+  t->index = NULL;
+  t->throttle = NULL;
+
+  __atomic_store_n( &t->orphaned, true, __ATOMIC_RELEASE );
+}
+
+/*
+===============
+createThreadKey
+
+Create the key used to catch thread exit
+===============
+*/
+static void createThreadKey( void )
+{
+  pthread_key_create( &threadKey, orphanThread );
+}
+
+/*
+===============
+registerThread
+
+Allocate aggregation state for the calling thread
+===============
+*/
+static aggThread_t *registerThread( void )
+{
+  aggThread_t *t;
+
+  pthread_once( &threadKeyOnce, createThreadKey );
+
+  if( ( t = (aggThread_t *)calloc( 1, sizeof( aggThread_t ) ) ) == NULL )
+    return NULL;
+
+  t->maxDepth = AGG_STACK_DEPTH;
+  t->indexSize = AGG_INDEX_SIZE;
+
+  if( ( t->frames = (aggFrame_t *)malloc( t->maxDepth *
+                                          sizeof( aggFrame_t ) ) ) == NULL ||
+      ( t->index = (int *)malloc( t->indexSize * sizeof( int ) ) ) == NULL )
+  {
+    free( t->frames );
+    free( t );
+    return NULL;
+  }
+
+  memset( t->index, -1, t->indexSize * sizeof( int ) );
+
+  pthread_setspecific( threadKey, t );
+
+  //the same as its ring's, so summaries and events are one thread's
+  t->tid = localThreadId( );
+
+  pthread_mutex_lock( &threadsMutex );
+  t->next = threads;
+  threads = t;
+  pthread_mutex_unlock( &threadsMutex );
+
+  localThread = t;
+
+  return t;
+}
+
+/*
+===============
+hashEdge
+
+Spread the bits of a caller/callee pair and call site
+===============
+*/
+static inline unsigned int hashEdge( void *caller, void *callee,
+                                     void *callSite, boolean streamed )
+{
+  unsigned long long h = (unsigned long)caller * 31 + (unsigned long)callee +
+                         (unsigned long)callSite * 17 + streamed;
+
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+
+  return (unsigned int)h;
+}
+
+/*
+===============
+growIndex
+
+Double the size of a thread's edge index
+===============
+*/
+static boolean growIndex( aggThread_t *t )
+{
+  unsigned int  size = t->indexSize * 2, i, j;
+  int           *index;
+  aggEdge_t     *e;
+
+  if( ( index = (int *)malloc( size * sizeof( int ) ) ) == NULL )
+    return false;
+
+  memset( index, -1, size * sizeof( int ) );
+
+  for( i = 0; i < t->numEdges; i++ )
+  {
+    e = AGG_EDGE( t, i );
+
+    for( j = hashEdge( e->caller, e->callee, e->callSite, e->streamed ) &
+             ( size - 1 );
+         index[ j ] >= 0; j = ( j + 1 ) & ( size - 1 ) );
+
+    index[ j ] = i;
+  }
+
+  free( t->index );
+  t->index = index;
+  t->indexSize = size;
+
+  return true;
+}
+
+/*
+===============
+findEdge
+
+Find or add the edge for a caller/callee pair and call site
+===============
+*/
+static aggEdge_t *findEdge( aggThread_t *t, void *caller, void *callee,
+                            void *callSite, boolean streamed )
+{
+  unsigned int  i;
+  int           n = t->numEdges;
+  aggEdge_t     *e;
+
+  for( i = hashEdge( caller, callee, callSite, streamed ) &
+           ( t->indexSize - 1 );
+       t->index[ i ] >= 0; i = ( i + 1 ) & ( t->indexSize - 1 ) )
+  {
+    e = AGG_EDGE( t, t->index[ i ] );
+
+    if( e->caller == caller && e->callee == callee &&
+        e->callSite == callSite && e->streamed == streamed )
+      return e;
+  }
+
+  //keep the index at most half full
+  if( ( n + 1 ) * 2 > t->indexSize )
+  {
+    if( !growIndex( t ) )
+      return NULL;
+
+    return findEdge( t, caller, callee, callSite, streamed );
+  }
+
+  if( n % AGG_CHUNK_EDGES == 0 )
+  {
+    if( n / AGG_CHUNK_EDGES >= AGG_MAX_CHUNKS ||
+        ( t->chunks[ n / AGG_CHUNK_EDGES ] = (aggEdge_t *)calloc(
+            AGG_CHUNK_EDGES, sizeof( aggEdge_t ) ) ) == NULL )
+      return NULL;
+  }
+
+  e = AGG_EDGE( t, n );
+  e->caller = caller;
+  e->callee = callee;
+  e->callSite = callSite;
+  e->streamed = streamed;
+
+  t->index[ i ] = n;
+  __atomic_store_n( &t->numEdges, n + 1, __ATOMIC_RELEASE );
+
+  return e;
+}
+
+/*
+===============
+aggregateThread
+
+Return the calling thread's aggregation state, creating it if needed
+===============
+*/
+aggThread_t *aggregateThread( void )
+{
+  if( localThread != NULL )
+    return localThread;
+
+  return registerThread( );
+}
+
+/*
+===============
+resetAggregateThread
+
+Empty the calling thread's shadow stack, which is stale after being
+detached from rtprof
+===============
+*/
+void resetAggregateThread( void )
+{
+  if( localThread != NULL )
+    localThread->depth = 0;
+}
+
+/*
+===============
+pushFrame
+
+Push a function onto a thread's shadow stack
+===============
+*/
+boolean pushFrame( aggThread_t *t, void *this_fn, void *callSite,
+                   timeStamp_t ts, timeStamp_t cpu, const counters_t *counters,
+                   frameMode_t mode )
+{
+  aggFrame_t  *frames;
+  aggFrame_t  *f;
+
+  if( t->depth == t->maxDepth )
+  {
+    if( ( frames = (aggFrame_t *)realloc( t->frames, 2 * t->maxDepth *
+                                          sizeof( aggFrame_t ) ) ) == NULL )
+      return false;
+
+    t->frames = frames;
+    t->maxDepth *= 2;
+  }
+
+  f = &t->frames[ t->depth++ ];
+  f->this_fn = this_fn;
+  f->callSite = callSite;
+  f->entryTime = ts;
+  f->childTime = 0;
+  f->entryCpu = cpu;
+  f->childCpu = 0;
+  f->entryCounters = *counters;
+  memset( &f->childCounters, 0, sizeof( counters_t ) );
+  f->mode = mode;
+
+  return true;
+}
+
+/*
+===============
+popFrame
+
+Pop a function off a thread's shadow stack, charging its time to the
+caller's frame
+Returns the popped frame, valid until the next push, or NULL if the
+stack was empty
+===============
+*/
+aggFrame_t *popFrame( aggThread_t *t, timeStamp_t ts, timeStamp_t cpu,
+                      const counters_t *counters )
+{
+  aggFrame_t  *f, *parent;
+  int         i;
+
+  if( t->depth == 0 )
+    return NULL;
+
+  f = &t->frames[ --t->depth ];
+
+  if( t->depth > 0 )
+  {
+    parent = &t->frames[ t->depth - 1 ];
+    parent->childTime += ts - f->entryTime;
+    parent->childCpu += cpu - f->entryCpu;
+
+    for( i = 0; i < NUM_COUNTERS; i++ )
+      parent->childCounters.count[ i ] += counters->count[ i ] -
+                                          f->entryCounters.count[ i ];
+  }
+
+  return f;
+}
+
+/*
+===============
+recordFrame
+
+Add a popped frame's times to the edge it was called through
+===============
+*/
+void recordFrame( aggThread_t *t, aggFrame_t *f, timeStamp_t ts,
+                  timeStamp_t cpu, const counters_t *counters )
+{
+  aggEdge_t           *e;
+  void                *caller = NULL;
+  timeStamp_t         total = ts - f->entryTime;
+  timeStamp_t         totalCpu = cpu - f->entryCpu;
+  unsigned long long  count;
+  int                 i;
+
+  if( t->depth > 0 )
+    caller = t->frames[ t->depth - 1 ].this_fn;
+
+  if( ( e = findEdge( t, caller, f->this_fn, f->callSite,
+                      f->mode != FRAME_AGGREGATED ) ) == NULL )
+    return;
+
+  __atomic_store_n( &e->calls, e->calls + 1, __ATOMIC_RELAXED );
+  __atomic_store_n( &e->localTime, e->localTime + total - f->childTime,
+                    __ATOMIC_RELAXED );
+  __atomic_store_n( &e->totalTime, e->totalTime + total, __ATOMIC_RELAXED );
+  __atomic_store_n( &e->localCpu, e->localCpu + totalCpu - f->childCpu,
+                    __ATOMIC_RELAXED );
+  __atomic_store_n( &e->totalCpu, e->totalCpu + totalCpu, __ATOMIC_RELAXED );
+
+  for( i = 0; i < NUM_COUNTERS; i++ )
+  {
+    count = counters->count[ i ] - f->entryCounters.count[ i ];
+
+    __atomic_store_n( &e->localCounts[ i ], e->localCounts[ i ] + count -
+                      f->childCounters.count[ i ], __ATOMIC_RELAXED );
+    __atomic_store_n( &e->totalCounts[ i ], e->totalCounts[ i ] + count,
+                      __ATOMIC_RELAXED );
+  }
+}
+
+/*
+===============
+aggregateEnter
+
+Entry hook for aggregation mode
+===============
+*/
+void aggregateEnter( void *this_fn, void *callSite, timeStamp_t ts,
+                     timeStamp_t cpu, const counters_t *counters )
+{
+  aggThread_t *t;
+
+  if( ( t = aggregateThread( ) ) != NULL )
+    pushFrame( t, this_fn, callSite, compensate( t, ts ),
+               compensateCpu( t, cpu ), counters, FRAME_AGGREGATED );
+}
+
+/*
+===============
+aggregateExit
+
+Exit hook for aggregation mode
+===============
+*/
+void aggregateExit( void *this_fn, timeStamp_t ts, timeStamp_t cpu,
+                    const counters_t *counters )
+{
+  aggThread_t *t = localThread;
+  aggFrame_t  *f;
+
+  if( t != NULL )
+  {
+    ts = compensate( t, ts );
+    cpu = compensateCpu( t, cpu );
+
+    if( ( f = popFrame( t, ts, cpu, counters ) ) != NULL )
+      recordFrame( t, f, ts, cpu, counters );
+  }
+}
+
+/*
+===============
+aggregateThreads
+
+Return the list of threads; everything but the head is stable
+===============
+*/
+aggThread_t *aggregateThreads( void )
+{
+  aggThread_t *t;
+
+  pthread_mutex_lock( &threadsMutex );
+  t = threads;
+  pthread_mutex_unlock( &threadsMutex );
+
+  return t;
+}
+
+/*
+===============
+reapAggregateThreads
+
+Free the tables of exited threads whose final totals have been sent
+===============
+*/
+void reapAggregateThreads( void )
+{
+  aggThread_t **prev, *t;
+  int         i;
+
+  pthread_mutex_lock( &threadsMutex );
+
+  for( prev = &threads; ( t = *prev ) != NULL; )
+  {
+    if( t->drained )
+    {
+      *prev = t->next;
+
+      for( i = 0; i < AGG_MAX_CHUNKS && t->chunks[ i ] != NULL; i++ )
+        free( t->chunks[ i ] );
+
+      free( t );
+    }
+    else
+      prev = &t->next;
+  }
+
+  pthread_mutex_unlock( &threadsMutex );
+}
+
+/*
+===============
+lockAggregation
+
+Hold the thread list still across a fork
+===============
+*/
+void lockAggregation( void )
+{
+  pthread_mutex_lock( &threadsMutex );
+}
+
+/*
+===============
+unlockAggregation
+
+Undo lockAggregation, in the parent or the child
+===============
+*/
+void unlockAggregation( void )
+{
+  pthread_mutex_unlock( &threadsMutex );
+}
+
+/*
+===============
+forkAggregation
+
+Called in the child after a fork; every thread but the caller is gone
+===============
+*/
+void forkAggregation( void )
+{
+  aggThread_t *t;
+
+  pthread_mutex_lock( &threadsMutex );
+
+  for( t = threads; t != NULL; t = t->next )
+  {
+    if( t != localThread )
+      t->orphaned = true;
+  }
+
+  pthread_mutex_unlock( &threadsMutex );
+}
@@ -0,0 +1,206 @@
+/*
+ * Copyright (C) 2003 Tim Angus
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef AGGREGATE_H
+#define AGGREGATE_H
+
+#include "../rtprof/com_common.h"
+#include "../rtprof/com_protocol.h"
+#include "clock.h"
+#include "counters.h"
+
+#define RTPROF_AGGREGATE  "RTPROF_AGGREGATE"
+
+//edges are allocated in chunks that never move, so the flusher can read
+//them while the owning thread adds more
+#define AGG_CHUNK_EDGES   1024
+#define AGG_MAX_CHUNKS    1024
+
+//initial size of a thread's edge index; must be a power of two
+#define AGG_INDEX_SIZE    1024
+
+//initial depth of a thread's shadow stack
+#define AGG_STACK_DEPTH   256
+
+//totals for one caller -> callee pair in one thread, or with
+//trackingCallSites for one call site
+typedef struct aggEdge_s
+{
+  void                        *caller;    //NULL for a thread's root calls
+  void                        *callee;
+  void                        *callSite;  //NULL if not known
+
+  //the caller's own events were streamed, so rtprof has counted this
+  //edge's time as the caller's local time
+  boolean                     streamed;
+
+  //written by the owning thread; they only ever increase
+  volatile unsigned long long calls;
+  volatile unsigned long long localTime;
+  volatile unsigned long long totalTime;
+  volatile unsigned long long localCpu;    //nanoseconds, with cpuTiming
+  volatile unsigned long long totalCpu;
+  volatile unsigned long long localCounts[ NUM_COUNTERS ];  //with counting
+  volatile unsigned long long totalCounts[ NUM_COUNTERS ];
+
+  //what the flusher has already sent
+  unsigned long long          sentCalls;
+  unsigned long long          sentLocalTime;
+  unsigned long long          sentTotalTime;
+  unsigned long long          sentLocalCpu;
+  unsigned long long          sentTotalCpu;
+  unsigned long long          sentLocalCounts[ NUM_COUNTERS ];
+  unsigned long long          sentTotalCounts[ NUM_COUNTERS ];
+} aggEdge_t;
+
+typedef enum
+{
+  FRAME_AGGREGATED,   //added to the edge table on exit
+  FRAME_STREAMED,     //sent to rtprof as events
+  FRAME_THROTTLED,    //aggregated; the caller was streamed
+  FRAME_PENDING       //held back until it calls something or returns
+} frameMode_t;
+
+typedef struct aggFrame_s
+{
+  void          *this_fn;
+  void          *callSite;
+  timeStamp_t   entryTime;
+  timeStamp_t   childTime;
+  timeStamp_t   entryCpu;
+  timeStamp_t   childCpu;
+  counters_t    entryCounters;
+  counters_t    childCounters;
+  frameMode_t   mode;
+} aggFrame_t;
+
+typedef struct aggThread_s
+{
+  unsigned int          tid;
+  volatile boolean      orphaned;
+
+  //set by the flusher once an orphaned thread's final totals are sent
+  boolean               drained;
+
+  //only touched by the owning thread
+  aggFrame_t            *frames;
+  int                   depth, maxDepth;
+  int                   *index;
+  unsigned int          indexSize;
+  struct throttleSlot_s *throttle;
+
+  //hook overhead so far, times OVERHEAD_SCALE, and the last timestamp it
+  //was taken out of; see compensate. Likewise for cpu time
+  timeStamp_t           overhead;
+  timeStamp_t           lastTime;
+  timeStamp_t           cpuOverhead;
+  timeStamp_t           lastCpu;
+
+  //published to the flusher with release stores
+  volatile int          numEdges;
+  aggEdge_t             *chunks[ AGG_MAX_CHUNKS ];
+
+  struct aggThread_s    *next;
+} aggThread_t;
+
+#define AGG_EDGE(t,i) ( &(t)->chunks[ (i) / AGG_CHUNK_EDGES ] \
+                                    [ (i) % AGG_CHUNK_EDGES ] )
+
+//milliseconds between snapshots, or 0 when sending raw events
+extern int  aggregateInterval;
+
+void          initAggregation( void );
+void          aggregateEnter( void *this_fn, void *callSite, timeStamp_t ts,
+                              timeStamp_t cpu, const counters_t *counters );
+void          aggregateExit( void *this_fn, timeStamp_t ts, timeStamp_t cpu,
+                             const counters_t *counters );
+aggThread_t   *aggregateThreads( void );
+void          reapAggregateThreads( void );
+void          lockAggregation( void );
+void          unlockAggregation( void );
+void          forkAggregation( void );
+
+aggThread_t   *aggregateThread( void );
+void          resetAggregateThread( void );
+boolean       pushFrame( aggThread_t *t, void *this_fn, void *callSite,
+                         timeStamp_t ts, timeStamp_t cpu,
+                         const counters_t *counters, frameMode_t mode );
+aggFrame_t    *popFrame( aggThread_t *t, timeStamp_t ts, timeStamp_t cpu,
+                         const counters_t *counters );
+void          recordFrame( aggThread_t *t, aggFrame_t *f, timeStamp_t ts,
+                           timeStamp_t cpu, const counters_t *counters );
+
+/*
+===============
+compensateClock
+
+Take *overhead / OVERHEAD_SCALE out of a reading of some clock, then add
+the cost of another hook to it
+===============
+*/
+static inline timeStamp_t compensateClock( timeStamp_t *overhead,
+                                           timeStamp_t *last,
+                                           timeStamp_t ts, timeStamp_t cost )
+{
+  timeStamp_t adjusted = ts - *overhead / OVERHEAD_SCALE;
+
+  //the hooks can't have taken longer than the time that passed
+  if( *overhead / OVERHEAD_SCALE > ts || adjusted < *last )
+  {
+    adjusted = *last;
+    *overhead = ( ts - adjusted ) * OVERHEAD_SCALE;
+  }
+
+  *last = adjusted;
+  *overhead += cost;
+
+  return adjusted;
+}
+
+/*
+===============
+compensate
+
+Take the cost of the hooks so far out of an aggregated event's timestamp,
+as rtprof does for streamed ones. Only differences between timestamps
+matter, and everything between an aggregated frame's entry and exit is
+aggregated too, so streamed events needn't be counted here.
+===============
+*/
+static inline timeStamp_t compensate( aggThread_t *t, timeStamp_t ts )
+{
+  return compensateClock( &t->overhead, &t->lastTime, ts, hookOverhead );
+}
+
+/*
+===============
+compensateCpu
+
+As compensate, for an aggregated event's cpu time
+===============
+*/
+static inline timeStamp_t compensateCpu( aggThread_t *t, timeStamp_t cpu )
+{
+  if( !cpuTiming )
+    return 0;
+
+  return compensateClock( &t->cpuOverhead, &t->lastCpu, cpu,
+                          hookCpuOverhead );
+}
+
+#endif
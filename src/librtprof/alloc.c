@@ -0,0 +1,325 @@
+/*
+ * Copyright (C) 2003 Tim Angus
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dlfcn.h>
+
+#include "alloc.h"
+#include "clock.h"
+#include "heap.h"
+
+boolean                   trackingAllocs = false;
+__thread boolean          inHook INITIAL_EXEC = false;
+
+extern volatile boolean   attached;
+
+//glibc's own allocator, in case there is nothing else to find
+extern void *__libc_malloc( size_t size );
+extern void *__libc_calloc( size_t n, size_t size );
+extern void *__libc_realloc( void *ptr, size_t size );
+extern void __libc_free( void *ptr );
+
+//the allocator librtprof stands in front of
+static void               *( *realMalloc )( size_t size );
+static void               *( *realCalloc )( size_t n, size_t size );
+static void               *( *realRealloc )( void *ptr, size_t size );
+static void               ( *realFree )( void *ptr );
+static volatile boolean   resolved = false;
+
+//dlsym can allocate while the allocator is being looked up, so the
+//thread doing it is handed memory from here, which is never freed
+#define BOOTSTRAP_BYTES   16384
+#define BOOTSTRAP_ALIGN   16
+
+static unsigned char      bootstrap[ BOOTSTRAP_BYTES ]
+                          __attribute__ ( ( aligned( BOOTSTRAP_ALIGN ) ) );
+static unsigned int       bootstrapUsed = 0;
+static __thread boolean   resolving INITIAL_EXEC = false;
+
+//the calling thread's totals for the allocation counters; time is in
+//clock ticks until sampled
+static __thread unsigned long long  allocCounts[ NUM_ALLOC_COUNTERS ]
+                                    INITIAL_EXEC;
+
+#define ALLOC_COUNT(c)    allocCounts[ (c) - CNT_ALLOCS ]
+
+#define IN_BOOTSTRAP(p)   ( (unsigned char *)(p) >= bootstrap && \
+                            (unsigned char *)(p) < bootstrap + BOOTSTRAP_BYTES )
+
+/*
+===============
+bootstrapAlloc
+
+Hand out zeroed memory while the allocator is being looked up
+===============
+*/
+static void *bootstrapAlloc( size_t size )
+{
+  unsigned int offset;
+
+  if( size > BOOTSTRAP_BYTES )
+    return NULL;
+
+  size = ( size + BOOTSTRAP_ALIGN - 1 ) & ~( BOOTSTRAP_ALIGN - 1 );
+  offset = __atomic_fetch_add( &bootstrapUsed, size, __ATOMIC_RELAXED );
+
+  if( offset + size > BOOTSTRAP_BYTES )
+    return NULL;
+
+  return bootstrap + offset;
+}
+
+/*
+===============
+resolveAllocator
+
+Find whichever malloc and friends would have been used without
+librtprof, which needn't be glibc's
+===============
+*/
+static void resolveAllocator( void )
+{
+  resolving = true;
+
+  if( ( realMalloc = dlsym( RTLD_NEXT, "malloc" ) ) == NULL ||
+      ( realCalloc = dlsym( RTLD_NEXT, "calloc" ) ) == NULL ||
+      ( realRealloc = dlsym( RTLD_NEXT, "realloc" ) ) == NULL ||
+      ( realFree = dlsym( RTLD_NEXT, "free" ) ) == NULL )
+  {
+    realMalloc = __libc_malloc;
+    realCalloc = __libc_calloc;
+    realRealloc = __libc_realloc;
+    realFree = __libc_free;
+  }
+
+  resolving = false;
+
+  __atomic_store_n( &resolved, true, __ATOMIC_RELEASE );
+}
+
+/*
+===============
+allocatorReady
+
+Can the real allocator be called yet? Looks it up if not, unless the
+calling thread is already doing so
+===============
+*/
+static inline boolean allocatorReady( void )
+{
+  if( __atomic_load_n( &resolved, __ATOMIC_ACQUIRE ) )
+    return true;
+
+  if( resolving )
+    return false;
+
+  resolveAllocator( );
+
+  return true;
+}
+
+/*
+===============
+countAlloc
+
+Add a call to the allocator to the calling thread's totals
+===============
+*/
+static inline void countAlloc( counter_t counter, size_t size,
+                               timeStamp_t start )
+{
+  ALLOC_COUNT( counter )++;
+  ALLOC_COUNT( CNT_ALLOC_BYTES ) += size;
+  ALLOC_COUNT( CNT_ALLOC_TIME ) += readClock( ) - start;
+}
+
+/*
+===============
+watchingAllocs
+
+Is there more to do than call the real allocator?
+===============
+*/
+static inline boolean watchingAllocs( void )
+{
+  return ( trackingAllocs || ( heapInterval > 0 && attached ) ) && !inHook;
+}
+
+/*
+===============
+allocated
+
+Count an allocation and pass it on to the heap sampler, as wanted
+===============
+*/
+static inline void allocated( void *p, size_t size, timeStamp_t start )
+{
+  if( trackingAllocs )
+    countAlloc( CNT_ALLOCS, size, start );
+
+  if( heapInterval > 0 && attached )
+    heapAllocated( p, size );
+}
+
+/*
+===============
+sampleAllocs
+
+Fill in the calling thread's allocation counters
+===============
+*/
+void sampleAllocs( unsigned long long *counts )
+{
+  if( !trackingAllocs )
+  {
+    memset( counts + CNT_ALLOCS, 0, sizeof( allocCounts ) );
+    return;
+  }
+
+  memcpy( counts + CNT_ALLOCS, allocCounts, sizeof( allocCounts ) );
+
+  counts[ CNT_ALLOC_TIME ] = (unsigned long long)(
+    (double)ALLOC_COUNT( CNT_ALLOC_TIME ) * 1.0e9 / (double)clockRate( ) );
+}
+
+/*
+===============
+malloc
+
+Counted and sampled malloc
+===============
+*/
+void *malloc( size_t size )
+{
+  timeStamp_t start;
+  void        *p;
+
+  if( !allocatorReady( ) )
+    return bootstrapAlloc( size );
+
+  if( !watchingAllocs( ) )
+    return realMalloc( size );
+
+  start = trackingAllocs ? readClock( ) : 0;
+  p = realMalloc( size );
+  allocated( p, size, start );
+
+  return p;
+}
+
+/*
+===============
+calloc
+
+Counted and sampled calloc
+===============
+*/
+void *calloc( size_t n, size_t size )
+{
+  timeStamp_t start;
+  void        *p;
+
+  //bootstrap memory is never reused, so is already zeroed
+  if( !allocatorReady( ) )
+    return n > 0 && size > BOOTSTRAP_BYTES / n ? NULL :
+           bootstrapAlloc( n * size );
+
+  if( !watchingAllocs( ) )
+    return realCalloc( n, size );
+
+  start = trackingAllocs ? readClock( ) : 0;
+  p = realCalloc( n, size );
+  allocated( p, n * size, start );
+
+  return p;
+}
+
+/*
+===============
+realloc
+
+Counted and sampled realloc
+===============
+*/
+void *realloc( void *ptr, size_t size )
+{
+  timeStamp_t start;
+  void        *p;
+  size_t      old;
+
+  if( !allocatorReady( ) )
+    return ptr == NULL ? bootstrapAlloc( size ) : NULL;
+
+  //the real allocator has never heard of bootstrap memory; its size
+  //isn't known, but it can't run past the end of the buffer
+  if( IN_BOOTSTRAP( ptr ) )
+  {
+    old = bootstrap + BOOTSTRAP_BYTES - (unsigned char *)ptr;
+
+    if( ( p = malloc( size ) ) != NULL )
+      memcpy( p, ptr, old < size ? old : size );
+
+    return p;
+  }
+
+  //the memory moves, or is freed for a size of 0; if the real realloc
+  //fails the old block lives on unsampled
+  if( ptr != NULL )
+    heapFreed( ptr );
+
+  if( !watchingAllocs( ) )
+    return realRealloc( ptr, size );
+
+  start = trackingAllocs ? readClock( ) : 0;
+  p = realRealloc( ptr, size );
+  allocated( p, size, start );
+
+  return p;
+}
+
+/*
+===============
+free
+
+Counted and sampled free
+===============
+*/
+void free( void *ptr )
+{
+  timeStamp_t start;
+
+  if( ptr == NULL || IN_BOOTSTRAP( ptr ) || !allocatorReady( ) )
+    return;
+
+  //memory sampled while attached can be freed at any time
+  heapFreed( ptr );
+
+  if( !trackingAllocs || inHook )
+  {
+    realFree( ptr );
+    return;
+  }
+
+  start = readClock( );
+  realFree( ptr );
+  countAlloc( CNT_FREES, 0, start );
+}
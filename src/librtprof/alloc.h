@@ -0,0 +1,40 @@
+/*
+ * Copyright (C) 2003 Tim Angus
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef ALLOC_H
+#define ALLOC_H
+
+#include "../rtprof/com_common.h"
+
+#define RTPROF_ALLOCS "RTPROF_ALLOCS"
+
+//the counters from CNT_ALLOCS on that are about allocation
+#define NUM_ALLOC_COUNTERS  ( CNT_LOCK_WAITS - CNT_ALLOCS )
+
+//initial exec, as anything else could call malloc
+#define INITIAL_EXEC  __attribute__ ( ( tls_model( "initial-exec" ) ) )
+
+//whether malloc and friends are counted, as agreed with rtprof
+extern boolean          trackingAllocs;
+
+//set while the hooks run, so librtprof's own allocations aren't counted
+extern __thread boolean inHook INITIAL_EXEC;
+
+void sampleAllocs( unsigned long long *counts );
+
+#endif
@@ -0,0 +1,123 @@
+/*
+ * Copyright (C) 2003 Tim Angus
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <string.h>
+
+#include "annotate.h"
+
+#define ANNOTATION_MASK     ( ANNOTATION_SLOTS - 1 )
+#define ANNOTATION_HASH(p)  ( (unsigned int)( (unsigned long)(p) * \
+                                              0x9e3779b97f4a7c15ULL >> 40 ) )
+
+boolean             trackingZones = false;
+
+//open addressed by the address of the name; NULL marks an empty slot,
+//and a slot, once taken, is never given up
+static const char   *names[ ANNOTATION_SLOTS ];
+
+//whether rtprof has been given the name in a slot in this stream
+static boolean      announced[ ANNOTATION_SLOTS ];
+
+/*
+===============
+internAnnotation
+
+Return the slot for a zone or counter name, taking a free one if it
+hasn't been seen before
+Returns -1 if every slot is taken
+===============
+*/
+int internAnnotation( const char *name )
+{
+  unsigned int  i = ANNOTATION_HASH( name ) & ANNOTATION_MASK, n;
+  const char    *p;
+
+  for( n = 0; n < ANNOTATION_SLOTS; n++, i = ( i + 1 ) & ANNOTATION_MASK )
+  {
+    p = __atomic_load_n( &names[ i ], __ATOMIC_ACQUIRE );
+
+    if( p == NULL )
+    {
+      if( __sync_bool_compare_and_swap( &names[ i ], NULL, name ) )
+        return (int)i;
+
+      //another thread got there first
+      p = __atomic_load_n( &names[ i ], __ATOMIC_ACQUIRE );
+    }
+
+    if( p == name )
+      return (int)i;
+  }
+
+  return -1;
+}
+
+/*
+===============
+isAnnotation
+
+Whether an address is that of a zone or counter name
+===============
+*/
+boolean isAnnotation( const void *p )
+{
+  unsigned int  i = ANNOTATION_HASH( p ) & ANNOTATION_MASK, n;
+  const char    *q;
+
+  for( n = 0; n < ANNOTATION_SLOTS; n++, i = ( i + 1 ) & ANNOTATION_MASK )
+  {
+    if( ( q = __atomic_load_n( &names[ i ], __ATOMIC_ACQUIRE ) ) == NULL )
+      return false;
+
+    if( q == p )
+      return true;
+  }
+
+  return false;
+}
+
+/*
+===============
+announceAnnotation
+
+Whether the name in a slot has yet to be given to rtprof, marking it as
+given
+===============
+*/
+boolean announceAnnotation( int slot )
+{
+  if( announced[ slot ] )
+    return false;
+
+  announced[ slot ] = true;
+
+  return true;
+}
+
+/*
+===============
+resetAnnotations
+
+Forget which names rtprof has been given, for when a new stream is
+started
+===============
+*/
+void resetAnnotations( void )
+{
+  memset( announced, 0, sizeof( announced ) );
+}
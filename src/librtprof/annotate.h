@@ -0,0 +1,41 @@
+/*
+ * Copyright (C) 2003 Tim Angus
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef ANNOTATE_H
+#define ANNOTATE_H
+
+#include "../rtprof/com_common.h"
+
+//distinct zone and counter names that can be told apart; must be a
+//power of two
+#define ANNOTATION_SLOTS    4096
+
+//longest name sent to rtprof; longer ones are cut short
+#define ANNOTATION_NAME_MAX 64
+
+//whether zones and counters go to rtprof, as agreed with it
+extern boolean  trackingZones;
+
+//names are only ever added, by any thread, and never locked; the rest
+//is only for the thread draining the rings
+int           internAnnotation( const char *name );
+boolean       isAnnotation( const void *p );
+boolean       announceAnnotation( int slot );
+void          resetAnnotations( void );
+
+#endif
@@ -0,0 +1,1704 @@
+/*
+ * Copyright (C) 2003 Tim Angus
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "buffer.h"
+#include "comms.h"
+#include "functions.h"
+#include "annotate.h"
+#include "aggregate.h"
+#include "filter.h"
+#include "heap.h"
+#include "locks.h"
+#include "loadmap.h"
+#include "../rtprof/com_protocol.h"
+
+//every thread that has emitted an event owns one of these
+static eventRing_t            *rings = NULL;
+static pthread_mutex_t        ringsMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t          ringKey;
+static pthread_once_t         ringKeyOnce = PTHREAD_ONCE_INIT;
+static unsigned int           nextThreadId = 0;
+
+//ids given back by threads that have exited, handed out again first
+static unsigned int           *freeThreadIds = NULL;
+static int                    numFreeThreadIds = 0;
+static int                    maxFreeThreadIds = 0;
+
+//how many of a thread's ring and aggregation state hold each id, which
+//is only retired once neither does; a fiber's is only ever held once
+static unsigned char          *threadIdHolds = NULL;
+static unsigned int           maxThreadIdHolds = 0;
+static __thread int           localThreadIdHeld INITIAL_EXEC = -1;
+
+//ids of fibers that have ended; see retireFibers
+static unsigned int           *retiring = NULL;
+static int                    numRetiring = 0;
+static int                    maxRetiring = 0;
+static int                    readyRetiring = 0;
+static __thread eventRing_t   *localRing = NULL;
+
+extern volatile boolean       attached;
+
+boolean                       trackingCallSites = false;
+
+static pthread_t              flusherThread;
+static boolean                flusherStarted = false;
+static volatile boolean       flushing = false;
+
+//only ever touched by whichever thread is draining the rings
+static unsigned char          *flushBuffer = NULL;
+static int                    flushBufferSize = 0;
+static int                    lastThreadSent = -1;
+
+//the version 2 record currently being built, if any
+static int                    recordStart = -1;
+static timeStamp_t            batchTs;
+static timeStamp_t            batchCpu;
+static counters_t             batchCounters;
+static unsigned long          batchFn;
+
+#define BATCH_HEADER_BYTES  ( 1 + RECORD_LENGTH_BYTES + \
+                              ( 3 + NUM_COUNTERS ) * MAX_VARINT )
+#define BATCH_EVENT_BYTES   ( ( 4 + NUM_COUNTERS ) * MAX_VARINT )
+#define FUNCTION_BYTES      ( 1 + MAX_VARINT + 2 * MAX_VARINT + \
+                              ANNOTATION_NAME_MAX )
+#define COUNTER_BYTES       ( 1 + RECORD_LENGTH_BYTES + 3 * MAX_VARINT + \
+                              ANNOTATION_NAME_MAX )
+#define SUMMARY_HEADER_BYTES  ( 1 + RECORD_LENGTH_BYTES + MAX_VARINT )
+#define SUMMARY_EDGE_BYTES    ( ( 8 + 2 * NUM_COUNTERS ) * MAX_VARINT )
+#define HEAP_HEADER_BYTES     ( 1 + RECORD_LENGTH_BYTES + MAX_VARINT )
+#define HEAP_PATH_BYTES       ( ( 3 + HEAP_MAX_DEPTH ) * MAX_VARINT )
+#define MODULE_BYTES(n)       ( 1 + RECORD_LENGTH_BYTES + MAX_VARINT + (n) )
+#define LOCKS_HEADER_BYTES    ( 1 + RECORD_LENGTH_BYTES + MAX_VARINT )
+#define LOCK_SITE_BYTES       ( 4 * MAX_VARINT )
+#define RETIRE_BYTES          ( 1 + RECORD_LENGTH_BYTES + MAX_VARINT )
+
+//the last REC_HEAP snapshot sent
+static boolean                heapSent = false;
+static unsigned int           heapSentChanges;
+static timeStamp_t            heapSentTs;
+
+//the last REC_LOCKS snapshot sent
+static boolean                locksSent = false;
+static unsigned int           locksSentChanges;
+static timeStamp_t            locksSentTs;
+
+//when the last REC_SUMMARYs were sent
+static boolean                aggregatesSent = false;
+static timeStamp_t            aggregatesSentTs;
+
+/*
+===============
+orphanRing
+
+Thread exit handler; hands the ring over to the flusher
+===============
+*/
+static void orphanRing( void *ring )
+{
+  localRing = NULL;
+  __atomic_store_n( &( (eventRing_t *)ring )->orphaned, true, __ATOMIC_RELEASE );
+}
+
+/*
+===============
+createRingKey
+
+Create the key used to catch thread exit
+===============
+*/
+static void createRingKey( void )
+{
+  pthread_key_create( &ringKey, orphanRing );
+}
+
+/*
+===============
+holdThreadId
+
+Count another holder of an id; call with ringsMutex held
+===============
+*/
+static void holdThreadId( unsigned int tid, boolean first )
+{
+  unsigned char *holds;
+  unsigned int  newSize;
+
+  if( tid >= maxThreadIdHolds )
+  {
+    newSize = maxThreadIdHolds ? maxThreadIdHolds * 2 : 256;
+
+    while( newSize <= tid )
+      newSize *= 2;
+
+    //without room for it the id is retired by whichever lets go first
+    if( ( holds = (unsigned char *)realloc( threadIdHolds, newSize ) ) == NULL )
+      return;
+
+    memset( holds + maxThreadIdHolds, 0, newSize - maxThreadIdHolds );
+    threadIdHolds = holds;
+    maxThreadIdHolds = newSize;
+  }
+
+  threadIdHolds[ tid ] = first ? 1 : threadIdHolds[ tid ] + 1;
+}
+
+/*
+===============
+newThreadId
+
+Allocate the small dense id rtprof knows a thread or fiber by
+===============
+*/
+unsigned int newThreadId( void )
+{
+  unsigned int tid;
+
+  pthread_mutex_lock( &ringsMutex );
+
+  if( numFreeThreadIds > 0 )
+    tid = freeThreadIds[ --numFreeThreadIds ];
+  else
+    tid = nextThreadId++;
+
+  holdThreadId( tid, true );
+
+  pthread_mutex_unlock( &ringsMutex );
+
+  return tid;
+}
+
+/*
+===============
+localThreadId
+
+The id the calling thread is known by, shared by its ring and its
+aggregation state so that rtprof charges both to the same thread; each
+caller holds it until it is retired
+===============
+*/
+unsigned int localThreadId( void )
+{
+  unsigned int tid;
+
+  if( localThreadIdHeld < 0 )
+  {
+    tid = newThreadId( );
+    localThreadIdHeld = tid;
+    return tid;
+  }
+
+  tid = localThreadIdHeld;
+
+  pthread_mutex_lock( &ringsMutex );
+  holdThreadId( tid, false );
+  pthread_mutex_unlock( &ringsMutex );
+
+  return tid;
+}
+
+/*
+===============
+dropThreadId
+
+Let go of an id; returns whether nothing holds it any more
+===============
+*/
+static boolean dropThreadId( unsigned int tid )
+{
+  boolean last = true;
+
+  pthread_mutex_lock( &ringsMutex );
+
+  if( tid < maxThreadIdHolds && threadIdHolds[ tid ] > 1 )
+  {
+    threadIdHolds[ tid ]--;
+    last = false;
+  }
+
+  pthread_mutex_unlock( &ringsMutex );
+
+  return last;
+}
+
+/*
+===============
+releaseThreadId
+
+Give back an id no longer in use, to be handed out again
+===============
+*/
+void releaseThreadId( unsigned int tid )
+{
+  unsigned int  *ids;
+  int           newSize;
+
+  pthread_mutex_lock( &ringsMutex );
+
+  if( numFreeThreadIds == maxFreeThreadIds )
+  {
+    newSize = maxFreeThreadIds ? maxFreeThreadIds * 2 : 256;
+
+    if( ( ids = (unsigned int *)realloc( freeThreadIds,
+            newSize * sizeof( unsigned int ) ) ) != NULL )
+    {
+      freeThreadIds = ids;
+      maxFreeThreadIds = newSize;
+    }
+  }
+
+  //otherwise it is never used again, which is safe
+  if( numFreeThreadIds < maxFreeThreadIds )
+    freeThreadIds[ numFreeThreadIds++ ] = tid;
+
+  pthread_mutex_unlock( &ringsMutex );
+}
+
+/*
+===============
+registerRing
+
+Allocate a ring for the calling thread
+===============
+*/
+static eventRing_t *registerRing( void )
+{
+  eventRing_t *ring;
+
+  pthread_once( &ringKeyOnce, createRingKey );
+
+  if( ( ring = (eventRing_t *)malloc( sizeof( eventRing_t ) ) ) == NULL )
+    return NULL;
+
+  ring->head = ring->tail = 0;
+  ring->orphaned = false;
+  ring->counters = NULL;
+
+  pthread_setspecific( ringKey, ring );
+
+  ring->tid = localThreadId( );
+
+  pthread_mutex_lock( &ringsMutex );
+  ring->next = rings;
+  rings = ring;
+  pthread_mutex_unlock( &ringsMutex );
+
+  localRing = ring;
+
+  return ring;
+}
+
+/*
+===============
+nextEvent
+
+The calling thread's next free slot, once the flusher has made room;
+NULL if there is no ring or nothing left to wait for. Publish it by
+bumping the ring's head
+===============
+*/
+static ringEvent_t *nextEvent( eventRing_t **ringOut )
+{
+  eventRing_t   *ring = localRing;
+  unsigned int  head;
+
+  if( ring == NULL && ( ring = registerRing( ) ) == NULL )
+    return NULL;
+
+  head = ring->head;
+
+  //ring is full; wait for the flusher to catch up
+  while( head - __atomic_load_n( &ring->tail, __ATOMIC_ACQUIRE ) >= RING_EVENTS )
+  {
+    if( !flushing )
+      return NULL;
+
+    sched_yield( );
+  }
+
+  *ringOut = ring;
+
+  return &ring->events[ head & RING_MASK ];
+}
+
+/*
+===============
+queueEvent
+
+Add an event to the calling thread's ring
+===============
+*/
+void queueEvent( unsigned int type, void *this_fn, void *callSite,
+                 timeStamp_t ts, timeStamp_t cpu, const counters_t *counters )
+{
+  eventRing_t   *ring;
+  ringEvent_t   *ev;
+
+  if( ( ev = nextEvent( &ring ) ) == NULL )
+    return;
+
+  ev->type = type;
+  ev->this_fn = this_fn;
+  ev->callSite = callSite;
+  ev->ts = ts;
+  ev->cpu = cpu;
+
+  //nothing is read when no counters are being collected
+  if( countersWanted( ) )
+  {
+    if( ring->counters == NULL )
+      ring->counters = (counters_t *)calloc( RING_EVENTS,
+                                             sizeof( counters_t ) );
+
+    if( ring->counters != NULL )
+      ring->counters[ ring->head & RING_MASK ] = *counters;
+  }
+
+  __atomic_store_n( &ring->head, ring->head + 1, __ATOMIC_RELEASE );
+}
+
+/*
+===============
+queueCounter
+
+Add an EV_COUNTER to the calling thread's ring
+===============
+*/
+void queueCounter( const char *name, timeStamp_t ts, long long value )
+{
+  eventRing_t   *ring;
+  ringEvent_t   *ev;
+
+  if( ( ev = nextEvent( &ring ) ) == NULL )
+    return;
+
+  ev->type = EV_COUNTER;
+  ev->this_fn = (void *)name;
+  ev->callSite = NULL;
+  ev->ts = ts;
+  ev->value = value;
+
+  __atomic_store_n( &ring->head, ring->head + 1, __ATOMIC_RELEASE );
+}
+
+/*
+===============
+writeFlushBuffer
+
+Send whatever is in the flush buffer to rtprof
+===============
+*/
+static int writeFlushBuffer( void )
+{
+  if( flushBufferSize > 0 && endSendToRtprof( flushBufferSize ) < 0 )
+    return -1;
+
+  flushBuffer = NULL;
+  flushBufferSize = 0;
+
+  return 0;
+}
+
+/*
+===============
+reserveFlushBuffer
+
+Make sure there is a flush buffer to append to
+===============
+*/
+static int reserveFlushBuffer( void )
+{
+  if( flushBuffer == NULL &&
+      ( flushBuffer = beginSendToRtprof( FLUSH_BUFFER ) ) == NULL )
+    return -1;
+
+  return 0;
+}
+
+/*
+===============
+appendEvent
+
+Add a functionEvent_t to the flush buffer, sending it first if full
+===============
+*/
+static int appendEvent( eventRing_t *ring, unsigned int tail,
+                        unsigned char type, void *this_fn, timeStamp_t ts )
+{
+  functionEvent_t fe;
+
+  if( flushBufferSize + sizeof( functionEvent_t ) > FLUSH_BUFFER )
+  {
+    //give the slots back before blocking in send
+    __atomic_store_n( &ring->tail, tail, __ATOMIC_RELEASE );
+
+    if( writeFlushBuffer( ) < 0 )
+      return -1;
+  }
+
+  if( reserveFlushBuffer( ) < 0 )
+    return -1;
+
+  fe.type = type;
+  fe.this_fn = this_fn;
+  fe.ts = ts;
+
+  memcpy( flushBuffer + flushBufferSize, &fe, sizeof( functionEvent_t ) );
+  flushBufferSize += sizeof( functionEvent_t );
+
+  return 0;
+}
+
+/*
+===============
+openRecord
+
+Start a new version 2 record in the flush buffer
+===============
+*/
+static void openRecord( unsigned char tag )
+{
+  recordStart = flushBufferSize;
+
+  flushBuffer[ flushBufferSize ] = tag;
+  flushBufferSize += 1 + RECORD_LENGTH_BYTES;
+}
+
+/*
+===============
+closeRecord
+
+Fill in the length of the current record
+===============
+*/
+static void closeRecord( void )
+{
+  if( recordStart < 0 )
+    return;
+
+  writeFixedVarint( flushBuffer + recordStart + 1,
+                    flushBufferSize - ( recordStart + 1 + RECORD_LENGTH_BYTES ),
+                    RECORD_LENGTH_BYTES );
+
+  recordStart = -1;
+}
+
+/*
+===============
+eventCounters
+
+The counters read with a ring's event, or zeros if it has none
+===============
+*/
+static inline const counters_t *eventCounters( eventRing_t *ring,
+                                               unsigned int tail )
+{
+  static const counters_t none;
+
+  if( ring->counters == NULL )
+    return &none;
+
+  return &ring->counters[ tail & RING_MASK ];
+}
+
+/*
+===============
+openBatch
+
+Start a new REC_BATCH in the flush buffer
+===============
+*/
+static void openBatch( unsigned int tid, timeStamp_t ts, timeStamp_t cpu,
+                       const counters_t *counters )
+{
+  int i;
+
+  openRecord( REC_BATCH );
+
+  flushBufferSize += writeVarint( flushBuffer + flushBufferSize, tid );
+  flushBufferSize += writeVarint( flushBuffer + flushBufferSize, ts );
+
+  if( protocolCapabilities & CAP_CPUTIME )
+    flushBufferSize += writeVarint( flushBuffer + flushBufferSize, cpu );
+
+  batchTs = ts;
+  batchCpu = cpu;
+  batchFn = 0;
+
+  if( !countersWanted( ) )
+    return;
+
+  for( i = 0; i < NUM_COUNTERS; i++ )
+  {
+    if( protocolCapabilities & counterCapability( i ) )
+      flushBufferSize += writeVarint( flushBuffer + flushBufferSize,
+                                      counters->count[ i ] );
+  }
+
+  batchCounters = *counters;
+}
+
+/*
+===============
+appendFunction
+
+Add a REC_FUNCTION to the flush buffer, naming it if it is a zone
+===============
+*/
+static int appendFunction( eventRing_t *ring, unsigned int tail,
+                           unsigned int id, void *this_fn )
+{
+  unsigned char body[ 2 * MAX_VARINT + ANNOTATION_NAME_MAX ];
+  int           size, n;
+
+  if( flushBufferSize + FUNCTION_BYTES > FLUSH_BUFFER )
+  {
+    //give the slots back before blocking in send
+    if( ring != NULL )
+      __atomic_store_n( &ring->tail, tail, __ATOMIC_RELEASE );
+
+    if( writeFlushBuffer( ) < 0 )
+      return -1;
+  }
+
+  if( reserveFlushBuffer( ) < 0 )
+    return -1;
+
+  size = writeVarint( body, id );
+  size += writeVarint( body + size, (unsigned long)this_fn );
+
+  if( trackingZones && isAnnotation( this_fn ) )
+  {
+    n = strnlen( (const char *)this_fn, ANNOTATION_NAME_MAX );
+    memcpy( body + size, this_fn, n );
+    size += n;
+  }
+
+  flushBuffer[ flushBufferSize++ ] = REC_FUNCTION;
+  flushBufferSize += writeVarint( flushBuffer + flushBufferSize, size );
+
+  memcpy( flushBuffer + flushBufferSize, body, size );
+  flushBufferSize += size;
+
+  return 0;
+}
+
+/*
+===============
+batchId
+
+Return the id for a function or call site in *id, defining it first if
+it is new
+Returns -1 on failure
+===============
+*/
+static int batchId( eventRing_t *ring, unsigned int tail, void *p,
+                    unsigned int *id )
+{
+  boolean isNew;
+
+  *id = internFunction( p, &isNew );
+
+  //the definition has to arrive before the batch that uses it
+  if( isNew )
+  {
+    closeRecord( );
+
+    if( appendFunction( ring, tail, *id, p ) < 0 )
+      return -1;
+  }
+
+  return 0;
+}
+
+/*
+===============
+appendBatchEvent
+
+Add an event to the current REC_BATCH, starting a new one if needed
+===============
+*/
+static int appendBatchEvent( eventRing_t *ring, unsigned int tail,
+                             ringEvent_t *ev )
+{
+  long long         deltaTs, deltaFn;
+  boolean           useIds = ( protocolCapabilities & CAP_FUNCIDS ) != 0;
+  boolean           useSites = ( protocolCapabilities & CAP_CALLSITES ) != 0;
+  unsigned int      id = 0, siteId = 0;
+  const counters_t  *counters;
+  int               i;
+
+  if( useIds && ev->type == EV_ENTER )
+  {
+    if( batchId( ring, tail, ev->this_fn, &id ) < 0 )
+      return -1;
+
+    //0 stands for not knowing
+    if( useSites && ev->callSite != NULL )
+    {
+      if( batchId( ring, tail, ev->callSite, &siteId ) < 0 )
+        return -1;
+
+      siteId++;
+    }
+  }
+
+  if( recordStart >= 0 && flushBufferSize + BATCH_EVENT_BYTES > FLUSH_BUFFER )
+    closeRecord( );
+
+  if( recordStart < 0 )
+  {
+    if( flushBufferSize + BATCH_HEADER_BYTES + BATCH_EVENT_BYTES > FLUSH_BUFFER )
+    {
+      //give the slots back before blocking in send
+      __atomic_store_n( &ring->tail, tail, __ATOMIC_RELEASE );
+
+      if( writeFlushBuffer( ) < 0 )
+        return -1;
+    }
+
+    if( reserveFlushBuffer( ) < 0 )
+      return -1;
+
+    openBatch( ring->tid, ev->ts, ev->cpu, eventCounters( ring, tail ) );
+  }
+
+  deltaTs = (long long)( ev->ts - batchTs );
+  deltaFn = (long long)( (unsigned long)ev->this_fn - batchFn );
+
+  flushBufferSize += writeVarint( flushBuffer + flushBufferSize,
+                                  ( ZIGZAG( deltaTs ) << BATCH_KIND_BITS ) |
+                                  ev->type );
+
+  if( ev->type == EV_THREAD )
+    flushBufferSize += writeVarint( flushBuffer + flushBufferSize,
+                                    (unsigned long)ev->this_fn );
+  else if( !useIds )
+    flushBufferSize += writeVarint( flushBuffer + flushBufferSize,
+                                    ZIGZAG( deltaFn ) );
+  else if( ev->type == EV_ENTER )
+  {
+    flushBufferSize += writeVarint( flushBuffer + flushBufferSize, id );
+
+    if( useSites )
+      flushBufferSize += writeVarint( flushBuffer + flushBufferSize, siteId );
+  }
+
+  if( protocolCapabilities & CAP_CPUTIME )
+    flushBufferSize += writeVarint( flushBuffer + flushBufferSize,
+                                    ZIGZAG( ev->cpu - batchCpu ) );
+
+  batchTs = ev->ts;
+  batchCpu = ev->cpu;
+
+  //an EV_THREAD's this_fn is a stack id
+  if( ev->type != EV_THREAD )
+    batchFn = (unsigned long)ev->this_fn;
+
+  if( !countersWanted( ) )
+    return 0;
+
+  counters = eventCounters( ring, tail );
+
+  for( i = 0; i < NUM_COUNTERS; i++ )
+  {
+    if( protocolCapabilities & counterCapability( i ) )
+      flushBufferSize += writeVarint( flushBuffer + flushBufferSize,
+                                      ZIGZAG( counters->count[ i ] -
+                                              batchCounters.count[ i ] ) );
+  }
+
+  batchCounters = *counters;
+
+  return 0;
+}
+
+/*
+===============
+appendCounter
+
+Add a REC_COUNTER for an EV_COUNTER to the flush buffer, ending the
+current REC_BATCH
+===============
+*/
+static int appendCounter( eventRing_t *ring, unsigned int tail,
+                          ringEvent_t *ev )
+{
+  const char  *name = (const char *)ev->this_fn;
+  int         slot = internAnnotation( name ), n;
+
+  closeRecord( );
+
+  if( flushBufferSize + COUNTER_BYTES > FLUSH_BUFFER )
+  {
+    //give the slots back before blocking in send
+    __atomic_store_n( &ring->tail, tail, __ATOMIC_RELEASE );
+
+    if( writeFlushBuffer( ) < 0 )
+      return -1;
+  }
+
+  if( reserveFlushBuffer( ) < 0 )
+    return -1;
+
+  openRecord( REC_COUNTER );
+
+  flushBufferSize += writeVarint( flushBuffer + flushBufferSize, slot );
+  flushBufferSize += writeVarint( flushBuffer + flushBufferSize, ev->ts );
+  flushBufferSize += writeVarint( flushBuffer + flushBufferSize,
+                                  ZIGZAG( ev->value ) );
+
+  if( announceAnnotation( slot ) )
+  {
+    n = strnlen( name, ANNOTATION_NAME_MAX );
+    memcpy( flushBuffer + flushBufferSize, name, n );
+    flushBufferSize += n;
+  }
+
+  closeRecord( );
+
+  return 0;
+}
+
+/*
+===============
+deferRetire
+
+Hold on to the id of a fiber that has ended until it is safe to retire
+===============
+*/
+static void deferRetire( unsigned int tid )
+{
+  unsigned int  *ids;
+  int           newSize;
+
+  if( numRetiring == maxRetiring )
+  {
+    newSize = maxRetiring ? maxRetiring * 2 : 64;
+
+    //otherwise it is never used again, which is safe
+    if( ( ids = (unsigned int *)realloc( retiring,
+            newSize * sizeof( unsigned int ) ) ) == NULL )
+      return;
+
+    retiring = ids;
+    maxRetiring = newSize;
+  }
+
+  retiring[ numRetiring++ ] = tid;
+}
+
+/*
+===============
+drainRing
+
+Move the contents of a ring into the flush buffer
+Returns the number of events drained or -1 on failure
+===============
+*/
+static int drainRing( eventRing_t *ring )
+{
+  unsigned int    tail = ring->tail;
+  unsigned int    head = __atomic_load_n( &ring->head, __ATOMIC_ACQUIRE );
+  ringEvent_t     *ev;
+  int             count = 0;
+
+  if( protocolVersion >= 2 )
+  {
+    for( ; tail != head; tail++, count++ )
+    {
+      ev = &ring->events[ tail & RING_MASK ];
+
+      if( ev->type == EV_RETIRE )
+        deferRetire( (unsigned int)(unsigned long)ev->this_fn );
+      else if( ( ev->type == EV_COUNTER ?
+                 appendCounter( ring, tail, ev ) :
+                 appendBatchEvent( ring, tail, ev ) ) < 0 )
+        return -1;
+    }
+
+    closeRecord( );
+    __atomic_store_n( &ring->tail, tail, __ATOMIC_RELEASE );
+
+    return count;
+  }
+
+  //tell rtprof which thread the following events came from
+  if( tail != head && lastThreadSent != (int)ring->tid )
+  {
+    if( appendEvent( ring, tail, EV_THREAD, NULL, ring->tid ) < 0 )
+      return -1;
+
+    lastThreadSent = ring->tid;
+  }
+
+  for( ; tail != head; tail++, count++ )
+  {
+    ev = &ring->events[ tail & RING_MASK ];
+
+    //version 1 has no way to send these
+    if( ev->type == EV_COUNTER || ev->type == EV_RETIRE )
+      continue;
+
+    if( appendEvent( ring, tail, ev->type, ev->this_fn, ev->ts ) < 0 )
+      return -1;
+  }
+
+  __atomic_store_n( &ring->tail, tail, __ATOMIC_RELEASE );
+
+  return count;
+}
+
+/*
+===============
+summaryId
+
+Intern a function for a REC_SUMMARY, defining it first if it is new
+===============
+*/
+static int summaryId( void *this_fn, unsigned int *id )
+{
+  boolean isNew;
+
+  *id = internFunction( this_fn, &isNew );
+
+  if( isNew )
+  {
+    closeRecord( );
+
+    if( appendFunction( NULL, 0, *id, this_fn ) < 0 )
+      return -1;
+  }
+
+  return 0;
+}
+
+/*
+===============
+appendSummaryEdge
+
+Add whatever has changed on an edge since it was last sent to the
+current REC_SUMMARY, starting a new one if needed
+Returns 1 if anything was added, 0 if not or -1 on failure
+===============
+*/
+static int appendSummaryEdge( aggThread_t *t, aggEdge_t *e )
+{
+  unsigned long long  calls, localTime, totalTime, localCpu, totalCpu;
+  unsigned long long  localCounts[ NUM_COUNTERS ], totalCounts[ NUM_COUNTERS ];
+  unsigned int        callerId = 0, calleeId, siteId = 0;
+  boolean             changed;
+  int                 i;
+
+  calls = __atomic_load_n( &e->calls, __ATOMIC_RELAXED );
+  localTime = __atomic_load_n( &e->localTime, __ATOMIC_RELAXED );
+  totalTime = __atomic_load_n( &e->totalTime, __ATOMIC_RELAXED );
+  localCpu = __atomic_load_n( &e->localCpu, __ATOMIC_RELAXED );
+  totalCpu = __atomic_load_n( &e->totalCpu, __ATOMIC_RELAXED );
+
+  changed = calls != e->sentCalls || localTime != e->sentLocalTime ||
+            totalTime != e->sentTotalTime || localCpu != e->sentLocalCpu ||
+            totalCpu != e->sentTotalCpu;
+
+  for( i = 0; i < NUM_COUNTERS; i++ )
+  {
+    localCounts[ i ] = __atomic_load_n( &e->localCounts[ i ], __ATOMIC_RELAXED );
+    totalCounts[ i ] = __atomic_load_n( &e->totalCounts[ i ], __ATOMIC_RELAXED );
+
+    changed = changed || localCounts[ i ] != e->sentLocalCounts[ i ] ||
+              totalCounts[ i ] != e->sentTotalCounts[ i ];
+  }
+
+  if( !changed )
+    return 0;
+
+  //0 stands for the thread's root
+  if( e->caller != NULL )
+  {
+    if( summaryId( e->caller, &callerId ) < 0 )
+      return -1;
+
+    callerId++;
+  }
+
+  callerId = ( callerId << 1 ) | ( e->streamed ? 1 : 0 );
+
+  if( summaryId( e->callee, &calleeId ) < 0 )
+    return -1;
+
+  if( e->callSite != NULL )
+  {
+    if( summaryId( e->callSite, &siteId ) < 0 )
+      return -1;
+
+    siteId++;
+  }
+
+  if( recordStart >= 0 && flushBufferSize + SUMMARY_EDGE_BYTES > FLUSH_BUFFER )
+    closeRecord( );
+
+  if( recordStart < 0 )
+  {
+    if( flushBufferSize + SUMMARY_HEADER_BYTES + SUMMARY_EDGE_BYTES >
+        FLUSH_BUFFER && writeFlushBuffer( ) < 0 )
+      return -1;
+
+    if( reserveFlushBuffer( ) < 0 )
+      return -1;
+
+    openRecord( REC_SUMMARY );
+    flushBufferSize += writeVarint( flushBuffer + flushBufferSize, t->tid );
+  }
+
+  flushBufferSize += writeVarint( flushBuffer + flushBufferSize, callerId );
+  flushBufferSize += writeVarint( flushBuffer + flushBufferSize, calleeId );
+
+  if( protocolCapabilities & CAP_CALLSITES )
+    flushBufferSize += writeVarint( flushBuffer + flushBufferSize, siteId );
+
+  flushBufferSize += writeVarint( flushBuffer + flushBufferSize,
+                                  calls - e->sentCalls );
+  flushBufferSize += writeVarint( flushBuffer + flushBufferSize,
+                                  localTime - e->sentLocalTime );
+  flushBufferSize += writeVarint( flushBuffer + flushBufferSize,
+                                  totalTime - e->sentTotalTime );
+
+  if( protocolCapabilities & CAP_CPUTIME )
+  {
+    flushBufferSize += writeVarint( flushBuffer + flushBufferSize,
+                                    localCpu - e->sentLocalCpu );
+    flushBufferSize += writeVarint( flushBuffer + flushBufferSize,
+                                    totalCpu - e->sentTotalCpu );
+  }
+
+  for( i = 0; i < NUM_COUNTERS; i++ )
+  {
+    if( protocolCapabilities & counterCapability( i ) )
+    {
+      flushBufferSize += writeVarint( flushBuffer + flushBufferSize,
+                                      localCounts[ i ] -
+                                      e->sentLocalCounts[ i ] );
+      flushBufferSize += writeVarint( flushBuffer + flushBufferSize,
+                                      totalCounts[ i ] -
+                                      e->sentTotalCounts[ i ] );
+    }
+  }
+
+  e->sentCalls = calls;
+  e->sentLocalTime = localTime;
+  e->sentTotalTime = totalTime;
+  e->sentLocalCpu = localCpu;
+  e->sentTotalCpu = totalCpu;
+  memcpy( e->sentLocalCounts, localCounts, sizeof( localCounts ) );
+  memcpy( e->sentTotalCounts, totalCounts, sizeof( totalCounts ) );
+
+  return 1;
+}
+
+/*
+===============
+retireThreadId
+
+Let go of a thread's id; once nothing holds it, tell rtprof it is
+finished with, then give it back
+Only version 2 streams can say so; otherwise the id is kept
+Returns -1 on failure
+===============
+*/
+static int retireThreadId( unsigned int tid )
+{
+  if( protocolVersion < 2 || !dropThreadId( tid ) )
+    return 0;
+
+  closeRecord( );
+
+  if( flushBufferSize + RETIRE_BYTES > FLUSH_BUFFER &&
+      writeFlushBuffer( ) < 0 )
+    return -1;
+
+  if( reserveFlushBuffer( ) < 0 )
+    return -1;
+
+  openRecord( REC_RETIRE );
+  flushBufferSize += writeVarint( flushBuffer + flushBufferSize, tid );
+  closeRecord( );
+
+  releaseThreadId( tid );
+
+  return 0;
+}
+
+/*
+===============
+retireFibers
+
+Retire the ids of fibers that ended before the last pass over the
+rings. Another thread may have switched to a fiber just before it
+ended, and that thread's ring may have been drained before the ring
+holding the end, but never before this pass
+Returns -1 on failure
+===============
+*/
+static int retireFibers( void )
+{
+  int i;
+
+  for( i = 0; i < readyRetiring; i++ )
+  {
+    if( retireThreadId( retiring[ i ] ) < 0 )
+      return -1;
+  }
+
+  memmove( retiring, retiring + readyRetiring,
+           ( numRetiring - readyRetiring ) * sizeof( unsigned int ) );
+  numRetiring -= readyRetiring;
+  readyRetiring = numRetiring;
+
+  return 0;
+}
+
+/*
+===============
+drainAggregates
+
+Send the changes to every thread's totals as REC_SUMMARYs, once every
+aggregateInterval, or straight away when forced
+Returns the number of edges sent or -1 on failure
+===============
+*/
+static int drainAggregates( boolean force )
+{
+  aggThread_t *t;
+  timeStamp_t now;
+  boolean     orphaned;
+  int         i, n, added, count = 0;
+
+  now = readClock( );
+
+  if( aggregatesSent && !force &&
+      now - aggregatesSentTs < clockRate( ) * aggregateInterval / 1000 )
+    return 0;
+
+  for( t = aggregateThreads( ); t != NULL; t = t->next )
+  {
+    //an exited thread's totals can't change after this
+    orphaned = __atomic_load_n( &t->orphaned, __ATOMIC_ACQUIRE );
+    n = __atomic_load_n( &t->numEdges, __ATOMIC_ACQUIRE );
+
+    for( i = 0; i < n; i++ )
+    {
+      if( ( added = appendSummaryEdge( t, AGG_EDGE( t, i ) ) ) < 0 )
+        return -1;
+
+      count += added;
+    }
+
+    closeRecord( );
+
+    //its final totals are out, so its id can go to another thread
+    if( orphaned && !t->drained && retireThreadId( t->tid ) < 0 )
+      return -1;
+
+    t->drained = orphaned;
+  }
+
+  aggregatesSent = true;
+  aggregatesSentTs = now;
+
+  return count;
+}
+
+/*
+===============
+reserveHeapRecord
+
+Make sure there is a REC_HEAP open with room for another call path
+===============
+*/
+static int reserveHeapRecord( boolean *first )
+{
+  if( recordStart >= 0 && flushBufferSize + HEAP_PATH_BYTES > FLUSH_BUFFER )
+    closeRecord( );
+
+  if( recordStart >= 0 )
+    return 0;
+
+  if( flushBufferSize + HEAP_HEADER_BYTES + HEAP_PATH_BYTES > FLUSH_BUFFER &&
+      writeFlushBuffer( ) < 0 )
+    return -1;
+
+  if( reserveFlushBuffer( ) < 0 )
+    return -1;
+
+  openRecord( REC_HEAP );
+  flushBufferSize += writeVarint( flushBuffer + flushBufferSize,
+                                  *first ? 1 : 0 );
+  *first = false;
+
+  return 0;
+}
+
+/*
+===============
+appendHeapPath
+
+Add a call path's live heap to the current REC_HEAP snapshot
+===============
+*/
+static int appendHeapPath( heapPath_t *path, unsigned long long bytes,
+                           unsigned long long allocs, boolean *first )
+{
+  unsigned int  ids[ HEAP_MAX_DEPTH ];
+  int           i;
+
+  //any new functions are defined before the record that uses them
+  for( i = 0; i < path->depth; i++ )
+  {
+    if( summaryId( path->fns[ i ], &ids[ i ] ) < 0 )
+      return -1;
+  }
+
+  if( reserveHeapRecord( first ) < 0 )
+    return -1;
+
+  flushBufferSize += writeVarint( flushBuffer + flushBufferSize, path->depth );
+
+  for( i = 0; i < path->depth; i++ )
+    flushBufferSize += writeVarint( flushBuffer + flushBufferSize, ids[ i ] );
+
+  flushBufferSize += writeVarint( flushBuffer + flushBufferSize, bytes );
+  flushBufferSize += writeVarint( flushBuffer + flushBufferSize, allocs );
+
+  return 0;
+}
+
+/*
+===============
+drainHeap
+
+Send a REC_HEAP snapshot of the live heap, if it has changed and the
+last one wasn't too recent, or straight away when forced
+Returns the number of call paths sent or -1 on failure
+===============
+*/
+static int drainHeap( boolean force )
+{
+  heapPath_t          *path;
+  unsigned long long  bytes, allocs;
+  unsigned int        changes;
+  timeStamp_t         now;
+  boolean             first = true;
+  int                 count = 0;
+
+  if( heapInterval == 0 )
+    return 0;
+
+  changes = heapChanges( );
+
+  if( heapSent && changes == heapSentChanges )
+    return 0;
+
+  now = readClock( );
+
+  if( heapSent && !force &&
+      now - heapSentTs < clockRate( ) * HEAP_SNAPSHOT_MSEC / 1000 )
+    return 0;
+
+  for( path = heapPaths( ); path != NULL; path = path->next )
+  {
+    bytes = __atomic_load_n( &path->liveBytes, __ATOMIC_RELAXED );
+    allocs = __atomic_load_n( &path->liveAllocs, __ATOMIC_RELAXED );
+
+    //the snapshot replaces the last, so paths with nothing live go
+    if( bytes == 0 )
+      continue;
+
+    if( appendHeapPath( path, bytes, allocs, &first ) < 0 )
+      return -1;
+
+    count++;
+  }
+
+  //an empty heap still needs saying
+  if( first && reserveHeapRecord( &first ) < 0 )
+    return -1;
+
+  closeRecord( );
+
+  heapSent = true;
+  heapSentChanges = changes;
+  heapSentTs = now;
+
+  return count;
+}
+
+/*
+===============
+reserveLocksRecord
+
+Make sure there is a REC_LOCKS open with room for another site
+===============
+*/
+static int reserveLocksRecord( boolean *first )
+{
+  if( recordStart >= 0 && flushBufferSize + LOCK_SITE_BYTES > FLUSH_BUFFER )
+    closeRecord( );
+
+  if( recordStart >= 0 )
+    return 0;
+
+  if( flushBufferSize + LOCKS_HEADER_BYTES + LOCK_SITE_BYTES > FLUSH_BUFFER &&
+      writeFlushBuffer( ) < 0 )
+    return -1;
+
+  if( reserveFlushBuffer( ) < 0 )
+    return -1;
+
+  openRecord( REC_LOCKS );
+  flushBufferSize += writeVarint( flushBuffer + flushBufferSize,
+                                  *first ? 1 : 0 );
+  *first = false;
+
+  return 0;
+}
+
+/*
+===============
+drainLocks
+
+Send a REC_LOCKS snapshot of where threads have waited for locks, on
+the same terms as drainHeap
+Returns the number of sites sent or -1 on failure
+===============
+*/
+static int drainLocks( boolean force )
+{
+  lockSite_t          *site;
+  unsigned long long  waits, waitTime;
+  unsigned int        changes, id;
+  timeStamp_t         now;
+  boolean             first = true;
+  int                 count = 0;
+
+  if( !trackingLocks )
+    return 0;
+
+  changes = lockChanges( );
+
+  if( locksSent && changes == locksSentChanges )
+    return 0;
+
+  now = readClock( );
+
+  if( locksSent && !force &&
+      now - locksSentTs < clockRate( ) * LOCK_SNAPSHOT_MSEC / 1000 )
+    return 0;
+
+  for( site = lockSites( ); site != NULL; site = site->next )
+  {
+    waits = __atomic_load_n( &site->waits, __ATOMIC_RELAXED ) -
+            site->baseWaits;
+    waitTime = __atomic_load_n( &site->waitTime, __ATOMIC_RELAXED ) -
+               site->baseWaitTime;
+
+    //nothing since the stream started
+    if( waits == 0 )
+      continue;
+
+    if( summaryId( site->fn, &id ) < 0 || reserveLocksRecord( &first ) < 0 )
+      return -1;
+
+    flushBufferSize += writeVarint( flushBuffer + flushBufferSize, id );
+    flushBufferSize += writeVarint( flushBuffer + flushBufferSize,
+                                    (unsigned long)site->lock );
+    flushBufferSize += writeVarint( flushBuffer + flushBufferSize, waits );
+    flushBufferSize += writeVarint( flushBuffer + flushBufferSize,
+                                    (unsigned long long)( (double)waitTime *
+                                      1.0e9 / (double)clockRate( ) ) );
+
+    count++;
+  }
+
+  if( first && reserveLocksRecord( &first ) < 0 )
+    return -1;
+
+  closeRecord( );
+
+  locksSent = true;
+  locksSentChanges = changes;
+  locksSentTs = now;
+
+  return count;
+}
+
+/*
+===============
+drainLoadMap
+
+Send the load map as REC_MODULEs if it has changed, so rtprof can
+name functions in whatever has just been loaded before their events
+arrive
+===============
+*/
+static int drainLoadMap( void )
+{
+  loadModule_t  *modules;
+  int           numModules, i, length;
+
+  if( !( protocolCapabilities & CAP_MODULES ) || !loadMapChanged( ) )
+    return 0;
+
+  modules = readLoadMap( &numModules );
+
+  for( i = 0; i < numModules; i++ )
+  {
+    length = strlen( modules[ i ].path );
+
+    if( MODULE_BYTES( length ) > FLUSH_BUFFER )
+      continue;
+
+    if( ( flushBufferSize + MODULE_BYTES( length ) > FLUSH_BUFFER &&
+          writeFlushBuffer( ) < 0 ) || reserveFlushBuffer( ) < 0 )
+    {
+      freeLoadMap( modules, numModules );
+      return -1;
+    }
+
+    openRecord( REC_MODULE );
+    flushBufferSize += writeVarint( flushBuffer + flushBufferSize,
+                                    modules[ i ].bias );
+    memcpy( flushBuffer + flushBufferSize, modules[ i ].path, length );
+    flushBufferSize += length;
+    closeRecord( );
+  }
+
+  freeLoadMap( modules, numModules );
+
+  return 0;
+}
+
+/*
+===============
+flushRings
+
+Drain every ring and send the result
+Returns the number of events sent or -1 on failure
+===============
+*/
+static int flushRings( void )
+{
+  eventRing_t *ring, **prev, *reaped = NULL;
+  int         count, total = 0;
+
+  //rings are only ever added at the head so the rest of the list is stable
+  pthread_mutex_lock( &ringsMutex );
+  ring = rings;
+  pthread_mutex_unlock( &ringsMutex );
+
+  if( drainLoadMap( ) < 0 )
+    return -1;
+
+  for( ; ring != NULL; ring = ring->next )
+  {
+    if( ( count = drainRing( ring ) ) < 0 )
+      return -1;
+
+    total += count;
+  }
+
+  if( retireFibers( ) < 0 )
+    return -1;
+
+  //the last flush after detaching always sends the totals as they stand
+  if( ( count = drainAggregates( !flushing ) ) < 0 )
+    return -1;
+
+  total += count;
+
+  //the last flush after detaching always sends the heap as it stands
+  if( ( count = drainHeap( !flushing ) ) < 0 )
+    return -1;
+
+  total += count;
+
+  if( ( count = drainLocks( !flushing ) ) < 0 )
+    return -1;
+
+  total += count;
+
+  if( writeFlushBuffer( ) < 0 )
+    return -1;
+
+  reapAggregateThreads( );
+
+  //free the rings of threads that have exited
+  pthread_mutex_lock( &ringsMutex );
+
+  for( prev = &rings; ( ring = *prev ) != NULL; )
+  {
+    if( __atomic_load_n( &ring->orphaned, __ATOMIC_ACQUIRE ) &&
+        __atomic_load_n( &ring->head, __ATOMIC_ACQUIRE ) == ring->tail )
+    {
+      *prev = ring->next;
+      ring->next = reaped;
+      reaped = ring;
+    }
+    else
+      prev = &ring->next;
+  }
+
+  pthread_mutex_unlock( &ringsMutex );
+
+  //sending may block, so not while holding the list
+  while( ( ring = reaped ) != NULL )
+  {
+    reaped = ring->next;
+
+    if( retireThreadId( ring->tid ) < 0 )
+      total = -1;
+
+    free( ring->counters );
+    free( ring );
+  }
+
+  return total;
+}
+
+/*
+===============
+flusher
+
+Background thread that sends events to rtprof
+===============
+*/
+static void *flusher( void *arg )
+{
+  controlMessage_t  msg;
+  int               count, received;
+  boolean           failed = false;
+
+  while( flushing )
+  {
+    while( ( received = receiveControl( &msg ) ) > 0 )
+    {
+      if( msg.type == CTL_DETACH )
+        flushing = false;
+      else
+        applyControl( &msg );
+    }
+
+    if( received < 0 || ( count = flushRings( ) ) < 0 )
+    {
+      failed = true;
+      break;
+    }
+
+    if( !flushing )
+      break;
+
+    //the rings are kept empty even when the totals aren't due yet
+    if( count == 0 )
+      usleep( FLUSH_IDLE_USEC );
+  }
+
+  //back to dormant; the hooks stop queueing from here on
+  attached = false;
+  flushing = false;
+
+  if( !failed && flushRings( ) < 0 )
+    failed = true;
+
+  if( failed )
+  {
+    disconnectFromFailedRtprof( );
+    fprintf( stderr, "WARNING: could not send to rtprof; disconnected\n" );
+  }
+  else
+    disconnectFromRtprof( );
+
+  return NULL;
+}
+
+/*
+===============
+resetBuffers
+
+Forget anything left over from a previous connection; the hooks must
+not be queueing while this runs
+===============
+*/
+void resetBuffers( void )
+{
+  eventRing_t *ring;
+  aggThread_t *t;
+  aggEdge_t   *e;
+  lockSite_t  *s;
+  int         i, j, n;
+
+  //ids are per stream
+  resetFunctions( );
+  resetAnnotations( );
+  lastThreadSent = -1;
+  heapSent = false;
+  locksSent = false;
+  aggregatesSent = false;
+  resetLoadMap( );
+
+  //fibers that ended before now are nothing to the new rtprof
+  for( i = 0; i < numRetiring; i++ )
+    releaseThreadId( retiring[ i ] );
+
+  numRetiring = readyRetiring = 0;
+
+  pthread_mutex_lock( &ringsMutex );
+  ring = rings;
+  pthread_mutex_unlock( &ringsMutex );
+
+  for( ; ring != NULL; ring = ring->next )
+    __atomic_store_n( &ring->tail, ring->head, __ATOMIC_RELEASE );
+
+  //totals from before now aren't the new rtprof's business
+  for( t = aggregateThreads( ); t != NULL; t = t->next )
+  {
+    n = __atomic_load_n( &t->numEdges, __ATOMIC_ACQUIRE );
+
+    for( i = 0; i < n; i++ )
+    {
+      e = AGG_EDGE( t, i );
+      e->sentCalls = e->calls;
+      e->sentLocalTime = e->localTime;
+      e->sentTotalTime = e->totalTime;
+      e->sentLocalCpu = e->localCpu;
+      e->sentTotalCpu = e->totalCpu;
+
+      for( j = 0; j < NUM_COUNTERS; j++ )
+      {
+        e->sentLocalCounts[ j ] = e->localCounts[ j ];
+        e->sentTotalCounts[ j ] = e->totalCounts[ j ];
+      }
+    }
+  }
+
+  for( s = lockSites( ); s != NULL; s = s->next )
+  {
+    s->baseWaits = __atomic_load_n( &s->waits, __ATOMIC_RELAXED );
+    s->baseWaitTime = __atomic_load_n( &s->waitTime, __ATOMIC_RELAXED );
+  }
+}
+
+/*
+===============
+lockBuffers
+
+Hold the ring list still across a fork
+===============
+*/
+void lockBuffers( void )
+{
+  pthread_mutex_lock( &ringsMutex );
+}
+
+/*
+===============
+unlockBuffers
+
+Undo lockBuffers, in the parent or the child
+===============
+*/
+void unlockBuffers( void )
+{
+  pthread_mutex_unlock( &ringsMutex );
+}
+
+/*
+===============
+forkBuffers
+
+Called in the child after a fork; of all the threads only the caller
+survived, so the flusher is gone and every other ring is orphaned
+===============
+*/
+void forkBuffers( void )
+{
+  eventRing_t *ring;
+
+  flusherStarted = false;
+  flushing = false;
+
+  //anything half built was the parent's
+  flushBuffer = NULL;
+  flushBufferSize = 0;
+  recordStart = -1;
+
+  pthread_mutex_lock( &ringsMutex );
+
+  for( ring = rings; ring != NULL; ring = ring->next )
+  {
+    if( ring != localRing )
+      ring->orphaned = true;
+  }
+
+  pthread_mutex_unlock( &ringsMutex );
+}
+
+/*
+===============
+startFlusher
+
+Start the background flusher thread
+===============
+*/
+int startFlusher( void )
+{
+  flushing = true;
+
+  if( pthread_create( &flusherThread, NULL, flusher, NULL ) != 0 )
+  {
+    flushing = false;
+    return -1;
+  }
+
+  flusherStarted = true;
+
+  return 0;
+}
+
+/*
+===============
+stopFlusher
+
+Ask the flusher thread to send anything still buffered and disconnect,
+then wait for it; also reaps a flusher that has stopped by itself
+===============
+*/
+void stopFlusher( void )
+{
+  if( !flusherStarted )
+    return;
+
+  flushing = false;
+  pthread_join( flusherThread, NULL );
+  flusherStarted = false;
+}
@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2003 Tim Angus
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef BUFFER_H
+#define BUFFER_H
+
+#include "../rtprof/com_common.h"
+#include "counters.h"
+
+#define RTPROF_CALLSITES "RTPROF_CALLSITES"
+
+//a value for a counter of the program's own; only ever in the rings,
+//never a batch event kind
+#define EV_COUNTER      ( EV_HELLO + 1 )
+
+//a fiber has ended and its id can be given back; likewise never sent
+#define EV_RETIRE       ( EV_HELLO + 2 )
+
+//must be a power of two
+#define RING_EVENTS     16384
+#define RING_MASK       ( RING_EVENTS - 1 )
+
+//size of the flusher's outgoing buffer
+#define FLUSH_BUFFER    65536
+
+//how long the flusher sleeps when there is nothing to do
+#define FLUSH_IDLE_USEC 1000
+
+typedef struct ringEvent_s
+{
+  void          *this_fn;     //for EV_THREAD, the stack id + 1 or 0;
+                              //for EV_RETIRE, the fiber's id;
+                              //for EV_COUNTER, the counter's name
+  void          *callSite;    //EV_ENTER, with trackingCallSites
+  timeStamp_t   ts;
+
+  union
+  {
+    timeStamp_t cpu;
+    long long   value;        //EV_COUNTER
+  };
+
+  unsigned int  type;
+} ringEvent_t;
+
+//single producer (the owning thread), single consumer (the flusher)
+typedef struct eventRing_s
+{
+  volatile unsigned int head;
+  volatile unsigned int tail;
+
+  //small dense id, sent to rtprof with EV_THREAD
+  unsigned int          tid;
+
+  //set when the owning thread exits; the flusher frees the ring once drained
+  volatile boolean      orphaned;
+
+  struct eventRing_s    *next;
+
+  ringEvent_t           events[ RING_EVENTS ];
+
+  //what the counters read at each event, a slot for each of events; only
+  //allocated once some counters are being collected
+  counters_t            *counters;
+} eventRing_t;
+
+//whether entries say where they were called from, as agreed with rtprof
+extern boolean  trackingCallSites;
+
+unsigned int  newThreadId( void );
+unsigned int  localThreadId( void );
+void          releaseThreadId( unsigned int tid );
+void          queueEvent( unsigned int type, void *this_fn, void *callSite,
+                          timeStamp_t ts, timeStamp_t cpu,
+                          const counters_t *counters );
+void          queueCounter( const char *name, timeStamp_t ts,
+                            long long value );
+void          resetBuffers( void );
+void          lockBuffers( void );
+void          unlockBuffers( void );
+void          forkBuffers( void );
+int           startFlusher( void );
+void          stopFlusher( void );
+
+#endif
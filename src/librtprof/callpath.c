@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) 2003 Tim Angus
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include "callpath.h"
+
+boolean                 tracingCallPaths = false;
+__thread void           *callPath[ CALL_PATH_DEPTH ] INITIAL_EXEC;
+__thread unsigned int   callDepth INITIAL_EXEC = 0;
+
+/*
+===============
+resetCallPath
+
+Empty the calling thread's call path, which is stale after being
+detached from rtprof
+===============
+*/
+void resetCallPath( void )
+{
+  callDepth = 0;
+}
+
+/*
+===============
+readCallPath
+
+Copy out the calling thread's innermost calls, outermost first
+Returns how many there are
+===============
+*/
+int readCallPath( void **fns )
+{
+  unsigned int  depth = callDepth, i;
+
+  if( depth > CALL_PATH_DEPTH )
+    depth = CALL_PATH_DEPTH;
+
+  for( i = 0; i < depth; i++ )
+    fns[ i ] = callPath[ ( callDepth - depth + i ) & ( CALL_PATH_DEPTH - 1 ) ];
+
+  return (int)depth;
+}
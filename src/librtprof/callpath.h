@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2003 Tim Angus
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef CALLPATH_H
+#define CALLPATH_H
+
+#include <stddef.h>
+
+#include "../rtprof/com_common.h"
+#include "../rtprof/com_protocol.h"
+#include "alloc.h"
+
+//innermost calls kept; as many as a REC_HEAP can carry
+#define CALL_PATH_DEPTH   HEAP_MAX_DEPTH
+
+//whether the hooks keep track of each thread's calls, for anything that
+//needs to know who is responsible for what it sees
+extern boolean                tracingCallPaths;
+
+//the calling thread's innermost calls, as a ring indexed by depth
+extern __thread void          *callPath[ CALL_PATH_DEPTH ] INITIAL_EXEC;
+extern __thread unsigned int  callDepth INITIAL_EXEC;
+
+void  resetCallPath( void );
+int   readCallPath( void **fns );
+
+/*
+===============
+callPathEnter
+
+Note a call
+===============
+*/
+static inline void callPathEnter( void *this_fn )
+{
+  callPath[ callDepth++ & ( CALL_PATH_DEPTH - 1 ) ] = this_fn;
+}
+
+/*
+===============
+callPathExit
+
+Note a return
+===============
+*/
+static inline void callPathExit( void )
+{
+  if( callDepth > 0 )
+    callDepth--;
+}
+
+/*
+===============
+currentFunction
+
+The instrumented function the calling thread is in, or NULL
+===============
+*/
+static inline void *currentFunction( void )
+{
+  if( callDepth == 0 )
+    return NULL;
+
+  return callPath[ ( callDepth - 1 ) & ( CALL_PATH_DEPTH - 1 ) ];
+}
+
+#endif
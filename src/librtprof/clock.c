@@ -0,0 +1,146 @@
+/*
+ * Copyright (C) 2003 Tim Angus
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined( __i386__ ) || defined( __x86_64__ )
+#include <cpuid.h>
+#endif
+
+#include "clock.h"
+
+clockSource_t       clockSource = CLK_MONOTONIC;
+static timeStamp_t  ticksPerSecond = 1000000000ULL;
+timeStamp_t         hookOverhead = 0;
+timeStamp_t         hookCpuOverhead = 0;
+boolean             cpuTiming = false;
+
+/*
+===============
+monotonicNsecs
+
+Read CLOCK_MONOTONIC_RAW in nanoseconds
+===============
+*/
+static timeStamp_t monotonicNsecs( void )
+{
+  struct timespec tp;
+
+  clock_gettime( CLOCK_MONOTONIC_RAW, &tp );
+
+  return (timeStamp_t)tp.tv_sec * 1000000000ULL + tp.tv_nsec;
+}
+
+/*
+===============
+invariantTSC
+
+Does this cpu have a tsc that ticks at a constant rate?
+===============
+*/
+static boolean invariantTSC( void )
+{
+#if defined( __i386__ ) || defined( __x86_64__ )
+  unsigned int eax, ebx, ecx, edx;
+
+  if( !__get_cpuid( 0x80000000, &eax, &ebx, &ecx, &edx ) || eax < 0x80000007 )
+    return false;
+
+  __get_cpuid( 0x80000007, &eax, &ebx, &ecx, &edx );
+
+  return (boolean)( ( edx & ( 1 << 8 ) ) != 0 );
+#else
+  return false;
+#endif
+}
+
+/*
+===============
+calibrateTSC
+
+Measure the tsc rate against CLOCK_MONOTONIC_RAW
+===============
+*/
+static timeStamp_t calibrateTSC( void )
+{
+  timeStamp_t ns0, ns1, tsc0, tsc1;
+
+  clockSource = CLK_TSC;
+
+  ns0 = monotonicNsecs( );
+  tsc0 = readClock( );
+
+  do
+    ns1 = monotonicNsecs( );
+  while( ns1 - ns0 < CALIBRATE_NSEC );
+
+  tsc1 = readClock( );
+
+  return (timeStamp_t)( (double)( tsc1 - tsc0 ) * 1.0e9 / (double)( ns1 - ns0 ) );
+}
+
+/*
+===============
+initClock
+
+Pick a clock source based on RTPROF_CLOCK and what the cpu supports
+===============
+*/
+void initClock( void )
+{
+  char    *env = getenv( RTPROF_CLOCK );
+  boolean useTSC = invariantTSC( );
+
+  if( env != NULL )
+  {
+    if( !strcmp( env, TSC_NAME ) )
+    {
+      if( !useTSC )
+        fprintf( stderr, "WARNING: librtprof cannot find an invariant tsc; "
+                         "using " MONOTONIC_NAME "\n" );
+    }
+    else if( !strcmp( env, MONOTONIC_NAME ) )
+      useTSC = false;
+    else
+      fprintf( stderr, "WARNING: librtprof cannot parse environment "
+                       "variable " RTPROF_CLOCK "\n" );
+  }
+
+  if( useTSC )
+    ticksPerSecond = calibrateTSC( );
+  else
+  {
+    clockSource = CLK_MONOTONIC;
+    ticksPerSecond = 1000000000ULL;
+  }
+}
+
+/*
+===============
+clockRate
+
+Clock ticks per second
+===============
+*/
+timeStamp_t clockRate( void )
+{
+  return ticksPerSecond;
+}
@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2003 Tim Angus
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <time.h>
+
+#include "../rtprof/com_common.h"
+
+#define RTPROF_CLOCK    "RTPROF_CLOCK"
+#define RTPROF_OVERHEAD "RTPROF_OVERHEAD"
+#define RTPROF_CPUTIME  "RTPROF_CPUTIME"
+
+#define TSC_NAME        "tsc"
+#define MONOTONIC_NAME  "monotonic"
+
+//how long to spend calibrating the tsc against CLOCK_MONOTONIC_RAW
+#define CALIBRATE_NSEC  20000000
+
+typedef enum
+{
+  CLK_MONOTONIC,
+  CLK_TSC
+} clockSource_t;
+
+extern clockSource_t  clockSource;
+
+//clock ticks OVERHEAD_SCALE calls to the hooks take; measured at attach
+extern timeStamp_t    hookOverhead;
+
+//the same in nanoseconds, for taking out of cpu times
+extern timeStamp_t    hookCpuOverhead;
+
+//whether the hooks read each thread's cpu time, as agreed with rtprof
+extern boolean        cpuTiming;
+
+void        initClock( void );
+timeStamp_t clockRate( void );
+
+/*
+===============
+readClock
+
+Read the current clock in ticks; called from the hooks so keep it inline
+===============
+*/
+static inline timeStamp_t readClock( void )
+{
+  struct timespec tp;
+
+#if defined( __i386__ ) || defined( __x86_64__ )
+  if( clockSource == CLK_TSC )
+  {
+    unsigned int lo, hi;
+
+    __asm__ __volatile__( "rdtsc" : "=a" (lo), "=d" (hi) );
+
+    return ( (timeStamp_t)hi << 32 ) | lo;
+  }
+#endif
+
+  clock_gettime( CLOCK_MONOTONIC_RAW, &tp );
+
+  return (timeStamp_t)tp.tv_sec * 1000000000ULL + tp.tv_nsec;
+}
+
+/*
+===============
+readCpuClock
+
+Read the calling thread's cpu time in nanoseconds, or 0 if cpu time
+isn't being collected
+===============
+*/
+static inline timeStamp_t readCpuClock( void )
+{
+  struct timespec tp;
+
+  if( !cpuTiming )
+    return 0;
+
+  clock_gettime( CLOCK_THREAD_CPUTIME_ID, &tp );
+
+  return (timeStamp_t)tp.tv_sec * 1000000000ULL + tp.tv_nsec;
+}
+
+#endif
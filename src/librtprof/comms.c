@@ -18,6 +18,10 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
 
 #include <sys/socket.h>
 #include <sys/un.h>
@@ -25,17 +29,44 @@
 #include <netdb.h>
 
 #include "comms.h"
+#include "buffer.h"
+#include "clock.h"
+#include "counters.h"
+#include "heap.h"
+#include "locks.h"
+#include "io.h"
+#include "shm.h"
+#include "trace.h"
 #include "../rtprof/com_common.h"
+#include "../rtprof/com_protocol.h"
+#include "../rtprof/com_compress.h"
 #include "../rtprof/lib_comms.h"
 
 extern int connection;
 
+transport_t   transport = TR_NONE;
+int           protocolVersion = 1;
+unsigned int  protocolCapabilities = 0;
+
+//events are built up here before being sent on a socket
+static unsigned char  sendBuffer[ FLUSH_BUFFER ];
+
+//with CAP_COMPRESS, sendBuffer is packed into a REC_BLOCK here
+#define BLOCK_HEADER_BYTES  ( 1 + RECORD_LENGTH_BYTES + MAX_VARINT )
+static unsigned char  blockBuffer[ BLOCK_HEADER_BYTES +
+                                   LZ_BOUND( FLUSH_BUFFER ) ];
+static int            blockTable[ LZ_HASH_SIZE ];
+
+//part of a control message from rtprof
+static controlMessage_t controlBuffer;
+static int              controlSize = 0;
+
 /*
 ===============
 parseSocketVariable
 ===============
 */
-static int parseSocketVariable( char *buffer, int bufferSize )
+static transport_t parseSocketVariable( char *buffer, int bufferSize )
 {
   char *env;
 
@@ -46,18 +77,30 @@ static int parseSocketVariable( char *buffer, int bufferSize )
     if( !strncmp( env, INET_PREFIX, INET_LENGTH ) )
     {
       strncpy( buffer, env + INET_LENGTH, bufferSize - INET_LENGTH );
-      return AF_INET;
+      return TR_INET;
     }
     else if( !strncmp( env, FILE_PREFIX, FILE_LENGTH ) )
     {
       strncpy( buffer, env + FILE_LENGTH, bufferSize - FILE_LENGTH );
-      return AF_UNIX;
+      return TR_UNIX;
+    }
+    else if( !strncmp( env, SHM_PREFIX, SHM_LENGTH ) )
+    {
+      //shm_open wants a leading slash
+      buffer[ 0 ] = '/';
+      strncpy( buffer + 1, env + SHM_LENGTH, bufferSize - SHM_LENGTH - 1 );
+      return TR_SHM;
+    }
+    else if( !strncmp( env, TRACE_PREFIX, TRACE_LENGTH ) )
+    {
+      strncpy( buffer, env + TRACE_LENGTH, bufferSize - TRACE_LENGTH );
+      return TR_TRACE;
     }
     else
-      return -1;
+      return TR_NONE;
   }
   else
-    return -1;
+    return TR_NONE;
 }
 
 
@@ -72,10 +115,25 @@ void disconnectFromRtprof( void )
 {
   functionEvent_t fe;
 
-  fe.type = EV_PROCEXIT;
+  if( connection < 0 )
+    return;
+
+  if( protocolVersion >= 2 )
+    sendRecord( REC_PROCEXIT, NULL, 0 );
+  else
+  {
+    fe.type = EV_PROCEXIT;
+
+    sendFE( connection, fe );
+  }
+
+  if( transport == TR_SHM )
+    disconnectFromShm( );
+  else if( transport == TR_TRACE )
+    disconnectFromTrace( );
 
-  sendFE( connection, fe );
   close( connection );
+  connection = -1;
 }
 
 
@@ -88,8 +146,383 @@ Disconnect from failed analysis program
 */
 void disconnectFromFailedRtprof( void )
 {
+  if( transport == TR_SHM )
+    disconnectFromShm( );
+  else if( transport == TR_TRACE )
+    disconnectFromTrace( );
+
+  close( connection );
+  connection = -1;
+}
+
+
+/*
+===============
+abandonRtprof
+
+Forget the connection inherited across a fork without touching it; it
+still belongs to the parent
+===============
+*/
+void abandonRtprof( void )
+{
+  if( connection < 0 )
+    return;
+
+  if( transport == TR_SHM )
+    disconnectFromShm( );
+  else if( transport == TR_TRACE )
+    abandonTrace( );
+
   close( connection );
   connection = -1;
+  controlSize = 0;
+}
+
+
+/*
+===============
+waitForHelloReply
+
+Wait a short while for rtprof to answer EV_HELLO
+===============
+*/
+static boolean waitForHelloReply( helloReply_t *reply )
+{
+  struct pollfd pfd;
+  unsigned char *p = (unsigned char *)reply;
+  int           size = 0, count;
+
+  pfd.fd = connection;
+  pfd.events = POLLIN;
+
+  while( size < sizeof( helloReply_t ) )
+  {
+    if( poll( &pfd, 1, HELLO_TIMEOUT ) <= 0 )
+      return false;
+
+    if( ( count = recv( connection, p + size,
+                        sizeof( helloReply_t ) - size, 0 ) ) <= 0 )
+      return false;
+
+    size += count;
+  }
+
+  return (boolean)( reply->magic == PROTOCOL_MAGIC );
+}
+
+/*
+===============
+sendHello
+
+Send the REC_HELLO that starts a version 2 stream, describing what has
+been agreed and what the hooks cost
+===============
+*/
+int sendHello( void )
+{
+  unsigned char body[ 6 * MAX_VARINT ];
+  int           size = 0;
+
+  size += writeVarint( body + size, protocolVersion );
+  size += writeVarint( body + size, sizeof( void * ) );
+  size += writeVarint( body + size, clockRate( ) );
+  size += writeVarint( body + size, protocolCapabilities );
+  size += writeVarint( body + size, getpid( ) );
+  size += writeVarint( body + size, hookOverhead );
+
+  return sendRecord( REC_HELLO, body, size );
+}
+
+/*
+===============
+clientCapabilities
+
+What to offer rtprof on any transport
+===============
+*/
+unsigned int clientCapabilities( void )
+{
+  unsigned int  capabilities = CLIENT_CAPABILITIES;
+  char          *env;
+
+  //reading the cpu clock or the perf counters costs a system call, and
+  //timing every allocation isn't free either, so only when asked
+  if( ( env = getenv( RTPROF_CPUTIME ) ) != NULL && atoi( env ) > 0 )
+    capabilities |= CAP_CPUTIME;
+
+  if( ( env = getenv( RTPROF_COUNTERS ) ) != NULL && atoi( env ) > 0 )
+  {
+    if( countersAvailable( ) )
+      capabilities |= CAP_COUNTERS;
+    else
+      fprintf( stderr, "WARNING: librtprof cannot open perf counters; "
+                       "not sending them\n" );
+  }
+
+  if( ( env = getenv( RTPROF_ALLOCS ) ) != NULL && atoi( env ) > 0 )
+    capabilities |= CAP_ALLOCS;
+
+  if( ( env = getenv( RTPROF_HEAP ) ) != NULL && atol( env ) > 0 )
+    capabilities |= CAP_HEAP;
+
+  if( ( env = getenv( RTPROF_LOCKS ) ) != NULL && atoi( env ) > 0 )
+    capabilities |= CAP_LOCKS;
+
+  if( ( env = getenv( RTPROF_IO ) ) != NULL && atoi( env ) > 0 )
+    capabilities |= CAP_IO;
+
+  if( ( env = getenv( RTPROF_CALLSITES ) ) != NULL && atoi( env ) > 0 )
+    capabilities |= CAP_CALLSITES;
+
+  return capabilities;
+}
+
+/*
+===============
+socketCapabilities
+
+What to offer rtprof over a socket; compression is worth it across a
+network but by default not to a local rtprof
+===============
+*/
+static unsigned int socketCapabilities( void )
+{
+  char  *env = getenv( RTPROF_COMPRESS );
+
+  if( env != NULL ? atoi( env ) != 0 : transport == TR_INET )
+    return clientCapabilities( ) | CAP_COMPRESS;
+
+  return clientCapabilities( );
+}
+
+/*
+===============
+announceToRtprof
+
+Tell the analysis program about ourselves and negotiate a protocol
+===============
+*/
+int announceToRtprof( void )
+{
+  functionEvent_t fe;
+  helloReply_t    reply;
+  int             maxVersion = PROTOCOL_VERSION;
+  char            *env;
+
+  if( ( env = getenv( RTPROF_PROTOCOL ) ) != NULL && atoi( env ) > 0 &&
+      atoi( env ) < maxVersion )
+    maxVersion = atoi( env );
+
+  //connectToShm has already read rtprof's side from the ring header and
+  //a trace file has nobody to ask
+  if( transport == TR_SHM || transport == TR_TRACE )
+    return 0;
+
+  fe.type = EV_CLOCKRATE;
+  fe.this_fn = NULL;
+  fe.ts = clockRate( );
+
+  if( sendFE( connection, fe ) < 0 )
+    return -1;
+
+  protocolVersion = 1;
+  protocolCapabilities = 0;
+
+  if( maxVersion < 2 )
+    return 0;
+
+  fe.type = EV_HELLO;
+  fe.this_fn = (void *)(unsigned long)socketCapabilities( );
+  fe.ts = HELLO_TS( maxVersion, sizeof( void * ) );
+
+  if( sendFE( connection, fe ) < 0 )
+    return -1;
+
+  //an old rtprof won't reply; stick with version 1
+  if( waitForHelloReply( &reply ) )
+  {
+    protocolVersion = reply.version < maxVersion ? reply.version : maxVersion;
+    protocolCapabilities = socketCapabilities( ) & reply.capabilities;
+  }
+
+  return 0;
+}
+
+
+/*
+===============
+receiveControl
+
+Take the next control message from rtprof without blocking
+Returns 1 if msg was filled in, 0 if there wasn't one or -1 if rtprof
+has gone away
+===============
+*/
+int receiveControl( controlMessage_t *msg )
+{
+  int count;
+
+  if( !( protocolCapabilities & CAP_CONTROL ) )
+    return 0;
+
+  if( transport == TR_SHM )
+    return receiveShmControl( msg );
+  else if( transport == TR_TRACE )
+    return 0;
+
+  count = recv( connection, (unsigned char *)&controlBuffer + controlSize,
+                sizeof( controlMessage_t ) - controlSize, MSG_DONTWAIT );
+
+  if( count == 0 || ( count < 0 && errno != EAGAIN && errno != EINTR ) )
+    return -1;
+  else if( count < 0 )
+    return 0;
+
+  if( ( controlSize += count ) < sizeof( controlMessage_t ) )
+    return 0;
+
+  *msg = controlBuffer;
+  controlSize = 0;
+
+  return 1;
+}
+
+
+/*
+===============
+sendRecord
+
+Send a single version 2 record
+===============
+*/
+int sendRecord( unsigned char tag, void *body, int length )
+{
+  unsigned char header[ 1 + MAX_VARINT ];
+  int           headerSize;
+
+  header[ 0 ] = tag;
+  headerSize = 1 + writeVarint( header + 1, length );
+
+  if( sendToRtprof( header, headerSize ) < 0 )
+    return -1;
+
+  return length > 0 ? sendToRtprof( body, length ) : 0;
+}
+
+
+/*
+===============
+sendToRtprof
+
+Send a buffer to the analysis program, blocking until it has all gone
+===============
+*/
+int sendToRtprof( void *buffer, int length )
+{
+  unsigned char *p = (unsigned char *)buffer;
+  int           count;
+
+  if( transport == TR_SHM )
+  {
+    if( ( p = reserveShm( length ) ) == NULL )
+      return -1;
+
+    memcpy( p, buffer, length );
+
+    return commitShm( length );
+  }
+  else if( transport == TR_TRACE )
+  {
+    if( ( p = reserveTrace( length ) ) == NULL )
+      return -1;
+
+    memcpy( p, buffer, length );
+
+    return commitTrace( length );
+  }
+
+  while( length > 0 )
+  {
+    if( ( count = send( connection, p, length, MSG_NOSIGNAL ) ) < 0 )
+    {
+      if( errno == EINTR )
+        continue;
+
+      return -1;
+    }
+
+    p += count;
+    length -= count;
+  }
+
+  return 0;
+}
+
+
+/*
+===============
+beginSendToRtprof
+
+Return somewhere to build up to length bytes for endSendToRtprof
+On the shared memory transport this is the ring itself, and for a trace
+the file itself
+===============
+*/
+unsigned char *beginSendToRtprof( int length )
+{
+  if( transport == TR_SHM )
+    return reserveShm( length );
+  else if( transport == TR_TRACE )
+    return reserveTrace( length );
+
+  return length <= FLUSH_BUFFER ? sendBuffer : NULL;
+}
+
+/*
+===============
+sendBlock
+
+Send the records in sendBuffer compressed into a REC_BLOCK, or as they
+are if that wouldn't save anything
+===============
+*/
+static int sendBlock( int length )
+{
+  unsigned char *p = blockBuffer + 1 + RECORD_LENGTH_BYTES;
+  int           size;
+
+  p += writeVarint( p, length );
+  p += compressBlock( sendBuffer, length, p, blockTable );
+  size = p - blockBuffer;
+
+  if( size >= length )
+    return sendToRtprof( sendBuffer, length );
+
+  blockBuffer[ 0 ] = REC_BLOCK;
+  writeFixedVarint( blockBuffer + 1, size - ( 1 + RECORD_LENGTH_BYTES ),
+                    RECORD_LENGTH_BYTES );
+
+  return sendToRtprof( blockBuffer, size );
+}
+
+/*
+===============
+endSendToRtprof
+
+Send the first length bytes of the beginSendToRtprof buffer
+===============
+*/
+int endSendToRtprof( int length )
+{
+  if( transport == TR_SHM )
+    return commitShm( length );
+  else if( transport == TR_TRACE )
+    return commitTrace( length );
+  else if( protocolCapabilities & CAP_COMPRESS )
+    return sendBlock( length );
+
+  return sendToRtprof( sendBuffer, length );
 }
 
 
@@ -104,13 +537,12 @@ Connect to analysis program
 */
 int connectToRtprof( void )
 {
-  int   socketType;
   char  hostBuffer[ MAX_HB ];
   int   s;
 
-  socketType = parseSocketVariable( hostBuffer, MAX_HB );
+  transport = parseSocketVariable( hostBuffer, MAX_HB );
 
-  if( socketType == AF_INET )
+  if( transport == TR_INET )
   {
     //tcp socket
     struct sockaddr_in sa;
@@ -125,7 +557,7 @@ int connectToRtprof( void )
     sa.sin_family = hp->h_addrtype;
     sa.sin_port = htons( (u_short)RTPROF_PORT );
     
-    if( ( s = socket( hp->h_addrtype, SOCK_STREAM, 0 ) ) < 0 )
+    if( ( s = socket( hp->h_addrtype, SOCK_STREAM | SOCK_CLOEXEC, 0 ) ) < 0 )
       return -1;
     
     if( connect( s, (struct sockaddr *)&sa, sizeof( sa ) ) < 0 )
@@ -136,7 +568,7 @@ int connectToRtprof( void )
 
     return s;
   }
-  else if( socketType == AF_UNIX )
+  else if( transport == TR_UNIX )
   {
     //file socket
     struct sockaddr_un sa;
@@ -146,7 +578,7 @@ int connectToRtprof( void )
     strcpy( sa.sun_path, hostBuffer );
     sa.sun_family = AF_UNIX;
     
-    if( ( s = socket( AF_UNIX, SOCK_STREAM, 0 ) ) < 0 )
+    if( ( s = socket( AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0 ) ) < 0 )
       return -1;
 
     if( connect( s, (struct sockaddr *)&sa, sizeof( sa ) ) < 0 )
@@ -157,12 +589,20 @@ int connectToRtprof( void )
 
     return s;
   }
-  else if( socketType < 0 )
+  else if( transport == TR_SHM )
+  {
+    //shared memory ring
+    return connectToShm( hostBuffer );
+  }
+  else if( transport == TR_TRACE )
+  {
+    //memory mapped trace file
+    return connectToTrace( hostBuffer );
+  }
+  else
   {
     fprintf( stderr, "WARNING: librtprof cannot parse environment"
                      "variable RTPROF_SKT\n" );
     return -1;
   }
-
-  return -1;
 }
@@ -21,16 +21,54 @@
 
 #include <sys/socket.h>
 
-#define RTPROF_SKT  "RTPROF_SKT"
+#include "../rtprof/com_protocol.h"
+
+#define RTPROF_SKT      "RTPROF_SKT"
+#define RTPROF_PROTOCOL "RTPROF_PROTOCOL"
+#define RTPROF_ATTACH   "RTPROF_ATTACH"
+#define RTPROF_COMPRESS "RTPROF_COMPRESS"
 
 #define INET_PREFIX "rtprof://"
 #define INET_LENGTH 9
 #define FILE_PREFIX "unix://"
 #define FILE_LENGTH 7
+#define SHM_PREFIX  "shm://"
+#define SHM_LENGTH  6
+#define TRACE_PREFIX "file://"
+#define TRACE_LENGTH 7
+
+typedef enum
+{
+  TR_NONE,
+  TR_INET,
+  TR_UNIX,
+  TR_SHM,
+  TR_TRACE
+} transport_t;
+
+//capability bits librtprof offers rtprof
+#define CLIENT_CAPABILITIES ( CAP_FUNCIDS | CAP_SUMMARY | CAP_CONTROL | \
+                              CAP_MODULES | CAP_FIBERS | CAP_ZONES )
+
+extern transport_t  transport;
+
+//what was agreed with rtprof in announceToRtprof
+extern int          protocolVersion;
+extern unsigned int protocolCapabilities;
 
 int   connectToRtprof( void );
 void  disconnectFromRtprof( void );
 void  disconnectFromFailedRtprof( void );
+void  abandonRtprof( void );
+int   announceToRtprof( void );
+int   sendHello( void );
+int   sendRecord( unsigned char tag, void *body, int length );
+int   sendToRtprof( void *buffer, int length );
+int   receiveControl( controlMessage_t *msg );
+
+unsigned char *beginSendToRtprof( int length );
+int           endSendToRtprof( int length );
+unsigned int  clientCapabilities( void );
 #define sendFE(s,fe) send(s,(void *)&fe,sizeof(functionEvent_t),MSG_NOSIGNAL)
   
 #endif
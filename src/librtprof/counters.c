@@ -0,0 +1,306 @@
+/*
+ * Copyright (C) 2003 Tim Angus
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "counters.h"
+
+boolean                         counting = false;
+
+//the software event each counter_t is read from
+static const unsigned long long counterConfigs[ NUM_PERF_COUNTERS ] =
+{
+  PERF_COUNT_SW_PAGE_FAULTS,
+  PERF_COUNT_SW_CONTEXT_SWITCHES,
+  PERF_COUNT_SW_CPU_MIGRATIONS
+};
+
+//the perf events counting one thread; fds[ 0 ] leads the group, so
+//reading it reads them all
+typedef struct counterGroup_s
+{
+  int                   fds[ NUM_PERF_COUNTERS ];
+  struct counterGroup_s *next;
+} counterGroup_t;
+
+static counterGroup_t           *groups = NULL;
+static pthread_mutex_t          groupsMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t            groupKey;
+static pthread_once_t           groupKeyOnce = PTHREAD_ONCE_INIT;
+static __thread counterGroup_t  *localGroup = NULL;
+
+/*
+===============
+openCounter
+
+Open a perf event counting a software event on the calling thread
+===============
+*/
+static int openCounter( unsigned long long config, int leader,
+                        boolean excludeKernel )
+{
+  struct perf_event_attr  attr;
+
+  memset( &attr, 0, sizeof( attr ) );
+  attr.type = PERF_TYPE_SOFTWARE;
+  attr.size = sizeof( attr );
+  attr.config = config;
+  attr.read_format = PERF_FORMAT_GROUP;
+  attr.exclude_kernel = excludeKernel;
+  attr.exclude_hv = 1;
+
+  return (int)syscall( SYS_perf_event_open, &attr, 0, -1, leader,
+                       PERF_FLAG_FD_CLOEXEC );
+}
+
+/*
+===============
+closeGroup
+
+Close whatever is open of a group
+===============
+*/
+static void closeGroup( int *fds )
+{
+  int i;
+
+  for( i = 0; i < NUM_PERF_COUNTERS; i++ )
+  {
+    if( fds[ i ] >= 0 )
+      close( fds[ i ] );
+
+    fds[ i ] = -1;
+  }
+}
+
+/*
+===============
+openGroup
+
+Open every counter on the calling thread as one group
+===============
+*/
+static boolean openGroup( int *fds )
+{
+  int excludeKernel, i;
+
+  //where perf_event_paranoid only lets us count user mode, context
+  //switches can't be seen at all, but faults and migrations still can
+  for( excludeKernel = 0; excludeKernel <= 1; excludeKernel++ )
+  {
+    for( i = 0; i < NUM_PERF_COUNTERS; i++ )
+      fds[ i ] = -1;
+
+    for( i = 0; i < NUM_PERF_COUNTERS; i++ )
+    {
+      if( ( fds[ i ] = openCounter( counterConfigs[ i ], fds[ 0 ],
+                                    (boolean)excludeKernel ) ) < 0 )
+        break;
+    }
+
+    if( i == NUM_PERF_COUNTERS )
+      return true;
+
+    closeGroup( fds );
+  }
+
+  return false;
+}
+
+/*
+===============
+releaseGroup
+
+Thread exit handler; stops counting the thread
+===============
+*/
+static void releaseGroup( void *group )
+{
+  counterGroup_t  *g = (counterGroup_t *)group;
+  counterGroup_t  **prev;
+
+  localGroup = NULL;
+
+  pthread_mutex_lock( &groupsMutex );
+
+  for( prev = &groups; *prev != NULL; prev = &( *prev )->next )
+  {
+    if( *prev == g )
+    {
+      *prev = g->next;
+      break;
+    }
+  }
+
+  pthread_mutex_unlock( &groupsMutex );
+
+  closeGroup( g->fds );
+  free( g );
+}
+
+/*
+===============
+createGroupKey
+
+Create the key used to catch thread exit
+===============
+*/
+static void createGroupKey( void )
+{
+  pthread_key_create( &groupKey, releaseGroup );
+}
+
+/*
+===============
+registerGroup
+
+Start counting the calling thread; if the counters can't be opened the
+group is kept anyway, so the thread reads zeros rather than retrying
+every time
+===============
+*/
+static counterGroup_t *registerGroup( void )
+{
+  counterGroup_t *g;
+
+  pthread_once( &groupKeyOnce, createGroupKey );
+
+  if( ( g = (counterGroup_t *)malloc( sizeof( counterGroup_t ) ) ) == NULL )
+    return NULL;
+
+  openGroup( g->fds );
+
+  pthread_setspecific( groupKey, g );
+
+  pthread_mutex_lock( &groupsMutex );
+  g->next = groups;
+  groups = g;
+  pthread_mutex_unlock( &groupsMutex );
+
+  localGroup = g;
+
+  return g;
+}
+
+/*
+===============
+countersAvailable
+
+Can this process open the counters at all?
+===============
+*/
+boolean countersAvailable( void )
+{
+  int fds[ NUM_PERF_COUNTERS ];
+
+  if( !openGroup( fds ) )
+    return false;
+
+  closeGroup( fds );
+
+  return true;
+}
+
+/*
+===============
+sampleCounters
+
+Read the calling thread's counters, the perf ones with a single read of
+the group; software events have nothing a user mode read of the mmap'd
+page can see
+===============
+*/
+void sampleCounters( counters_t *c )
+{
+  counterGroup_t      *g = localGroup;
+  unsigned long long  values[ 1 + NUM_PERF_COUNTERS ];
+
+  if( !counting ||
+      ( g == NULL && ( g = registerGroup( ) ) == NULL ) || g->fds[ 0 ] < 0 ||
+      read( g->fds[ 0 ], values, sizeof( values ) ) != sizeof( values ) )
+    memset( c->count, 0, NUM_PERF_COUNTERS * sizeof( c->count[ 0 ] ) );
+  else
+  {
+    //values[ 0 ] is the number of counters in the group
+    memcpy( c->count, values + 1, NUM_PERF_COUNTERS * sizeof( c->count[ 0 ] ) );
+  }
+
+  sampleAllocs( c->count );
+  sampleLocks( c->count );
+  sampleIo( c->count );
+}
+
+/*
+===============
+lockCounters
+
+Hold the group list still across a fork
+===============
+*/
+void lockCounters( void )
+{
+  pthread_mutex_lock( &groupsMutex );
+}
+
+/*
+===============
+unlockCounters
+
+Undo lockCounters, in the parent or the child
+===============
+*/
+void unlockCounters( void )
+{
+  pthread_mutex_unlock( &groupsMutex );
+}
+
+/*
+===============
+forkCounters
+
+Called in the child after a fork; every group counts a thread of the
+parent, including the one that forked, so the child starts afresh
+===============
+*/
+void forkCounters( void )
+{
+  counterGroup_t *g;
+
+  pthread_mutex_lock( &groupsMutex );
+
+  while( ( g = groups ) != NULL )
+  {
+    groups = g->next;
+    closeGroup( g->fds );
+    free( g );
+  }
+
+  pthread_mutex_unlock( &groupsMutex );
+
+  if( localGroup != NULL )
+  {
+    pthread_setspecific( groupKey, NULL );
+    localGroup = NULL;
+  }
+}
@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2003 Tim Angus
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef COUNTERS_H
+#define COUNTERS_H
+
+#include <string.h>
+
+#include "../rtprof/com_common.h"
+#include "alloc.h"
+#include "locks.h"
+#include "io.h"
+
+#define RTPROF_COUNTERS   "RTPROF_COUNTERS"
+
+//the counters read from perf events come first
+#define NUM_PERF_COUNTERS CNT_ALLOCS
+
+//a reading of the calling thread's software counters
+typedef struct counters_s
+{
+  unsigned long long  count[ NUM_COUNTERS ];
+} counters_t;
+
+//whether the hooks read the perf counters, as agreed with rtprof
+extern boolean  counting;
+
+boolean countersAvailable( void );
+void    sampleCounters( counters_t *c );
+void    lockCounters( void );
+void    unlockCounters( void );
+void    forkCounters( void );
+
+/*
+===============
+countersWanted
+
+Whether any counters are being collected at all
+===============
+*/
+static inline boolean countersWanted( void )
+{
+  return counting || trackingAllocs || trackingLocks || trackingIo;
+}
+
+/*
+===============
+readCounters
+
+Read the calling thread's counters, or zeros for those that aren't
+being collected; c is left alone when none are, as nothing reads it
+===============
+*/
+static inline void readCounters( counters_t *c )
+{
+  if( countersWanted( ) )
+    sampleCounters( c );
+}
+
+#endif
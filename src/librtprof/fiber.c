@@ -0,0 +1,413 @@
+/*
+ * Copyright (C) 2003 Tim Angus
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "fiber.h"
+#include "alloc.h"
+#include "buffer.h"
+#include "throttle.h"
+
+#define FIBER_HASH(f)     ( (unsigned int)( (unsigned long)(f) * \
+                                            0x9e3779b97f4a7c15ULL >> 40 ) )
+
+boolean                   trackingFibers = false;
+
+//guards the table; a spinlock of its own, as a mutex would go through
+//the lock wrappers
+static volatile int       fibersLock = 0;
+static fiber_t            *fiberBuckets[ FIBER_BUCKETS ];
+
+//the fiber the calling thread is running, or NULL for its own stack,
+//which is set aside in threadFiber meanwhile
+static __thread fiber_t   *localFiber = NULL;
+static __thread fiber_t   *threadFiber = NULL;
+static pthread_key_t      threadKey;
+static pthread_once_t     threadKeyOnce = PTHREAD_ONCE_INIT;
+
+/*
+===============
+lockFibersSpin
+
+Take fibersLock
+===============
+*/
+static inline void lockFibersSpin( void )
+{
+  while( __atomic_exchange_n( &fibersLock, 1, __ATOMIC_ACQUIRE ) )
+    sched_yield( );
+}
+
+/*
+===============
+unlockFibersSpin
+
+Release fibersLock
+===============
+*/
+static inline void unlockFibersSpin( void )
+{
+  __atomic_store_n( &fibersLock, 0, __ATOMIC_RELEASE );
+}
+
+/*
+===============
+freeThreadFiber
+
+Thread exit handler; anything still set aside is the thread's own
+===============
+*/
+static void freeThreadFiber( void *fiber )
+{
+  fiber_t *f = (fiber_t *)fiber;
+
+  threadFiber = NULL;
+
+  free( f->frames );
+  free( f );
+}
+
+/*
+===============
+createThreadKey
+
+Create the key used to catch thread exit
+===============
+*/
+static void createThreadKey( void )
+{
+  pthread_key_create( &threadKey, freeThreadFiber );
+}
+
+/*
+===============
+ownFiber
+
+Return where the calling thread's own stack is set aside, creating it
+if needed
+===============
+*/
+static fiber_t *ownFiber( void )
+{
+  if( threadFiber != NULL )
+    return threadFiber;
+
+  pthread_once( &threadKeyOnce, createThreadKey );
+
+  if( ( threadFiber = (fiber_t *)calloc( 1, sizeof( fiber_t ) ) ) != NULL )
+    pthread_setspecific( threadKey, threadFiber );
+
+  return threadFiber;
+}
+
+/*
+===============
+searchFibers
+
+Look a fiber up in its bucket; call with fibersLock held
+===============
+*/
+static fiber_t *searchFibers( void *fiber, unsigned int bucket )
+{
+  fiber_t *f;
+
+  for( f = fiberBuckets[ bucket ]; f != NULL; f = f->chain )
+  {
+    if( f->fiber == fiber )
+      break;
+  }
+
+  return f;
+}
+
+/*
+===============
+findFiber
+
+Return the table entry for a fiber, creating it if needed
+===============
+*/
+static fiber_t *findFiber( void *fiber )
+{
+  fiber_t       *f, *n;
+  unsigned int  bucket = FIBER_HASH( fiber ) & ( FIBER_BUCKETS - 1 );
+
+  lockFibersSpin( );
+  f = searchFibers( fiber, bucket );
+  unlockFibersSpin( );
+
+  if( f != NULL )
+    return f;
+
+  //complete before anything else can find it; the id is taken without
+  //fibersLock held, as a fork takes the two the other way round
+  if( ( n = (fiber_t *)calloc( 1, sizeof( fiber_t ) ) ) == NULL )
+    return NULL;
+
+  n->fiber = fiber;
+  n->tid = newThreadId( );
+
+  lockFibersSpin( );
+
+  //another thread may have got there first
+  if( ( f = searchFibers( fiber, bucket ) ) == NULL )
+  {
+    n->chain = fiberBuckets[ bucket ];
+    fiberBuckets[ bucket ] = n;
+    f = n;
+    n = NULL;
+  }
+
+  unlockFibersSpin( );
+
+  if( n != NULL )
+  {
+    releaseThreadId( n->tid );
+    free( n );
+  }
+
+  return f;
+}
+
+/*
+===============
+setAside
+
+Move the calling thread's state for the stack it is leaving into f
+===============
+*/
+static void setAside( fiber_t *f, aggThread_t *t, unsigned int session,
+                      unsigned int filterDepth, timeStamp_t ts,
+                      timeStamp_t cpu, timeStamp_t aggTs, timeStamp_t aggCpu,
+                      const counters_t *counters )
+{
+  f->session = session;
+  f->filterDepth = filterDepth;
+
+  f->suspendTime = ts;
+  f->suspendCpu = cpu;
+  f->suspendAggTime = aggTs;
+  f->suspendAggCpu = aggCpu;
+  f->suspendCounters = *counters;
+
+  if( t != NULL )
+  {
+    f->frames = t->frames;
+    f->depth = t->depth;
+    f->maxDepth = t->maxDepth;
+  }
+
+  if( tracingCallPaths )
+  {
+    f->callDepth = callDepth;
+    memcpy( f->callPath, callPath, sizeof( f->callPath ) );
+  }
+}
+
+/*
+===============
+takeUp
+
+Move the state for the stack being switched to out of f and into the
+calling thread, so that none of the time since it was set aside is
+charged to the frames on it
+Returns the filter depth to carry on with
+===============
+*/
+static unsigned int takeUp( fiber_t *f, aggThread_t *t, unsigned int session,
+                            timeStamp_t ts, timeStamp_t cpu,
+                            timeStamp_t aggTs, timeStamp_t aggCpu,
+                            const counters_t *counters )
+{
+  aggFrame_t  *frame;
+  int         i, j;
+
+  //left over from before the last attach
+  if( f->session != session )
+  {
+    f->depth = 0;
+    f->filterDepth = 0;
+    f->callDepth = 0;
+  }
+
+  if( t != NULL )
+  {
+    for( i = 0; i < f->depth; i++ )
+    {
+      frame = &f->frames[ i ];
+
+      if( frame->mode == FRAME_AGGREGATED || frame->mode == FRAME_THROTTLED )
+      {
+        frame->entryTime += aggTs - f->suspendAggTime;
+        frame->entryCpu += aggCpu - f->suspendAggCpu;
+      }
+      else
+      {
+        frame->entryTime += ts - f->suspendTime;
+        frame->entryCpu += cpu - f->suspendCpu;
+      }
+
+      for( j = 0; j < NUM_COUNTERS; j++ )
+        frame->entryCounters.count[ j ] += counters->count[ j ] -
+                                           f->suspendCounters.count[ j ];
+    }
+
+    t->frames = f->frames;
+    t->depth = f->depth;
+    t->maxDepth = f->maxDepth;
+    f->frames = NULL;
+  }
+
+  if( tracingCallPaths )
+  {
+    callDepth = f->callDepth;
+    memcpy( callPath, f->callPath, sizeof( f->callPath ) );
+  }
+
+  return f->filterDepth;
+}
+
+/*
+===============
+switchFiber
+
+Set aside the calling thread's calls and carry on with those of fiber,
+or of the thread's own stack if it is NULL
+===============
+*/
+void switchFiber( void *fiber, unsigned int session,
+                  unsigned int *filterDepth, timeStamp_t ts,
+                  timeStamp_t cpu, const counters_t *counters )
+{
+  fiber_t     *from, *to;
+  aggThread_t *t = NULL;
+  timeStamp_t aggTs = 0, aggCpu = 0;
+
+  if( ( from = localFiber ) == NULL )
+    from = ownFiber( );
+
+  to = ( fiber != NULL ) ? findFiber( fiber ) : ownFiber( );
+
+  if( from == NULL || to == NULL || from == to )
+    return;
+
+  if( aggregateInterval > 0 || throttleRate > 0 || shortCallTicks > 0 )
+  {
+    if( ( t = aggregateThread( ) ) == NULL )
+      return;
+
+    //a new stack needs somewhere to put its frames before anything moves
+    if( to->frames == NULL )
+    {
+      if( ( to->frames = (aggFrame_t *)malloc( FIBER_STACK_DEPTH *
+                                               sizeof( aggFrame_t ) ) ) ==
+          NULL )
+        return;
+
+      to->maxDepth = FIBER_STACK_DEPTH;
+      to->depth = 0;
+    }
+
+    //a function held back on the stack being left is being suspended,
+    //not returned from
+    releasePending( t );
+
+    aggTs = compensate( t, ts );
+    aggCpu = compensateCpu( t, cpu );
+  }
+
+  //streamed events after this belong to the other stack
+  if( aggregateInterval == 0 )
+    queueEvent( EV_THREAD,
+                (void *)(unsigned long)( fiber != NULL ? to->tid + 1 : 0 ),
+                NULL, ts, cpu, counters );
+
+  setAside( from, t, session, *filterDepth, ts, cpu, aggTs, aggCpu,
+            counters );
+  *filterDepth = takeUp( to, t, session, ts, cpu, aggTs, aggCpu, counters );
+
+  localFiber = ( fiber != NULL ) ? to : NULL;
+}
+
+/*
+===============
+exitFiber
+
+Forget a fiber that has ended, leaving its id in *tid to be given back
+Returns false if there is nothing to forget, or it is still running
+===============
+*/
+boolean exitFiber( void *fiber, unsigned int *tid )
+{
+  fiber_t       *f, **prev;
+  unsigned int  bucket = FIBER_HASH( fiber ) & ( FIBER_BUCKETS - 1 );
+
+  if( localFiber != NULL && localFiber->fiber == fiber )
+    return false;
+
+  lockFibersSpin( );
+
+  for( prev = &fiberBuckets[ bucket ]; ( f = *prev ) != NULL;
+       prev = &f->chain )
+  {
+    if( f->fiber == fiber )
+    {
+      *prev = f->chain;
+      break;
+    }
+  }
+
+  unlockFibersSpin( );
+
+  if( f == NULL )
+    return false;
+
+  *tid = f->tid;
+
+  free( f->frames );
+  free( f );
+
+  return true;
+}
+
+/*
+===============
+lockFibers
+
+Hold the table still across a fork
+===============
+*/
+void lockFibers( void )
+{
+  lockFibersSpin( );
+}
+
+/*
+===============
+unlockFibers
+
+Undo lockFibers, in the parent or the child
+===============
+*/
+void unlockFibers( void )
+{
+  unlockFibersSpin( );
+}
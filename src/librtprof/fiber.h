@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2003 Tim Angus
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef FIBER_H
+#define FIBER_H
+
+#include "../rtprof/com_common.h"
+#include "aggregate.h"
+#include "callpath.h"
+#include "counters.h"
+
+//must be a power of two
+#define FIBER_BUCKETS     1024
+
+//initial depth of a fiber's shadow stack, when aggregating
+#define FIBER_STACK_DEPTH 16
+
+//a stack of calls rtprof_fiber_switch has been told about, or a thread's
+//own; a fiber's is freed by rtprof_fiber_exit, so a new fiber at the same
+//address starts with an empty stack
+typedef struct fiber_s
+{
+  void                *fiber;
+  unsigned int        tid;        //rtprof's id for the stack
+  unsigned int        session;    //when it was last switched away from
+
+  //the calling thread's state, set aside while the stack isn't running;
+  //frames is NULL while it is
+  aggFrame_t          *frames;
+  int                 depth, maxDepth;
+  unsigned int        filterDepth;
+  unsigned int        callDepth;
+  void                *callPath[ CALL_PATH_DEPTH ];
+
+  //the clocks when it was switched away from, as read and as compensated
+  //for aggregated frames
+  timeStamp_t         suspendTime;
+  timeStamp_t         suspendCpu;
+  timeStamp_t         suspendAggTime;
+  timeStamp_t         suspendAggCpu;
+  counters_t          suspendCounters;
+
+  struct fiber_s      *chain;     //in the same bucket
+} fiber_t;
+
+//whether rtprof can keep the stacks apart, as agreed with it
+extern boolean  trackingFibers;
+
+void    switchFiber( void *fiber, unsigned int session,
+                     unsigned int *filterDepth, timeStamp_t ts,
+                     timeStamp_t cpu, const counters_t *counters );
+boolean exitFiber( void *fiber, unsigned int *tid );
+void    lockFibers( void );
+void    unlockFibers( void );
+
+#endif
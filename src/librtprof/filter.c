@@ -0,0 +1,188 @@
+/*
+ * Copyright (C) 2003 Tim Angus
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "filter.h"
+
+filter_t * volatile activeFilter = NULL;
+
+//the hooks read filters without locking, so ones that have been
+//replaced are kept rather than freed; they only change when asked to
+static filter_t     *retiredFilters = NULL;
+
+//the ranges as rtprof last left them; only touched by the flusher
+static filterRange_t  *ranges = NULL;
+static int            numRanges = 0;
+
+/*
+===============
+searchFilter
+
+Binary search a filter's ranges for an address
+===============
+*/
+boolean searchFilter( filter_t *f, unsigned long address )
+{
+  int lo = 0, hi = f->numRanges - 1, mid;
+
+  //ranges may overlap, so find the last one starting at or before
+  //address and then look back through any that might still cover it
+  while( lo <= hi )
+  {
+    mid = ( lo + hi ) / 2;
+
+    if( f->ranges[ mid ].start <= address )
+      lo = mid + 1;
+    else
+      hi = mid - 1;
+  }
+
+  for( ; hi >= 0; hi-- )
+  {
+    if( f->ranges[ hi ].end >= address )
+      return true;
+  }
+
+  return false;
+}
+
+/*
+===============
+compareRanges
+
+qsort comparator for filterRange_t
+===============
+*/
+static int compareRanges( const void *a, const void *b )
+{
+  const filterRange_t *ra = (const filterRange_t *)a;
+  const filterRange_t *rb = (const filterRange_t *)b;
+
+  if( ra->start < rb->start )
+    return -1;
+  else if( ra->start > rb->start )
+    return 1;
+
+  return 0;
+}
+
+/*
+===============
+publishFilter
+
+Build a filter from the current ranges and make it active
+===============
+*/
+static void publishFilter( void )
+{
+  filter_t      *f = NULL, *old;
+  unsigned long page;
+  unsigned int  bit;
+  int           i;
+
+  if( numRanges > 0 )
+  {
+    if( ( f = (filter_t *)calloc( 1, sizeof( filter_t ) ) ) == NULL )
+      return;
+
+    if( ( f->ranges = (filterRange_t *)malloc(
+            numRanges * sizeof( filterRange_t ) ) ) == NULL )
+    {
+      free( f );
+      return;
+    }
+
+    f->numRanges = numRanges;
+    memcpy( f->ranges, ranges, numRanges * sizeof( filterRange_t ) );
+    qsort( f->ranges, numRanges, sizeof( filterRange_t ), compareRanges );
+
+    for( i = 0; i < numRanges; i++ )
+    {
+      //a range this big sets every bit anyway
+      if( ( ranges[ i ].end >> FILTER_PAGE_SHIFT ) -
+          ( ranges[ i ].start >> FILTER_PAGE_SHIFT ) >= FILTER_BITS )
+      {
+        memset( f->bits, 0xff, sizeof( f->bits ) );
+        break;
+      }
+
+      for( page = ranges[ i ].start >> FILTER_PAGE_SHIFT;
+           page <= ranges[ i ].end >> FILTER_PAGE_SHIFT; page++ )
+      {
+        bit = filterBit( page << FILTER_PAGE_SHIFT );
+        f->bits[ bit / 64 ] |= 1ULL << ( bit % 64 );
+      }
+    }
+  }
+
+  old = activeFilter;
+  __atomic_store_n( &activeFilter, f, __ATOMIC_RELEASE );
+
+  if( old != NULL )
+  {
+    old->retired = retiredFilters;
+    retiredFilters = old;
+  }
+}
+
+/*
+===============
+applyControl
+
+Act on a control message from rtprof
+===============
+*/
+void applyControl( controlMessage_t *msg )
+{
+  filterRange_t *r;
+  int           i, j;
+
+  switch( msg->type )
+  {
+    case CTL_FILTER:
+      if( ( r = (filterRange_t *)realloc( ranges, ( numRanges + 1 ) *
+                                          sizeof( filterRange_t ) ) ) == NULL )
+        return;
+
+      ranges = r;
+      ranges[ numRanges ].start = (unsigned long)msg->start;
+      ranges[ numRanges ].end = (unsigned long)msg->end;
+      numRanges++;
+      break;
+
+    case CTL_RESUME:
+      for( i = j = 0; i < numRanges; i++ )
+      {
+        if( ranges[ i ].start < msg->start || ranges[ i ].end > msg->end )
+          ranges[ j++ ] = ranges[ i ];
+      }
+
+      if( j == numRanges )
+        return;
+
+      numRanges = j;
+      break;
+
+    default:
+      return;
+  }
+
+  publishFilter( );
+}
@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2003 Tim Angus
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef FILTER_H
+#define FILTER_H
+
+#include "../rtprof/com_common.h"
+#include "../rtprof/com_protocol.h"
+
+//bits in the quick rejection bitmap; must be a power of two
+#define FILTER_BITS       65536
+
+//the bitmap is indexed by page
+#define FILTER_PAGE_SHIFT 12
+
+typedef struct filterRange_s
+{
+  unsigned long start;
+  unsigned long end;
+} filterRange_t;
+
+//never changed once published; a new one replaces it instead
+typedef struct filter_s
+{
+  int                 numRanges;
+  filterRange_t       *ranges;    //sorted by start
+
+  unsigned long long  bits[ FILTER_BITS / 64 ];
+
+  struct filter_s     *retired;
+} filter_t;
+
+//NULL when nothing is filtered
+extern filter_t * volatile activeFilter;
+
+void    applyControl( controlMessage_t *msg );
+boolean searchFilter( filter_t *f, unsigned long address );
+
+/*
+===============
+filterBit
+
+Which bitmap bit covers an address
+===============
+*/
+static inline unsigned int filterBit( unsigned long address )
+{
+  unsigned long page = address >> FILTER_PAGE_SHIFT;
+
+  return (unsigned int)( page ^ ( page >> 16 ) ) & ( FILTER_BITS - 1 );
+}
+
+/*
+===============
+filtered
+
+Check whether rtprof has asked for a function to be dropped; called
+from the hooks so keep it inline
+===============
+*/
+static inline boolean filtered( void *this_fn )
+{
+  filter_t      *f = __atomic_load_n( &activeFilter, __ATOMIC_ACQUIRE );
+  unsigned int  bit;
+
+  if( f == NULL )
+    return false;
+
+  bit = filterBit( (unsigned long)this_fn );
+
+  if( !( f->bits[ bit / 64 ] & ( 1ULL << ( bit % 64 ) ) ) )
+    return false;
+
+  return searchFilter( f, (unsigned long)this_fn );
+}
+
+#endif
@@ -0,0 +1,153 @@
+/*
+ * Copyright (C) 2003 Tim Angus
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "functions.h"
+
+typedef struct functionSlot_s
+{
+  void          *this_fn;
+  unsigned int  id;
+} functionSlot_t;
+
+//open addressed; this_fn == NULL marks an empty slot
+static functionSlot_t *table = NULL;
+static unsigned int   tableSize = 0;
+static unsigned int   numFunctions = 0;
+
+/*
+===============
+hashFunction
+
+Spread the bits of a function address
+===============
+*/
+static inline unsigned int hashFunction( void *this_fn )
+{
+  unsigned long long h = (unsigned long)this_fn;
+
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+
+  return (unsigned int)h;
+}
+
+/*
+===============
+insertFunction
+
+Put a function in the table, which must have a free slot
+===============
+*/
+static void insertFunction( void *this_fn, unsigned int id )
+{
+  unsigned int i = hashFunction( this_fn ) & ( tableSize - 1 );
+
+  while( table[ i ].this_fn != NULL )
+    i = ( i + 1 ) & ( tableSize - 1 );
+
+  table[ i ].this_fn = this_fn;
+  table[ i ].id = id;
+}
+
+/*
+===============
+growTable
+
+Double the size of the table
+===============
+*/
+static boolean growTable( void )
+{
+  functionSlot_t  *old = table;
+  unsigned int    oldSize = tableSize, i;
+
+  tableSize = oldSize ? oldSize * 2 : FUNCTION_TABLE_SIZE;
+
+  if( ( table = (functionSlot_t *)calloc( tableSize,
+                                          sizeof( functionSlot_t ) ) ) == NULL )
+  {
+    table = old;
+    tableSize = oldSize;
+    return false;
+  }
+
+  for( i = 0; i < oldSize; i++ )
+  {
+    if( old[ i ].this_fn != NULL )
+      insertFunction( old[ i ].this_fn, old[ i ].id );
+  }
+
+  free( old );
+
+  return true;
+}
+
+/*
+===============
+internFunction
+
+Return the id for a function, allocating the next one if it hasn't been
+seen before
+===============
+*/
+unsigned int internFunction( void *this_fn, boolean *isNew )
+{
+  unsigned int i;
+
+  *isNew = false;
+
+  if( tableSize > 0 )
+  {
+    i = hashFunction( this_fn ) & ( tableSize - 1 );
+
+    for( ; table[ i ].this_fn != NULL; i = ( i + 1 ) & ( tableSize - 1 ) )
+    {
+      if( table[ i ].this_fn == this_fn )
+        return table[ i ].id;
+    }
+  }
+
+  //keep the table at most half full
+  if( ( numFunctions + 1 ) * 2 > tableSize && !growTable( ) &&
+      numFunctions + 1 >= tableSize )
+    return 0;
+
+  insertFunction( this_fn, numFunctions );
+  *isNew = true;
+
+  return numFunctions++;
+}
+
+/*
+===============
+resetFunctions
+
+Forget every id, for when a new stream is started
+===============
+*/
+void resetFunctions( void )
+{
+  free( table );
+
+  table = NULL;
+  tableSize = numFunctions = 0;
+}
@@ -0,0 +1,32 @@
+/*
+ * Copyright (C) 2003 Tim Angus
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef FUNCTIONS_H
+#define FUNCTIONS_H
+
+#include "../rtprof/com_common.h"
+
+//initial number of slots in the function table; must be a power of two
+#define FUNCTION_TABLE_SIZE 4096
+
+//ids are only ever handed out by the thread draining the rings,
+//so none of this is locked
+unsigned int  internFunction( void *this_fn, boolean *isNew );
+void          resetFunctions( void );
+
+#endif
@@ -0,0 +1,328 @@
+/*
+ * Copyright (C) 2003 Tim Angus
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+
+#include "heap.h"
+#include "callpath.h"
+#include "comms.h"
+#include "clock.h"
+
+unsigned long                 heapInterval = 0;
+volatile unsigned int         heapFilter[ HEAP_FILTER_SIZE ];
+__thread long long            heapCountdown INITIAL_EXEC = 0;
+
+//xorshift state for drawing intervals; 0 until the thread's first draw
+static __thread unsigned long long  heapRandom INITIAL_EXEC = 0;
+
+//a sampled allocation that hasn't been freed yet
+typedef struct heapSample_s
+{
+  void                  *p;
+  heapPath_t            *path;
+
+  //what it stands for, counting the allocations that weren't sampled
+  unsigned long long    bytes;
+  unsigned long long    allocs;
+
+  struct heapSample_s   *chain;
+} heapSample_t;
+
+//guards everything below, and changes to paths' totals
+static pthread_mutex_t        heapMutex = PTHREAD_MUTEX_INITIALIZER;
+static heapSample_t           *sampleBuckets[ HEAP_BUCKETS ];
+static heapPath_t             *pathBuckets[ HEAP_BUCKETS ];
+static heapPath_t             *paths = NULL;
+
+//bumped whenever the live heap changes, so unchanged snapshots needn't
+//be sent again
+static volatile unsigned int  changes = 0;
+
+/*
+===============
+initHeap
+
+Decide whether to sample the heap, once rtprof has said what it supports
+===============
+*/
+void initHeap( void )
+{
+  char  *env = getenv( RTPROF_HEAP );
+
+  heapInterval = 0;
+
+  if( env == NULL || atol( env ) <= 0 )
+    return;
+
+  //call paths are sent as function ids
+  if( protocolVersion < 2 ||
+      ( protocolCapabilities & ( CAP_HEAP | CAP_FUNCIDS ) ) !=
+      ( CAP_HEAP | CAP_FUNCIDS ) )
+  {
+    fprintf( stderr, "WARNING: rtprof does not accept heap snapshots; "
+                     "not sampling the heap\n" );
+    return;
+  }
+
+  heapInterval = (unsigned long)atol( env );
+}
+
+/*
+===============
+nextInterval
+
+Draw the bytes until the calling thread's next sample; exponentially
+distributed, so that every byte allocated is equally likely to be
+sampled whatever the size of the allocations it comes in
+===============
+*/
+static long long nextInterval( void )
+{
+  double  u;
+
+  if( heapRandom == 0 )
+    heapRandom = ( (unsigned long long)(unsigned long)&heapRandom ^
+                   readClock( ) ) | 1;
+
+  heapRandom ^= heapRandom << 13;
+  heapRandom ^= heapRandom >> 7;
+  heapRandom ^= heapRandom << 17;
+
+  //uniform on (0, 1]
+  u = (double)( ( heapRandom >> 11 ) + 1 ) / 9007199254740992.0;
+
+  return (long long)( -log( u ) * (double)heapInterval ) + 1;
+}
+
+/*
+===============
+findPath
+
+Return the path with these functions, adding it if it is new; call with
+heapMutex held
+===============
+*/
+static heapPath_t *findPath( void **fns, int depth )
+{
+  heapPath_t    *path;
+  unsigned int  hash = (unsigned int)depth;
+  int           i;
+
+  for( i = 0; i < depth; i++ )
+    hash = hash * 31 + HEAP_HASH( fns[ i ] );
+
+  for( path = pathBuckets[ hash & ( HEAP_BUCKETS - 1 ) ]; path != NULL;
+       path = path->chain )
+  {
+    if( path->hash == hash && path->depth == depth &&
+        !memcmp( path->fns, fns, depth * sizeof( void * ) ) )
+      return path;
+  }
+
+  if( ( path = (heapPath_t *)calloc( 1, sizeof( heapPath_t ) ) ) == NULL )
+    return NULL;
+
+  memcpy( path->fns, fns, depth * sizeof( void * ) );
+  path->depth = depth;
+  path->hash = hash;
+
+  path->chain = pathBuckets[ hash & ( HEAP_BUCKETS - 1 ) ];
+  pathBuckets[ hash & ( HEAP_BUCKETS - 1 ) ] = path;
+
+  //filled in before the flusher can see it
+  path->next = paths;
+  __atomic_store_n( &paths, path, __ATOMIC_RELEASE );
+
+  return path;
+}
+
+/*
+===============
+sampleHeap
+
+Called when the calling thread's countdown runs out: record an
+allocation along with the call path that made it, standing in for all
+the bytes that weren't sampled
+===============
+*/
+void sampleHeap( void *p, size_t size )
+{
+  void          *fns[ HEAP_MAX_DEPTH ];
+  heapSample_t  *s;
+  heapPath_t    *path;
+  boolean       first = ( heapRandom == 0 );
+  boolean       wasInHook = inHook;
+  double        chance;
+  unsigned int  bucket;
+  int           depth;
+
+  heapCountdown = nextInterval( );
+
+  //a thread's first countdown starts at 0, so its first allocation
+  //isn't any more likely to be sampled than the rest
+  if( first || size == 0 )
+    return;
+
+  //allocations outside every instrumented function aren't anybody's
+  if( ( depth = readCallPath( fns ) ) == 0 )
+    return;
+
+  //librtprof's own allocations aren't sampled
+  inHook = true;
+
+  if( ( s = (heapSample_t *)malloc( sizeof( heapSample_t ) ) ) == NULL )
+  {
+    inHook = wasInHook;
+    return;
+  }
+
+  //an allocation is sampled with this chance, so stands for 1 / chance
+  //allocations of its size
+  chance = 1.0 - exp( -(double)size / (double)heapInterval );
+
+  s->p = p;
+  s->bytes = (unsigned long long)( (double)size / chance );
+  s->allocs = (unsigned long long)( 1.0 / chance + 0.5 );
+
+  pthread_mutex_lock( &heapMutex );
+
+  if( ( path = findPath( fns, depth ) ) == NULL )
+  {
+    pthread_mutex_unlock( &heapMutex );
+    free( s );
+    inHook = wasInHook;
+    return;
+  }
+
+  s->path = path;
+
+  bucket = HEAP_HASH( p ) & ( HEAP_BUCKETS - 1 );
+  s->chain = sampleBuckets[ bucket ];
+  sampleBuckets[ bucket ] = s;
+
+  __atomic_store_n( &path->liveBytes, path->liveBytes + s->bytes,
+                    __ATOMIC_RELAXED );
+  __atomic_store_n( &path->liveAllocs, path->liveAllocs + s->allocs,
+                    __ATOMIC_RELAXED );
+  __atomic_add_fetch( &heapFilter[ HEAP_HASH( p ) & ( HEAP_FILTER_SIZE - 1 ) ],
+                      1, __ATOMIC_RELAXED );
+  changes++;
+
+  pthread_mutex_unlock( &heapMutex );
+
+  inHook = wasInHook;
+}
+
+/*
+===============
+forgetHeap
+
+Called as memory that may have been sampled is freed, before it can be
+handed out again
+===============
+*/
+void forgetHeap( void *p )
+{
+  heapSample_t  *s, **prev;
+  heapPath_t    *path;
+  boolean       wasInHook = inHook;
+
+  //nor are waits for librtprof's own locks counted
+  inHook = true;
+  pthread_mutex_lock( &heapMutex );
+
+  for( prev = &sampleBuckets[ HEAP_HASH( p ) & ( HEAP_BUCKETS - 1 ) ];
+       ( s = *prev ) != NULL; prev = &s->chain )
+  {
+    if( s->p == p )
+      break;
+  }
+
+  if( s != NULL )
+  {
+    *prev = s->chain;
+    path = s->path;
+
+    __atomic_store_n( &path->liveBytes, path->liveBytes - s->bytes,
+                      __ATOMIC_RELAXED );
+    __atomic_store_n( &path->liveAllocs, path->liveAllocs - s->allocs,
+                      __ATOMIC_RELAXED );
+    __atomic_sub_fetch( &heapFilter[ HEAP_HASH( p ) &
+                                     ( HEAP_FILTER_SIZE - 1 ) ],
+                        1, __ATOMIC_RELAXED );
+    changes++;
+  }
+
+  pthread_mutex_unlock( &heapMutex );
+
+  free( s );
+  inHook = wasInHook;
+}
+
+/*
+===============
+heapPaths
+
+The newest path; the rest follow it through next
+===============
+*/
+heapPath_t *heapPaths( void )
+{
+  return __atomic_load_n( &paths, __ATOMIC_ACQUIRE );
+}
+
+/*
+===============
+heapChanges
+
+How many times the live heap has changed
+===============
+*/
+unsigned int heapChanges( void )
+{
+  return __atomic_load_n( &changes, __ATOMIC_RELAXED );
+}
+
+/*
+===============
+lockHeap
+
+Keep the sample table consistent across a fork
+===============
+*/
+void lockHeap( void )
+{
+  pthread_mutex_lock( &heapMutex );
+}
+
+/*
+===============
+unlockHeap
+
+Undo lockHeap, in the parent or the child; the child keeps the samples,
+as it has a copy of the memory they describe
+===============
+*/
+void unlockHeap( void )
+{
+  pthread_mutex_unlock( &heapMutex );
+}
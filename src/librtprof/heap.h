@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) 2003 Tim Angus
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef HEAP_H
+#define HEAP_H
+
+#include <stddef.h>
+
+#include "../rtprof/com_common.h"
+#include "../rtprof/com_protocol.h"
+#include "alloc.h"
+
+#define RTPROF_HEAP         "RTPROF_HEAP"
+
+//milliseconds between snapshots of the live heap
+#define HEAP_SNAPSHOT_MSEC  500
+
+//both must be powers of two
+#define HEAP_FILTER_SIZE    16384
+#define HEAP_BUCKETS        4096
+
+#define HEAP_HASH(p)        ( (unsigned int)( ( (unsigned long)(p) >> 4 ) * \
+                                              0x9e3779b97f4a7c15ULL >> 40 ) )
+
+//a call path that allocations have been sampled on; paths are never
+//freed, so the flusher can walk the list without a lock
+typedef struct heapPath_s
+{
+  void                        *fns[ HEAP_MAX_DEPTH ];   //outermost first
+  int                         depth;
+  unsigned int                hash;
+
+  //estimates, from the samples not yet freed
+  volatile unsigned long long liveBytes;
+  volatile unsigned long long liveAllocs;
+
+  struct heapPath_s           *chain;   //in the same bucket
+  struct heapPath_s           *next;    //every path, newest first
+} heapPath_t;
+
+//mean bytes allocated between samples, or 0 when not sampling
+extern unsigned long                heapInterval;
+
+//for each hash of a pointer, how many sampled allocations have it
+extern volatile unsigned int        heapFilter[ HEAP_FILTER_SIZE ];
+
+//bytes the calling thread can allocate before the next sample
+extern __thread long long           heapCountdown INITIAL_EXEC;
+
+void          initHeap( void );
+void          sampleHeap( void *p, size_t size );
+void          forgetHeap( void *p );
+heapPath_t    *heapPaths( void );
+unsigned int  heapChanges( void );
+void          lockHeap( void );
+void          unlockHeap( void );
+
+/*
+===============
+heapAllocated
+
+Count an allocation towards the next sample, taking it if due
+===============
+*/
+static inline void heapAllocated( void *p, size_t size )
+{
+  if( ( heapCountdown -= (long long)size ) > 0 || p == NULL )
+    return;
+
+  sampleHeap( p, size );
+}
+
+/*
+===============
+heapFreed
+
+Forget an allocation if it was sampled; most weren't, which is found
+out without taking a lock
+===============
+*/
+static inline void heapFreed( void *p )
+{
+  unsigned int  slot = HEAP_HASH( p ) & ( HEAP_FILTER_SIZE - 1 );
+
+  if( __atomic_load_n( &heapFilter[ slot ], __ATOMIC_RELAXED ) == 0 )
+    return;
+
+  forgetHeap( p );
+}
+
+#endif
@@ -0,0 +1,638 @@
+/*
+ * Copyright (C) 2003 Tim Angus
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <poll.h>
+
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <sys/epoll.h>
+
+#include "io.h"
+#include "clock.h"
+
+boolean                   trackingIo = false;
+
+//librtprof's own socket to rtprof
+extern int                connection;
+
+//the calling thread's totals; time is in clock ticks until sampled
+static __thread unsigned long long  ioCounts[ NUM_IO_COUNTERS ] INITIAL_EXEC;
+
+#define IO_COUNT(c)       ioCounts[ (c) - CNT_IO_CALLS ]
+
+//the functions librtprof stands in front of, looked up as first used
+static ssize_t  ( *realRead )( int fd, void *buf, size_t count );
+static ssize_t  ( *realWrite )( int fd, const void *buf, size_t count );
+static ssize_t  ( *realPread )( int fd, void *buf, size_t count,
+                                off_t offset );
+static ssize_t  ( *realPwrite )( int fd, const void *buf, size_t count,
+                                 off_t offset );
+static ssize_t  ( *realPread64 )( int fd, void *buf, size_t count,
+                                  off64_t offset );
+static ssize_t  ( *realPwrite64 )( int fd, const void *buf, size_t count,
+                                   off64_t offset );
+static ssize_t  ( *realReadv )( int fd, const struct iovec *iov, int n );
+static ssize_t  ( *realWritev )( int fd, const struct iovec *iov, int n );
+static ssize_t  ( *realRecv )( int fd, void *buf, size_t len, int flags );
+static ssize_t  ( *realRecvfrom )( int fd, void *buf, size_t len, int flags,
+                                   struct sockaddr *from, socklen_t *fromLen );
+static ssize_t  ( *realRecvmsg )( int fd, struct msghdr *msg, int flags );
+static ssize_t  ( *realSend )( int fd, const void *buf, size_t len,
+                               int flags );
+static ssize_t  ( *realSendto )( int fd, const void *buf, size_t len,
+                                 int flags, const struct sockaddr *to,
+                                 socklen_t toLen );
+static ssize_t  ( *realSendmsg )( int fd, const struct msghdr *msg,
+                                  int flags );
+static int      ( *realPoll )( struct pollfd *fds, nfds_t n, int timeout );
+static int      ( *realSelect )( int n, fd_set *r, fd_set *w, fd_set *e,
+                                 struct timeval *timeout );
+static int      ( *realEpollWait )( int epfd, struct epoll_event *events,
+                                    int max, int timeout );
+static int      ( *realFsync )( int fd );
+static int      ( *realFdatasync )( int fd );
+
+/*
+===============
+resolveIo
+
+Find whichever function name would have been used without librtprof,
+unless it has already been found
+Returns false, with errno set, if there isn't one
+===============
+*/
+static boolean resolveIo( void **real, const char *name )
+{
+  void *fn;
+
+  if( __atomic_load_n( real, __ATOMIC_ACQUIRE ) != NULL )
+    return true;
+
+  if( ( fn = dlsym( RTLD_NEXT, name ) ) == NULL )
+  {
+    errno = ENOSYS;
+    return false;
+  }
+
+  __atomic_store_n( real, fn, __ATOMIC_RELEASE );
+
+  return true;
+}
+
+#define RESOLVE_IO(r,n)   resolveIo( (void **)&(r), (n) )
+
+/*
+===============
+watchingIo
+
+Should a call on fd be counted? Not for librtprof's own, nor while the
+hooks run
+===============
+*/
+static inline boolean watchingIo( int fd )
+{
+  return trackingIo && !inHook && ( fd < 0 || fd != connection );
+}
+
+/*
+===============
+ioDone
+
+Count a call that started at start, having read in bytes and written
+out bytes
+===============
+*/
+static inline void ioDone( timeStamp_t start, ssize_t in, ssize_t out )
+{
+  IO_COUNT( CNT_IO_TIME ) += readClock( ) - start;
+  IO_COUNT( CNT_IO_CALLS )++;
+
+  if( in > 0 )
+    IO_COUNT( CNT_IO_BYTES_IN ) += in;
+
+  if( out > 0 )
+    IO_COUNT( CNT_IO_BYTES_OUT ) += out;
+}
+
+/*
+===============
+sampleIo
+
+Fill in the calling thread's i/o counters
+===============
+*/
+void sampleIo( unsigned long long *counts )
+{
+  if( !trackingIo )
+  {
+    memset( counts + CNT_IO_CALLS, 0, sizeof( ioCounts ) );
+    return;
+  }
+
+  counts[ CNT_IO_CALLS ] = IO_COUNT( CNT_IO_CALLS );
+  counts[ CNT_IO_BYTES_IN ] = IO_COUNT( CNT_IO_BYTES_IN );
+  counts[ CNT_IO_BYTES_OUT ] = IO_COUNT( CNT_IO_BYTES_OUT );
+  counts[ CNT_IO_TIME ] = (unsigned long long)(
+    (double)IO_COUNT( CNT_IO_TIME ) * 1.0e9 / (double)clockRate( ) );
+}
+
+/*
+===============
+read
+
+Timed read
+===============
+*/
+ssize_t read( int fd, void *buf, size_t count )
+{
+  timeStamp_t start;
+  ssize_t     r;
+
+  if( !RESOLVE_IO( realRead, "read" ) )
+    return -1;
+
+  if( !watchingIo( fd ) )
+    return realRead( fd, buf, count );
+
+  start = readClock( );
+  r = realRead( fd, buf, count );
+  ioDone( start, r, 0 );
+
+  return r;
+}
+
+/*
+===============
+write
+
+Timed write
+===============
+*/
+ssize_t write( int fd, const void *buf, size_t count )
+{
+  timeStamp_t start;
+  ssize_t     r;
+
+  if( !RESOLVE_IO( realWrite, "write" ) )
+    return -1;
+
+  if( !watchingIo( fd ) )
+    return realWrite( fd, buf, count );
+
+  start = readClock( );
+  r = realWrite( fd, buf, count );
+  ioDone( start, 0, r );
+
+  return r;
+}
+
+/*
+===============
+pread
+
+Timed pread
+===============
+*/
+ssize_t pread( int fd, void *buf, size_t count, off_t offset )
+{
+  timeStamp_t start;
+  ssize_t     r;
+
+  if( !RESOLVE_IO( realPread, "pread" ) )
+    return -1;
+
+  if( !watchingIo( fd ) )
+    return realPread( fd, buf, count, offset );
+
+  start = readClock( );
+  r = realPread( fd, buf, count, offset );
+  ioDone( start, r, 0 );
+
+  return r;
+}
+
+/*
+===============
+pwrite
+
+Timed pwrite
+===============
+*/
+ssize_t pwrite( int fd, const void *buf, size_t count, off_t offset )
+{
+  timeStamp_t start;
+  ssize_t     r;
+
+  if( !RESOLVE_IO( realPwrite, "pwrite" ) )
+    return -1;
+
+  if( !watchingIo( fd ) )
+    return realPwrite( fd, buf, count, offset );
+
+  start = readClock( );
+  r = realPwrite( fd, buf, count, offset );
+  ioDone( start, 0, r );
+
+  return r;
+}
+
+/*
+===============
+pread64
+
+Timed pread64, which is what pread becomes with _FILE_OFFSET_BITS=64
+===============
+*/
+ssize_t pread64( int fd, void *buf, size_t count, off64_t offset )
+{
+  timeStamp_t start;
+  ssize_t     r;
+
+  if( !RESOLVE_IO( realPread64, "pread64" ) )
+    return -1;
+
+  if( !watchingIo( fd ) )
+    return realPread64( fd, buf, count, offset );
+
+  start = readClock( );
+  r = realPread64( fd, buf, count, offset );
+  ioDone( start, r, 0 );
+
+  return r;
+}
+
+/*
+===============
+pwrite64
+
+Timed pwrite64
+===============
+*/
+ssize_t pwrite64( int fd, const void *buf, size_t count, off64_t offset )
+{
+  timeStamp_t start;
+  ssize_t     r;
+
+  if( !RESOLVE_IO( realPwrite64, "pwrite64" ) )
+    return -1;
+
+  if( !watchingIo( fd ) )
+    return realPwrite64( fd, buf, count, offset );
+
+  start = readClock( );
+  r = realPwrite64( fd, buf, count, offset );
+  ioDone( start, 0, r );
+
+  return r;
+}
+
+/*
+===============
+readv
+
+Timed readv
+===============
+*/
+ssize_t readv( int fd, const struct iovec *iov, int n )
+{
+  timeStamp_t start;
+  ssize_t     r;
+
+  if( !RESOLVE_IO( realReadv, "readv" ) )
+    return -1;
+
+  if( !watchingIo( fd ) )
+    return realReadv( fd, iov, n );
+
+  start = readClock( );
+  r = realReadv( fd, iov, n );
+  ioDone( start, r, 0 );
+
+  return r;
+}
+
+/*
+===============
+writev
+
+Timed writev
+===============
+*/
+ssize_t writev( int fd, const struct iovec *iov, int n )
+{
+  timeStamp_t start;
+  ssize_t     r;
+
+  if( !RESOLVE_IO( realWritev, "writev" ) )
+    return -1;
+
+  if( !watchingIo( fd ) )
+    return realWritev( fd, iov, n );
+
+  start = readClock( );
+  r = realWritev( fd, iov, n );
+  ioDone( start, 0, r );
+
+  return r;
+}
+
+/*
+===============
+recv
+
+Timed recv
+===============
+*/
+ssize_t recv( int fd, void *buf, size_t len, int flags )
+{
+  timeStamp_t start;
+  ssize_t     r;
+
+  if( !RESOLVE_IO( realRecv, "recv" ) )
+    return -1;
+
+  if( !watchingIo( fd ) )
+    return realRecv( fd, buf, len, flags );
+
+  start = readClock( );
+  r = realRecv( fd, buf, len, flags );
+  ioDone( start, r, 0 );
+
+  return r;
+}
+
+/*
+===============
+recvfrom
+
+Timed recvfrom
+===============
+*/
+ssize_t recvfrom( int fd, void *buf, size_t len, int flags,
+                  struct sockaddr *from, socklen_t *fromLen )
+{
+  timeStamp_t start;
+  ssize_t     r;
+
+  if( !RESOLVE_IO( realRecvfrom, "recvfrom" ) )
+    return -1;
+
+  if( !watchingIo( fd ) )
+    return realRecvfrom( fd, buf, len, flags, from, fromLen );
+
+  start = readClock( );
+  r = realRecvfrom( fd, buf, len, flags, from, fromLen );
+  ioDone( start, r, 0 );
+
+  return r;
+}
+
+/*
+===============
+recvmsg
+
+Timed recvmsg
+===============
+*/
+ssize_t recvmsg( int fd, struct msghdr *msg, int flags )
+{
+  timeStamp_t start;
+  ssize_t     r;
+
+  if( !RESOLVE_IO( realRecvmsg, "recvmsg" ) )
+    return -1;
+
+  if( !watchingIo( fd ) )
+    return realRecvmsg( fd, msg, flags );
+
+  start = readClock( );
+  r = realRecvmsg( fd, msg, flags );
+  ioDone( start, r, 0 );
+
+  return r;
+}
+
+/*
+===============
+send
+
+Timed send
+===============
+*/
+ssize_t send( int fd, const void *buf, size_t len, int flags )
+{
+  timeStamp_t start;
+  ssize_t     r;
+
+  if( !RESOLVE_IO( realSend, "send" ) )
+    return -1;
+
+  if( !watchingIo( fd ) )
+    return realSend( fd, buf, len, flags );
+
+  start = readClock( );
+  r = realSend( fd, buf, len, flags );
+  ioDone( start, 0, r );
+
+  return r;
+}
+
+/*
+===============
+sendto
+
+Timed sendto
+===============
+*/
+ssize_t sendto( int fd, const void *buf, size_t len, int flags,
+                const struct sockaddr *to, socklen_t toLen )
+{
+  timeStamp_t start;
+  ssize_t     r;
+
+  if( !RESOLVE_IO( realSendto, "sendto" ) )
+    return -1;
+
+  if( !watchingIo( fd ) )
+    return realSendto( fd, buf, len, flags, to, toLen );
+
+  start = readClock( );
+  r = realSendto( fd, buf, len, flags, to, toLen );
+  ioDone( start, 0, r );
+
+  return r;
+}
+
+/*
+===============
+sendmsg
+
+Timed sendmsg
+===============
+*/
+ssize_t sendmsg( int fd, const struct msghdr *msg, int flags )
+{
+  timeStamp_t start;
+  ssize_t     r;
+
+  if( !RESOLVE_IO( realSendmsg, "sendmsg" ) )
+    return -1;
+
+  if( !watchingIo( fd ) )
+    return realSendmsg( fd, msg, flags );
+
+  start = readClock( );
+  r = realSendmsg( fd, msg, flags );
+  ioDone( start, 0, r );
+
+  return r;
+}
+
+/*
+===============
+poll
+
+Timed poll; librtprof polls its own socket with nothing else
+===============
+*/
+int poll( struct pollfd *fds, nfds_t n, int timeout )
+{
+  timeStamp_t start;
+  int         r;
+
+  if( !RESOLVE_IO( realPoll, "poll" ) )
+    return -1;
+
+  if( !watchingIo( n == 1 ? fds[ 0 ].fd : -1 ) )
+    return realPoll( fds, n, timeout );
+
+  start = readClock( );
+  r = realPoll( fds, n, timeout );
+  ioDone( start, 0, 0 );
+
+  return r;
+}
+
+/*
+===============
+select
+
+Timed select
+===============
+*/
+int select( int n, fd_set *r, fd_set *w, fd_set *e, struct timeval *timeout )
+{
+  timeStamp_t start;
+  int         count;
+
+  if( !RESOLVE_IO( realSelect, "select" ) )
+    return -1;
+
+  if( !watchingIo( -1 ) )
+    return realSelect( n, r, w, e, timeout );
+
+  start = readClock( );
+  count = realSelect( n, r, w, e, timeout );
+  ioDone( start, 0, 0 );
+
+  return count;
+}
+
+/*
+===============
+epoll_wait
+
+Timed epoll_wait
+===============
+*/
+int epoll_wait( int epfd, struct epoll_event *events, int max, int timeout )
+{
+  timeStamp_t start;
+  int         r;
+
+  if( !RESOLVE_IO( realEpollWait, "epoll_wait" ) )
+    return -1;
+
+  if( !watchingIo( epfd ) )
+    return realEpollWait( epfd, events, max, timeout );
+
+  start = readClock( );
+  r = realEpollWait( epfd, events, max, timeout );
+  ioDone( start, 0, 0 );
+
+  return r;
+}
+
+/*
+===============
+fsync
+
+Timed fsync
+===============
+*/
+int fsync( int fd )
+{
+  timeStamp_t start;
+  int         r;
+
+  if( !RESOLVE_IO( realFsync, "fsync" ) )
+    return -1;
+
+  if( !watchingIo( fd ) )
+    return realFsync( fd );
+
+  start = readClock( );
+  r = realFsync( fd );
+  ioDone( start, 0, 0 );
+
+  return r;
+}
+
+/*
+===============
+fdatasync
+
+Timed fdatasync
+===============
+*/
+int fdatasync( int fd )
+{
+  timeStamp_t start;
+  int         r;
+
+  if( !RESOLVE_IO( realFdatasync, "fdatasync" ) )
+    return -1;
+
+  if( !watchingIo( fd ) )
+    return realFdatasync( fd );
+
+  start = readClock( );
+  r = realFdatasync( fd );
+  ioDone( start, 0, 0 );
+
+  return r;
+}
@@ -0,0 +1,35 @@
+/*
+ * Copyright (C) 2003 Tim Angus
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef IO_H
+#define IO_H
+
+#include "../rtprof/com_common.h"
+#include "alloc.h"
+
+#define RTPROF_IO         "RTPROF_IO"
+
+//the counters from CNT_IO_CALLS on
+#define NUM_IO_COUNTERS   ( NUM_COUNTERS - CNT_IO_CALLS )
+
+//whether blocking i/o is counted, as agreed with rtprof
+extern boolean  trackingIo;
+
+void sampleIo( unsigned long long *counts );
+
+#endif
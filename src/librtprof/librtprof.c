@@ -17,50 +17,480 @@
  */
 
 #include <stdio.h>
-#include <sys/time.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
 
 #include "comms.h"
+#include "buffer.h"
+#include "clock.h"
+#include "counters.h"
+#include "aggregate.h"
+#include "throttle.h"
+#include "filter.h"
+#include "heap.h"
+#include "locks.h"
+#include "io.h"
+#include "callpath.h"
+#include "fiber.h"
+#include "annotate.h"
+#include "rtprof.h"
 #include "../rtprof/com_common.h"
 
-//static to avoid stack frame juggling
-static struct timeval   tv;
-static functionEvent_t  fe;
 int                     connection = -1;
-static boolean          attemptedConnection = false;
+
+//the only thing the hooks look at while no profiler is attached
+volatile boolean        attached = false;
+
+//serialises attaching and exiting
+static pthread_mutex_t  attachMutex = PTHREAD_MUTEX_INITIALIZER;
+static boolean          clockStarted = false;
+static boolean          exiting = false;
+
+//milliseconds between attempts to attach, or 0 to only try at startup
+static int              attachInterval = 0;
+static pthread_t        watcherThread;
+
+//set in a forked child, which attaches from its first hook rather than
+//from the fork handler, keeping the parent's measured overhead
+static volatile boolean needsAttach = false;
+static boolean          reattachChild = false;
+static boolean          keepOverhead = false;
+
+//bumped on every attach so threads can throw away stale state
+static volatile unsigned int  session = 0;
+static __thread unsigned int  threadSession = 0;
+
+//how deep the calling thread is inside a filtered function
+static __thread unsigned int  filterDepth = 0;
+
+//how many calls to time, and how many times, when measuring the hooks
+#define CALIBRATE_CALLS   4096
+#define CALIBRATE_ROUNDS  16
 
 /*
 ===============
-__cyg_profile_func_enter
+startSession
 
-Instrumentation function called on entry
+Throw away the calling thread's state from before the last attach
 ===============
 */
-void __cyg_profile_func_enter( void *this_fn, void *call_site )
+static void startSession( void )
+{
+  threadSession = session;
+  filterDepth = 0;
+  resetAggregateThread( );
+  resetCallPath( );
+}
+
+/*
+===============
+enterHook
+
+Everything the entry hook does once attached
+===============
+*/
+static inline void enterHook( void *this_fn, void *callSite )
 {
-  if( connection < 0 && !attemptedConnection )
+  counters_t  counters;
+
+  if( threadSession != session )
+    startSession( );
+
+  if( filterDepth > 0 || filtered( this_fn ) )
   {
-    attemptedConnection = true;
+    filterDepth++;
+    return;
+  }
 
-    if( ( connection = connectToRtprof( ) ) < 0 )
-      fprintf( stderr, "WARNING: librtprof cannot connect to rtprof\n" );
-    else
-      atexit( disconnectFromRtprof );
+  if( tracingCallPaths )
+    callPathEnter( this_fn );
+
+  //reading perf counters is i/o of librtprof's own
+  inHook = true;
+  readCounters( &counters );
+
+  if( aggregateInterval > 0 )
+    aggregateEnter( this_fn, callSite, readClock( ), readCpuClock( ),
+                    &counters );
+  else if( throttleRate > 0 || shortCallTicks > 0 )
+    throttleEnter( this_fn, callSite, readClock( ), readCpuClock( ),
+                   &counters );
+  else
+    queueEvent( EV_ENTER, this_fn, callSite, readClock( ), readCpuClock( ),
+                &counters );
+
+  inHook = false;
+}
+
+/*
+===============
+exitHook
+
+Everything the exit hook does once attached
+===============
+*/
+static inline void exitHook( void *this_fn )
+{
+  counters_t  counters;
+
+  if( threadSession != session )
+    startSession( );
+
+  if( filterDepth > 0 )
+  {
+    filterDepth--;
+    return;
+  }
+
+  if( tracingCallPaths )
+    callPathExit( );
+
+  //reading perf counters is i/o of librtprof's own
+  inHook = true;
+  readCounters( &counters );
+
+  if( aggregateInterval > 0 )
+    aggregateExit( this_fn, readClock( ), readCpuClock( ), &counters );
+  else if( throttleRate > 0 || shortCallTicks > 0 )
+    throttleExit( this_fn, readClock( ), readCpuClock( ), &counters );
+  else
+    queueEvent( EV_EXIT, this_fn, NULL, readClock( ), readCpuClock( ),
+                &counters );
+
+  inHook = false;
+}
+
+/*
+===============
+calibrateOverhead
+
+Time the hooks in whatever mode has been chosen, so rtprof can take
+their cost back out of the times it reports
+===============
+*/
+static void calibrateOverhead( void )
+{
+  unsigned int  depth = filterDepth;
+  timeStamp_t   start, elapsed, best = ~0ULL;
+  int           round, i;
+  char          *env;
+
+  if( ( env = getenv( RTPROF_OVERHEAD ) ) != NULL && atoi( env ) >= 0 )
+  {
+    hookOverhead = (timeStamp_t)atoi( env ) * clockRate( ) * OVERHEAD_SCALE /
+                   1000000000ULL;
+    hookCpuOverhead = (timeStamp_t)atoi( env ) * OVERHEAD_SCALE;
+    return;
   }
-  
-  if( connection >= 0 )
+
+  //nothing is compensated while measuring
+  hookOverhead = hookCpuOverhead = 0;
+  filterDepth = 0;
+
+  for( round = 0; round < CALIBRATE_ROUNDS; round++ )
   {
-    gettimeofday( &tv, NULL );
+    //starting with an empty ring each time
+    resetBuffers( );
 
-    fe.type = EV_ENTER;
-    fe.this_fn = this_fn;
-    fe.ts = tv.tv_sec * 1000000 + tv.tv_usec;
+    start = readClock( );
 
-    if( sendFE( connection, fe ) < 0 )
+    for( i = 0; i < CALIBRATE_CALLS; i++ )
     {
-      disconnectFromFailedRtprof( );
-      fprintf( stderr, "WARNING: could not send to rtprof; disconnected\n" );
+      enterHook( (void *)calibrateOverhead, NULL );
+      exitHook( (void *)calibrateOverhead );
     }
+
+    //the quickest round is the one least disturbed by anything else
+    if( ( elapsed = readClock( ) - start ) < best )
+      best = elapsed;
   }
+
+  filterDepth = depth;
+  hookOverhead = best * OVERHEAD_SCALE / ( 2 * CALIBRATE_CALLS );
+
+  //the hooks are busy the whole time they take
+  hookCpuOverhead = hookOverhead * 1000000000ULL / clockRate( );
+}
+
+/*
+===============
+attach
+
+Connect to rtprof and start the flusher; call with attachMutex held
+===============
+*/
+static boolean attach( boolean quiet )
+{
+  //reap the flusher from the last connection
+  stopFlusher( );
+
+  if( ( connection = connectToRtprof( ) ) < 0 )
+  {
+    if( !quiet )
+      fprintf( stderr, "WARNING: librtprof cannot connect to rtprof\n" );
+
+    return false;
+  }
+
+  if( !clockStarted )
+  {
+    initClock( );
+    clockStarted = true;
+  }
+
+  if( announceToRtprof( ) < 0 )
+  {
+    disconnectFromFailedRtprof( );
+    fprintf( stderr, "WARNING: could not send to rtprof; disconnected\n" );
+    return false;
+  }
+
+  //before calibrating, so the cost of reading them is measured too
+  cpuTiming = protocolVersion >= 2 &&
+              ( protocolCapabilities & CAP_CPUTIME ) != 0;
+  counting = protocolVersion >= 2 &&
+             ( protocolCapabilities & CAP_COUNTERS ) != 0;
+  trackingAllocs = protocolVersion >= 2 &&
+                   ( protocolCapabilities & CAP_ALLOCS ) != 0;
+  trackingLocks = protocolVersion >= 2 &&
+                  ( protocolCapabilities & CAP_LOCKS ) != 0;
+  trackingIo = protocolVersion >= 2 &&
+               ( protocolCapabilities & CAP_IO ) != 0;
+  trackingFibers = protocolVersion >= 2 &&
+                   ( protocolCapabilities & CAP_FIBERS ) != 0;
+  trackingCallSites = protocolVersion >= 2 &&
+                      ( protocolCapabilities &
+                        ( CAP_CALLSITES | CAP_FUNCIDS ) ) ==
+                      ( CAP_CALLSITES | CAP_FUNCIDS );
+  trackingZones = protocolVersion >= 2 &&
+                  ( protocolCapabilities & ( CAP_ZONES | CAP_FUNCIDS ) ) ==
+                  ( CAP_ZONES | CAP_FUNCIDS );
+
+  initAggregation( );
+  initThrottle( );
+  initHeap( );
+  tracingCallPaths = heapInterval > 0 || trackingLocks;
+
+  //a forked child's hooks cost what its parent's did
+  if( keepOverhead )
+    keepOverhead = false;
+  else
+    calibrateOverhead( );
+
+  if( protocolVersion >= 2 && sendHello( ) < 0 )
+  {
+    disconnectFromFailedRtprof( );
+    fprintf( stderr, "WARNING: could not send to rtprof; disconnected\n" );
+    return false;
+  }
+
+  resetBuffers( );
+
+  session++;
+  attached = true;
+
+  if( startFlusher( ) < 0 )
+  {
+    attached = false;
+    disconnectFromFailedRtprof( );
+    fprintf( stderr, "WARNING: librtprof cannot start flusher thread\n" );
+    return false;
+  }
+
+  return true;
+}
+
+/*
+===============
+watcher
+
+Background thread that keeps trying to attach while dormant
+===============
+*/
+static void *watcher( void *arg )
+{
+  while( 1 )
+  {
+    usleep( attachInterval * 1000 );
+
+    pthread_mutex_lock( &attachMutex );
+
+    if( !exiting && !attached )
+      attach( true );
+
+    pthread_mutex_unlock( &attachMutex );
+  }
+
+  return NULL;
+}
+
+/*
+===============
+shutdownLibrtprof
+
+Exit handler
+===============
+*/
+static void shutdownLibrtprof( void )
+{
+  pthread_mutex_lock( &attachMutex );
+
+  exiting = true;
+  stopFlusher( );
+
+  pthread_mutex_unlock( &attachMutex );
+}
+
+/*
+===============
+prepareFork
+
+pthread_atfork handler; keep everything a child will need consistent
+===============
+*/
+static void prepareFork( void )
+{
+  pthread_mutex_lock( &attachMutex );
+  lockBuffers( );
+  lockAggregation( );
+  lockCounters( );
+  lockHeap( );
+  lockFibers( );
+
+  //last, as taking any of the others can mean adding a site
+  lockLockSites( );
+}
+
+/*
+===============
+parentFork
+
+pthread_atfork handler; the parent carries on with its own stream
+===============
+*/
+static void parentFork( void )
+{
+  unlockLockSites( );
+  unlockFibers( );
+  unlockHeap( );
+  unlockCounters( );
+  unlockAggregation( );
+  unlockBuffers( );
+  pthread_mutex_unlock( &attachMutex );
+}
+
+/*
+===============
+childFork
+
+pthread_atfork handler; the child leaves the parent's stream alone and
+attaches with one of its own once it first gets as far as a hook
+===============
+*/
+static void childFork( void )
+{
+  boolean wasAttached = attached;
+
+  unlockLockSites( );
+  unlockFibers( );
+  unlockHeap( );
+  unlockCounters( );
+  unlockAggregation( );
+  unlockBuffers( );
+
+  attached = false;
+  abandonRtprof( );
+  forkBuffers( );
+  forkAggregation( );
+  forkCounters( );
+
+  reattachChild = wasAttached;
+  keepOverhead = wasAttached;
+  needsAttach = !exiting && ( wasAttached || attachInterval > 0 );
+
+  pthread_mutex_unlock( &attachMutex );
+}
+
+/*
+===============
+attachChild
+
+Finish what childFork left undone; whichever thread gets here first
+does it, the rest carry on unprofiled. Returns whether it's attached
+===============
+*/
+static boolean attachChild( void )
+{
+  boolean wasInHook = inHook;
+
+  if( pthread_mutex_trylock( &attachMutex ) != 0 )
+    return false;
+
+  //the hooks aren't taking anything of the child's into account yet
+  inHook = true;
+
+  if( needsAttach && !exiting )
+  {
+    needsAttach = false;
+
+    if( reattachChild )
+      attach( attachInterval > 0 );
+
+    //threads don't survive a fork
+    if( attachInterval > 0 &&
+        pthread_create( &watcherThread, NULL, watcher, NULL ) == 0 )
+      pthread_detach( watcherThread );
+  }
+
+  inHook = wasInHook;
+  pthread_mutex_unlock( &attachMutex );
+
+  return attached;
+}
+
+/*
+===============
+initLibrtprof
+
+Runs when the library is loaded; attaches straight away if rtprof is
+listening and, with RTPROF_ATTACH set, keeps trying in the background
+if not
+===============
+*/
+static void __attribute__ ( ( constructor ) ) initLibrtprof( void )
+{
+  char *env;
+
+  if( ( env = getenv( RTPROF_ATTACH ) ) != NULL && atoi( env ) > 0 )
+    attachInterval = atoi( env );
+
+  atexit( shutdownLibrtprof );
+  pthread_atfork( prepareFork, parentFork, childFork );
+
+  pthread_mutex_lock( &attachMutex );
+  attach( attachInterval > 0 );
+  pthread_mutex_unlock( &attachMutex );
+
+  if( attachInterval > 0 &&
+      pthread_create( &watcherThread, NULL, watcher, NULL ) == 0 )
+    pthread_detach( watcherThread );
+}
+
+/*
+===============
+__cyg_profile_func_enter
+
+Instrumentation function called on entry
+===============
+*/
+void __cyg_profile_func_enter( void *this_fn, void *call_site )
+{
+  if( !attached && ( !needsAttach || !attachChild( ) ) )
+    return;
+
+  enterHook( this_fn, trackingCallSites ? call_site : NULL );
 }
 
 /*
@@ -72,18 +502,123 @@ Instrumentation function called on exit
 */
 void __cyg_profile_func_exit( void *this_fn, void *call_site )
 {
-  if( connection >= 0 )
-  {
-    gettimeofday( &tv, NULL );
+  if( !attached )
+    return;
+
+  exitHook( this_fn );
+}
+
+/*
+===============
+rtprof_fiber_switch
+
+Annotation for programs that switch stacks; see rtprof.h
+===============
+*/
+void rtprof_fiber_switch( void *fiber )
+{
+  counters_t  counters;
+
+  if( !attached || !trackingFibers )
+    return;
 
-    fe.type = EV_EXIT;
-    fe.this_fn = this_fn;
-    fe.ts = tv.tv_sec * 1000000 + tv.tv_usec;
+  if( threadSession != session )
+    startSession( );
 
-    if( sendFE( connection, fe ) < 0 )
+  //librtprof's own allocations aren't counted
+  inHook = true;
+  readCounters( &counters );
+
+  switchFiber( fiber, session, &filterDepth, readClock( ), readCpuClock( ),
+               &counters );
+
+  inHook = false;
+}
+
+/*
+===============
+rtprof_fiber_exit
+
+Annotation for a fiber that has ended; see rtprof.h
+===============
+*/
+void rtprof_fiber_exit( void *fiber )
+{
+  counters_t    counters;
+  unsigned int  tid;
+
+  //librtprof's own frees aren't counted
+  inHook = true;
+
+  if( fiber != NULL && exitFiber( fiber, &tid ) )
+  {
+    //rtprof has to hear of it after any switch to the fiber
+    if( attached && trackingFibers )
     {
-      disconnectFromFailedRtprof( );
-      fprintf( stderr, "WARNING: could not send to rtprof; disconnected\n" );
+      memset( &counters, 0, sizeof( counters ) );
+      queueEvent( EV_RETIRE, (void *)(unsigned long)tid, NULL, readClock( ),
+                  0, &counters );
     }
+    else
+      releaseThreadId( tid );
   }
+
+  inHook = false;
+}
+
+/*
+===============
+rtprof_zone_begin
+
+Annotation for the start of a named zone; see rtprof.h
+===============
+*/
+void rtprof_zone_begin( const char *name )
+{
+  if( !attached || !trackingZones )
+    return;
+
+  //a name that doesn't fit in the table is still timed, but rtprof only
+  //knows it by its address
+  internAnnotation( name );
+
+  enterHook( (void *)name,
+             trackingCallSites ? __builtin_return_address( 0 ) : NULL );
+}
+
+/*
+===============
+rtprof_zone_end
+
+Annotation for the end of the innermost zone; see rtprof.h
+===============
+*/
+void rtprof_zone_end( void )
+{
+  if( !attached || !trackingZones )
+    return;
+
+  //exits don't say what they leave
+  exitHook( NULL );
+}
+
+/*
+===============
+rtprof_counter
+
+Annotation for a value of the program's own; see rtprof.h
+===============
+*/
+void rtprof_counter( const char *name, long long value )
+{
+  if( !attached || !trackingZones || internAnnotation( name ) < 0 )
+    return;
+
+  if( threadSession != session )
+    startSession( );
+
+  //the ring may need allocating
+  inHook = true;
+  queueCounter( name, readClock( ), value );
+  inHook = false;
 }
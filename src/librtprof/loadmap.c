@@ -0,0 +1,191 @@
+/*
+ * Copyright (C) 2003 Tim Angus
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <link.h>
+
+#include "loadmap.h"
+
+//the loader's counts of objects loaded and unloaded when the load map
+//was last read; both only ever go up
+static unsigned long long readAdds, readSubs;
+static boolean            readOnce = false;
+
+typedef struct loadCounts_s
+{
+  unsigned long long  adds;
+  unsigned long long  subs;
+} loadCounts_t;
+
+typedef struct loadList_s
+{
+  loadModule_t  *modules;
+  int           numModules;
+  int           maxModules;
+  int           seen;         //including those with nothing to read
+  loadCounts_t  counts;
+} loadList_t;
+
+/*
+===============
+readCounts
+
+dl_iterate_phdr callback; every object carries the same counts, so the
+first will do
+===============
+*/
+static int readCounts( struct dl_phdr_info *info, size_t size, void *data )
+{
+  loadCounts_t  *counts = (loadCounts_t *)data;
+
+  counts->adds = info->dlpi_adds;
+  counts->subs = info->dlpi_subs;
+
+  return 1;
+}
+
+/*
+===============
+loadMapChanged
+
+Has anything been loaded or unloaded since the load map was last read?
+Cheap enough to ask on every flush
+===============
+*/
+boolean loadMapChanged( void )
+{
+  loadCounts_t  counts;
+
+  if( !readOnce )
+    return true;
+
+  dl_iterate_phdr( readCounts, &counts );
+
+  return counts.adds != readAdds || counts.subs != readSubs;
+}
+
+/*
+===============
+addModule
+
+dl_iterate_phdr callback; add an object to the list
+===============
+*/
+static int addModule( struct dl_phdr_info *info, size_t size, void *data )
+{
+  loadList_t    *list = (loadList_t *)data;
+  loadModule_t  *modules;
+  char          exe[ PATH_MAX ];
+  const char    *path = info->dlpi_name;
+  ssize_t       length;
+
+  if( list->seen++ == 0 )
+  {
+    list->counts.adds = info->dlpi_adds;
+    list->counts.subs = info->dlpi_subs;
+  }
+
+  //the executable comes first, without a name
+  if( list->seen == 1 && path[ 0 ] == '\0' )
+  {
+    if( ( length = readlink( "/proc/self/exe", exe, sizeof( exe ) - 1 ) ) <= 0 )
+      return 0;
+
+    exe[ length ] = '\0';
+    path = exe;
+  }
+
+  //the vdso and the like have no file to read symbols from
+  if( path[ 0 ] != '/' )
+    return 0;
+
+  if( list->numModules == list->maxModules )
+  {
+    list->maxModules = list->maxModules ? list->maxModules * 2 : 32;
+
+    if( ( modules = (loadModule_t *)realloc( list->modules,
+            list->maxModules * sizeof( loadModule_t ) ) ) == NULL )
+      return 1;
+
+    list->modules = modules;
+  }
+
+  if( ( list->modules[ list->numModules ].path = strdup( path ) ) == NULL )
+    return 1;
+
+  list->modules[ list->numModules++ ].bias = info->dlpi_addr;
+
+  return 0;
+}
+
+/*
+===============
+readLoadMap
+
+Every object mapped into the process that has symbols to be read
+===============
+*/
+loadModule_t *readLoadMap( int *numModules )
+{
+  loadList_t  list;
+
+  memset( &list, 0, sizeof( list ) );
+  dl_iterate_phdr( addModule, &list );
+
+  readAdds = list.counts.adds;
+  readSubs = list.counts.subs;
+  readOnce = true;
+
+  *numModules = list.numModules;
+
+  return list.modules;
+}
+
+/*
+===============
+freeLoadMap
+
+Free what readLoadMap returned
+===============
+*/
+void freeLoadMap( loadModule_t *modules, int numModules )
+{
+  int i;
+
+  for( i = 0; i < numModules; i++ )
+    free( modules[ i ].path );
+
+  free( modules );
+}
+
+/*
+===============
+resetLoadMap
+
+Forget the load map has been read, so it is sent again on a new stream
+===============
+*/
+void resetLoadMap( void )
+{
+  readOnce = false;
+}
@@ -0,0 +1,36 @@
+/*
+ * Copyright (C) 2003 Tim Angus
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef LOADMAP_H
+#define LOADMAP_H
+
+#include "../rtprof/com_common.h"
+
+//an object mapped into the process, as sent in a REC_MODULE
+typedef struct loadModule_s
+{
+  unsigned long long  bias;
+  char                *path;
+} loadModule_t;
+
+boolean       loadMapChanged( void );
+loadModule_t  *readLoadMap( int *numModules );
+void          freeLoadMap( loadModule_t *modules, int numModules );
+void          resetLoadMap( void );
+
+#endif
@@ -0,0 +1,557 @@
+/*
+ * Copyright (C) 2003 Tim Angus
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <pthread.h>
+#include <dlfcn.h>
+
+#include "locks.h"
+#include "callpath.h"
+#include "clock.h"
+
+boolean                   trackingLocks = false;
+
+extern volatile boolean   attached;
+
+//glibc's own names for them, in case there is nothing else to find;
+//weak, as newer glibc only keeps them for programs linked long ago
+extern int __pthread_mutex_lock( pthread_mutex_t *mutex )
+           __attribute__ ( ( weak ) );
+extern int __pthread_rwlock_rdlock( pthread_rwlock_t *rwlock )
+           __attribute__ ( ( weak ) );
+extern int __pthread_rwlock_wrlock( pthread_rwlock_t *rwlock )
+           __attribute__ ( ( weak ) );
+
+//the functions librtprof stands in front of
+static int                ( *realMutexLock )( pthread_mutex_t *mutex );
+static int                ( *realMutexTrylock )( pthread_mutex_t *mutex );
+static int                ( *realRdlock )( pthread_rwlock_t *rwlock );
+static int                ( *realTryrdlock )( pthread_rwlock_t *rwlock );
+static int                ( *realWrlock )( pthread_rwlock_t *rwlock );
+static int                ( *realTrywrlock )( pthread_rwlock_t *rwlock );
+static int                ( *realCondWait )( pthread_cond_t *cond,
+                                             pthread_mutex_t *mutex );
+static int                ( *realCondTimedwait )( pthread_cond_t *cond,
+                                                  pthread_mutex_t *mutex,
+                                                  const struct timespec *t );
+static volatile boolean   resolved = false;
+static __thread boolean   resolving INITIAL_EXEC = false;
+
+//the calling thread's totals; times are in clock ticks until sampled
+static __thread unsigned long long  lockCounts[ NUM_LOCK_COUNTERS ]
+                                    INITIAL_EXEC;
+
+#define LOCK_COUNT(c)     lockCounts[ (c) - CNT_LOCK_WAITS ]
+
+#define SITE_HASH(f,l)    ( (unsigned int)( ( (unsigned long)(f) ^ \
+                                              ( (unsigned long)(l) >> 4 ) ) * \
+                                            0x9e3779b97f4a7c15ULL >> 40 ) )
+
+//guards the sites; a spinlock of its own, as a mutex would come back
+//through the wrappers below
+static volatile int           sitesLock = 0;
+static lockSite_t             *siteBuckets[ LOCK_BUCKETS ];
+static lockSite_t             *sites = NULL;
+
+//bumped whenever a site changes, so unchanged snapshots needn't be sent
+static volatile unsigned int  changes = 0;
+
+/*
+===============
+fallbackMutexLock
+
+pthread_mutex_lock without librtprof in the way; the try functions
+aren't stood in front of, so failing glibc's own name, trying until it
+isn't held any more will do
+===============
+*/
+static int fallbackMutexLock( pthread_mutex_t *mutex )
+{
+  int r;
+
+  if( __pthread_mutex_lock != NULL )
+    return __pthread_mutex_lock( mutex );
+
+  while( ( r = pthread_mutex_trylock( mutex ) ) == EBUSY )
+    sched_yield( );
+
+  return r;
+}
+
+/*
+===============
+fallbackRdlock
+
+pthread_rwlock_rdlock without librtprof in the way
+===============
+*/
+static int fallbackRdlock( pthread_rwlock_t *rwlock )
+{
+  int r;
+
+  if( __pthread_rwlock_rdlock != NULL )
+    return __pthread_rwlock_rdlock( rwlock );
+
+  while( ( r = pthread_rwlock_tryrdlock( rwlock ) ) == EBUSY )
+    sched_yield( );
+
+  return r;
+}
+
+/*
+===============
+fallbackWrlock
+
+pthread_rwlock_wrlock without librtprof in the way
+===============
+*/
+static int fallbackWrlock( pthread_rwlock_t *rwlock )
+{
+  int r;
+
+  if( __pthread_rwlock_wrlock != NULL )
+    return __pthread_rwlock_wrlock( rwlock );
+
+  while( ( r = pthread_rwlock_trywrlock( rwlock ) ) == EBUSY )
+    sched_yield( );
+
+  return r;
+}
+
+/*
+===============
+resolveLocks
+
+Find whichever pthread functions would have been used without librtprof
+===============
+*/
+static void resolveLocks( void )
+{
+  resolving = true;
+
+  realMutexLock = dlsym( RTLD_NEXT, "pthread_mutex_lock" );
+  realMutexTrylock = dlsym( RTLD_NEXT, "pthread_mutex_trylock" );
+  realRdlock = dlsym( RTLD_NEXT, "pthread_rwlock_rdlock" );
+  realTryrdlock = dlsym( RTLD_NEXT, "pthread_rwlock_tryrdlock" );
+  realWrlock = dlsym( RTLD_NEXT, "pthread_rwlock_wrlock" );
+  realTrywrlock = dlsym( RTLD_NEXT, "pthread_rwlock_trywrlock" );
+  realCondWait = dlsym( RTLD_NEXT, "pthread_cond_wait" );
+  realCondTimedwait = dlsym( RTLD_NEXT, "pthread_cond_timedwait" );
+
+  if( realMutexLock == NULL || realMutexTrylock == NULL )
+  {
+    realMutexLock = fallbackMutexLock;
+    realMutexTrylock = pthread_mutex_trylock;
+  }
+
+  if( realRdlock == NULL || realTryrdlock == NULL )
+  {
+    realRdlock = fallbackRdlock;
+    realTryrdlock = pthread_rwlock_tryrdlock;
+  }
+
+  if( realWrlock == NULL || realTrywrlock == NULL )
+  {
+    realWrlock = fallbackWrlock;
+    realTrywrlock = pthread_rwlock_trywrlock;
+  }
+
+  resolving = false;
+
+  __atomic_store_n( &resolved, true, __ATOMIC_RELEASE );
+}
+
+/*
+===============
+locksReady
+
+Can the real functions be called yet? Looks them up if not, unless the
+calling thread is already doing so, in which case it has to make do with
+the fallbacks above
+===============
+*/
+static inline boolean locksReady( void )
+{
+  if( __atomic_load_n( &resolved, __ATOMIC_ACQUIRE ) )
+    return true;
+
+  if( resolving )
+    return false;
+
+  resolveLocks( );
+
+  return true;
+}
+
+/*
+===============
+initLocks
+
+Look the real functions up before librtprof's own constructor, or the
+program, takes a lock
+===============
+*/
+static void __attribute__ ( ( constructor( 101 ) ) ) initLocks( void )
+{
+  locksReady( );
+}
+
+/*
+===============
+condFallback
+
+Stands in for a condition variable wait that can't be made yet; waking
+spuriously is allowed, so the mutex is just let go of for a moment
+===============
+*/
+static int condFallback( pthread_mutex_t *mutex )
+{
+  pthread_mutex_unlock( mutex );
+  sched_yield( );
+
+  return fallbackMutexLock( mutex );
+}
+
+/*
+===============
+lockSitesSpin
+
+Take sitesLock
+===============
+*/
+static inline void lockSitesSpin( void )
+{
+  while( __atomic_exchange_n( &sitesLock, 1, __ATOMIC_ACQUIRE ) )
+    sched_yield( );
+}
+
+/*
+===============
+unlockSitesSpin
+
+Release sitesLock
+===============
+*/
+static inline void unlockSitesSpin( void )
+{
+  __atomic_store_n( &sitesLock, 0, __ATOMIC_RELEASE );
+}
+
+/*
+===============
+addSiteWait
+
+Charge a wait for a lock to the function that waited
+===============
+*/
+static void addSiteWait( void *fn, void *lock, timeStamp_t ticks )
+{
+  lockSite_t    *site;
+  unsigned int  bucket = SITE_HASH( fn, lock ) & ( LOCK_BUCKETS - 1 );
+  boolean       wasInHook = inHook;
+
+  //librtprof's own allocations aren't counted
+  inHook = true;
+  lockSitesSpin( );
+
+  for( site = siteBuckets[ bucket ]; site != NULL; site = site->chain )
+  {
+    if( site->fn == fn && site->lock == lock )
+      break;
+  }
+
+  if( site == NULL &&
+      ( site = (lockSite_t *)calloc( 1, sizeof( lockSite_t ) ) ) != NULL )
+  {
+    site->fn = fn;
+    site->lock = lock;
+
+    site->chain = siteBuckets[ bucket ];
+    siteBuckets[ bucket ] = site;
+
+    //filled in before the flusher can see it
+    site->next = sites;
+    __atomic_store_n( &sites, site, __ATOMIC_RELEASE );
+  }
+
+  if( site != NULL )
+  {
+    __atomic_store_n( &site->waits, site->waits + 1, __ATOMIC_RELAXED );
+    __atomic_store_n( &site->waitTime, site->waitTime + ticks,
+                      __ATOMIC_RELAXED );
+    changes++;
+  }
+
+  unlockSitesSpin( );
+  inHook = wasInHook;
+}
+
+/*
+===============
+lockWaited
+
+Count having waited for a lock since start
+===============
+*/
+static void lockWaited( void *lock, timeStamp_t start )
+{
+  timeStamp_t ticks = readClock( ) - start;
+  void        *fn;
+
+  LOCK_COUNT( CNT_LOCK_WAITS )++;
+  LOCK_COUNT( CNT_LOCK_TIME ) += ticks;
+
+  //outside every instrumented function it isn't anybody's
+  if( attached && ( fn = currentFunction( ) ) != NULL )
+    addSiteWait( fn, lock, ticks );
+}
+
+/*
+===============
+condWaited
+
+Count having waited on a condition variable since start
+===============
+*/
+static void condWaited( timeStamp_t start )
+{
+  LOCK_COUNT( CNT_COND_WAITS )++;
+  LOCK_COUNT( CNT_COND_TIME ) += readClock( ) - start;
+}
+
+/*
+===============
+ticksToNsecs
+
+Convert a count of clock ticks to nanoseconds
+===============
+*/
+static inline unsigned long long ticksToNsecs( unsigned long long ticks )
+{
+  return (unsigned long long)( (double)ticks * 1.0e9 / (double)clockRate( ) );
+}
+
+/*
+===============
+sampleLocks
+
+Fill in the calling thread's lock counters
+===============
+*/
+void sampleLocks( unsigned long long *counts )
+{
+  if( !trackingLocks )
+  {
+    memset( counts + CNT_LOCK_WAITS, 0, sizeof( lockCounts ) );
+    return;
+  }
+
+  counts[ CNT_LOCK_WAITS ] = LOCK_COUNT( CNT_LOCK_WAITS );
+  counts[ CNT_LOCK_TIME ] = ticksToNsecs( LOCK_COUNT( CNT_LOCK_TIME ) );
+  counts[ CNT_COND_WAITS ] = LOCK_COUNT( CNT_COND_WAITS );
+  counts[ CNT_COND_TIME ] = ticksToNsecs( LOCK_COUNT( CNT_COND_TIME ) );
+}
+
+/*
+===============
+lockSites
+
+The newest site; the rest follow it through next
+===============
+*/
+lockSite_t *lockSites( void )
+{
+  return __atomic_load_n( &sites, __ATOMIC_ACQUIRE );
+}
+
+/*
+===============
+lockChanges
+
+How many times a site has changed
+===============
+*/
+unsigned int lockChanges( void )
+{
+  return __atomic_load_n( &changes, __ATOMIC_RELAXED );
+}
+
+/*
+===============
+lockLockSites
+
+Keep the sites consistent across a fork
+===============
+*/
+void lockLockSites( void )
+{
+  lockSitesSpin( );
+}
+
+/*
+===============
+unlockLockSites
+
+Undo lockLockSites, in the parent or the child
+===============
+*/
+void unlockLockSites( void )
+{
+  unlockSitesSpin( );
+}
+
+/*
+===============
+pthread_mutex_lock
+
+Timed pthread_mutex_lock; only a mutex that is already held is waited
+for, and trying it first finds that out for the price of locking it
+===============
+*/
+int pthread_mutex_lock( pthread_mutex_t *mutex )
+{
+  timeStamp_t start;
+  int         r;
+
+  if( !locksReady( ) )
+    return fallbackMutexLock( mutex );
+
+  if( !trackingLocks || inHook )
+    return realMutexLock( mutex );
+
+  if( ( r = realMutexTrylock( mutex ) ) != EBUSY )
+    return r;
+
+  start = readClock( );
+  r = realMutexLock( mutex );
+  lockWaited( mutex, start );
+
+  return r;
+}
+
+/*
+===============
+pthread_rwlock_rdlock
+
+Timed pthread_rwlock_rdlock
+===============
+*/
+int pthread_rwlock_rdlock( pthread_rwlock_t *rwlock )
+{
+  timeStamp_t start;
+  int         r;
+
+  if( !locksReady( ) )
+    return fallbackRdlock( rwlock );
+
+  if( !trackingLocks || inHook )
+    return realRdlock( rwlock );
+
+  if( ( r = realTryrdlock( rwlock ) ) != EBUSY )
+    return r;
+
+  start = readClock( );
+  r = realRdlock( rwlock );
+  lockWaited( rwlock, start );
+
+  return r;
+}
+
+/*
+===============
+pthread_rwlock_wrlock
+
+Timed pthread_rwlock_wrlock
+===============
+*/
+int pthread_rwlock_wrlock( pthread_rwlock_t *rwlock )
+{
+  timeStamp_t start;
+  int         r;
+
+  if( !locksReady( ) )
+    return fallbackWrlock( rwlock );
+
+  if( !trackingLocks || inHook )
+    return realWrlock( rwlock );
+
+  if( ( r = realTrywrlock( rwlock ) ) != EBUSY )
+    return r;
+
+  start = readClock( );
+  r = realWrlock( rwlock );
+  lockWaited( rwlock, start );
+
+  return r;
+}
+
+/*
+===============
+pthread_cond_wait
+
+Timed pthread_cond_wait
+===============
+*/
+int pthread_cond_wait( pthread_cond_t *cond, pthread_mutex_t *mutex )
+{
+  timeStamp_t start;
+  int         r;
+
+  if( !locksReady( ) || realCondWait == NULL )
+    return condFallback( mutex );
+
+  if( !trackingLocks || inHook )
+    return realCondWait( cond, mutex );
+
+  start = readClock( );
+  r = realCondWait( cond, mutex );
+  condWaited( start );
+
+  return r;
+}
+
+/*
+===============
+pthread_cond_timedwait
+
+Timed pthread_cond_timedwait
+===============
+*/
+int pthread_cond_timedwait( pthread_cond_t *cond, pthread_mutex_t *mutex,
+                            const struct timespec *abstime )
+{
+  timeStamp_t start;
+  int         r;
+
+  if( !locksReady( ) || realCondTimedwait == NULL )
+    return condFallback( mutex );
+
+  if( !trackingLocks || inHook )
+    return realCondTimedwait( cond, mutex, abstime );
+
+  start = readClock( );
+  r = realCondTimedwait( cond, mutex, abstime );
+  condWaited( start );
+
+  return r;
+}
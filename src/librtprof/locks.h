@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2003 Tim Angus
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef LOCKS_H
+#define LOCKS_H
+
+#include "../rtprof/com_common.h"
+#include "alloc.h"
+
+#define RTPROF_LOCKS        "RTPROF_LOCKS"
+
+//the counters from CNT_LOCK_WAITS on that are about locks
+#define NUM_LOCK_COUNTERS   ( CNT_IO_CALLS - CNT_LOCK_WAITS )
+
+//milliseconds between REC_LOCKS snapshots
+#define LOCK_SNAPSHOT_MSEC  500
+
+//must be a power of two
+#define LOCK_BUCKETS        4096
+
+//a function that has had to wait for a lock; sites are never freed,
+//so the flusher can walk the list without a lock
+typedef struct lockSite_s
+{
+  void                        *fn;
+  void                        *lock;
+
+  volatile unsigned long long waits;
+  volatile unsigned long long waitTime;   //clock ticks
+
+  //what had already been seen when the stream started
+  unsigned long long          baseWaits;
+  unsigned long long          baseWaitTime;
+
+  struct lockSite_s           *chain;     //in the same bucket
+  struct lockSite_s           *next;      //every site, newest first
+} lockSite_t;
+
+//whether waits for locks are counted, as agreed with rtprof
+extern boolean  trackingLocks;
+
+void          sampleLocks( unsigned long long *counts );
+lockSite_t    *lockSites( void );
+unsigned int  lockChanges( void );
+void          lockLockSites( void );
+void          unlockLockSites( void );
+
+#endif
@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2003 Tim Angus
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef RTPROF_H
+#define RTPROF_H
+
+/*
+ * Calls an instrumented program can make to tell librtprof about what
+ * the instrumentation can't see for itself. They do nothing while no
+ * rtprof is attached.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//the calling thread is about to start or resume running another stack
+//of calls, such as a coroutine or fiber, identified by any address that
+//is unique to it; NULL is the thread's own stack. Call it just before
+//swapcontext or the like. The calls on each stack are kept apart, and
+//the time one spends switched away from isn't charged to any function
+//on it
+void  rtprof_fiber_switch( void *fiber );
+
+//a fiber rtprof_fiber_switch has been told about has ended for good and
+//won't be switched to again; call it once it has been switched away
+//from. Whatever is still on its stack is dropped, and a new fiber at the
+//same address starts afresh. Without it, librtprof holds on to every
+//fiber it has seen
+void  rtprof_fiber_exit( void *fiber );
+
+//the calling thread is starting or finishing a zone, a stretch of code
+//that rtprof times and draws like a call to a function of that name.
+//Zones are told apart by the address of the name, which has to stay
+//valid for as long as the program runs, such as a string literal. A
+//zone has to be ended in the function that began it, and zones nest
+//the same way: rtprof_zone_end ends the innermost one
+void  rtprof_zone_begin( const char *name );
+void  rtprof_zone_end( void );
+
+//the program's own counter called name, held to the same rules as a
+//zone's, has reached value; rtprof keeps the values it is given over time
+void  rtprof_counter( const char *name, long long value );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
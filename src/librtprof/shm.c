@@ -0,0 +1,213 @@
+/*
+ * Copyright (C) 2003 Tim Angus
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "shm.h"
+#include "comms.h"
+#include "../rtprof/com_protocol.h"
+#include "../rtprof/com_shm.h"
+
+static unsigned char          *shmBase = NULL;
+static shmHeader_t            *header;
+static unsigned char          *data;
+static unsigned int           size;
+static unsigned long long     head;
+
+/*
+===============
+tryShm
+
+Try to claim the ring currently under name
+Sets *taken if another client got there first
+===============
+*/
+static int tryShm( char *name, boolean *taken )
+{
+  struct stat st;
+  int         fd;
+  int         none = 0;
+
+  *taken = false;
+
+  if( ( fd = shm_open( name, O_RDWR, 0 ) ) < 0 )
+    return -1;
+
+  if( fstat( fd, &st ) < 0 || st.st_size <= SHM_HEADER_SIZE )
+  {
+    close( fd );
+    return -1;
+  }
+
+  size = st.st_size - SHM_HEADER_SIZE;
+
+  if( ( shmBase = mapShmRing( fd, size ) ) == NULL )
+  {
+    close( fd );
+    return -1;
+  }
+
+  header = (shmHeader_t *)shmBase;
+  data = shmBase + SHM_HEADER_SIZE;
+
+  //there can only be one writer
+  if( header->magic != SHM_MAGIC || header->size != size ||
+      !__atomic_compare_exchange_n( &header->writerPid, &none, (int)getpid( ),
+                                    false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE ) )
+  {
+    *taken = ( header->magic == SHM_MAGIC && none != 0 );
+    disconnectFromShm( );
+    close( fd );
+    return -1;
+  }
+
+  head = header->head;
+
+  //no reply is possible, so the header stands in for one
+  protocolVersion = header->version < PROTOCOL_VERSION ?
+                    header->version : PROTOCOL_VERSION;
+  protocolCapabilities = clientCapabilities( ) & header->capabilities;
+
+  return fd;
+}
+
+/*
+===============
+connectToShm
+
+Attach to a shared memory ring created by rtprof
+===============
+*/
+int connectToShm( char *name )
+{
+  boolean taken;
+  int     fd, tries = 0;
+
+  //rtprof puts up a fresh ring as soon as one is claimed, so losing a
+  //race with another process (typically a sibling after a fork) is only
+  //worth a short wait
+  while( ( fd = tryShm( name, &taken ) ) < 0 && taken &&
+         ++tries < SHM_TAKEN_TRIES )
+    usleep( SHM_TAKEN_USEC );
+
+  return fd;
+}
+
+/*
+===============
+disconnectFromShm
+
+Detach from the shared memory ring
+===============
+*/
+void disconnectFromShm( void )
+{
+  if( shmBase != NULL )
+    unmapShmRing( shmBase, size );
+
+  shmBase = NULL;
+}
+
+/*
+===============
+reserveShm
+
+Wait until there are length free bytes in the ring and return them
+===============
+*/
+unsigned char *reserveShm( int length )
+{
+  int waits = 0;
+
+  if( shmBase == NULL || length > size )
+    return NULL;
+
+  while( head + length -
+         __atomic_load_n( &header->tail, __ATOMIC_ACQUIRE ) > size )
+  {
+    //don't wait forever on a reader that has died
+    if( ++waits % SHM_LIVENESS == 0 &&
+        kill( header->readerPid, 0 ) < 0 && errno == ESRCH )
+      return NULL;
+
+    usleep( SHM_FULL_USEC );
+  }
+
+  return data + ( head & ( size - 1 ) );
+}
+
+/*
+===============
+commitShm
+
+Make length bytes written at the reserved position visible to rtprof
+===============
+*/
+int commitShm( int length )
+{
+  if( shmBase == NULL )
+    return -1;
+
+  head += length;
+  __atomic_store_n( &header->head, head, __ATOMIC_RELEASE );
+
+  //only pay for the syscall if rtprof is asleep
+  __atomic_thread_fence( __ATOMIC_SEQ_CST );
+
+  if( header->readerWaiting )
+  {
+    __atomic_add_fetch( &header->wakeCount, 1, __ATOMIC_RELEASE );
+    futexWake( &header->wakeCount );
+  }
+
+  return 0;
+}
+
+/*
+===============
+receiveShmControl
+
+Take the next control message from rtprof, if there is one
+Returns 1 if msg was filled in, otherwise 0
+===============
+*/
+int receiveShmControl( controlMessage_t *msg )
+{
+  unsigned int tail;
+
+  if( shmBase == NULL )
+    return 0;
+
+  tail = header->controlTail;
+
+  if( __atomic_load_n( &header->controlHead, __ATOMIC_ACQUIRE ) == tail )
+    return 0;
+
+  *msg = header->control[ tail & ( SHM_CONTROL_SLOTS - 1 ) ];
+  __atomic_store_n( &header->controlTail, tail + 1, __ATOMIC_RELEASE );
+
+  return 1;
+}
@@ -0,0 +1,40 @@
+/*
+ * Copyright (C) 2003 Tim Angus
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef SHM_H
+#define SHM_H
+
+#include "../rtprof/com_protocol.h"
+
+//how long the writer sleeps while waiting for the ring to drain
+#define SHM_FULL_USEC   100
+
+//check rtprof is still alive after this many waits
+#define SHM_LIVENESS    10000
+
+//how often and for how long to retry when another client claims a ring
+#define SHM_TAKEN_TRIES 100
+#define SHM_TAKEN_USEC  10000
+
+int           connectToShm( char *name );
+void          disconnectFromShm( void );
+unsigned char *reserveShm( int length );
+int           commitShm( int length );
+int           receiveShmControl( controlMessage_t *msg );
+
+#endif
@@ -0,0 +1,290 @@
+/*
+ * Copyright (C) 2003 Tim Angus
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "throttle.h"
+#include "aggregate.h"
+#include "buffer.h"
+#include "clock.h"
+#include "comms.h"
+
+unsigned int        throttleRate = 0;
+timeStamp_t         shortCallTicks = 0;
+
+static timeStamp_t  windowTicks;
+static timeStamp_t  tinyTicks;
+
+/*
+===============
+initThrottle
+
+Decide whether to throttle, once rtprof has said what it supports
+===============
+*/
+void initThrottle( void )
+{
+  char *throttle = getenv( RTPROF_THROTTLE );
+  char *shortCall = getenv( RTPROF_SHORT );
+
+  throttleRate = 0;
+  shortCallTicks = 0;
+
+  if( ( ( throttle == NULL || atoi( throttle ) <= 0 ) &&
+        ( shortCall == NULL || atoi( shortCall ) <= 0 ) ) ||
+      aggregateInterval > 0 )
+    return;
+
+  //throttled calls are reported in REC_SUMMARYs
+  if( protocolVersion < 2 ||
+      ( protocolCapabilities & ( CAP_SUMMARY | CAP_FUNCIDS ) ) !=
+      ( CAP_SUMMARY | CAP_FUNCIDS ) )
+  {
+    fprintf( stderr, "WARNING: rtprof does not accept snapshots; "
+                     "sending every event\n" );
+    return;
+  }
+
+  if( throttle != NULL && atoi( throttle ) > 0 )
+  {
+    throttleRate = atoi( throttle );
+    windowTicks = clockRate( ) * THROTTLE_WINDOW / 1000;
+    tinyTicks = clockRate( ) * THROTTLE_TINY_NSEC / 1000000000ULL;
+  }
+
+  if( shortCall != NULL && atoi( shortCall ) > 0 )
+  {
+    shortCallTicks = clockRate( ) * atoi( shortCall ) / 1000000000ULL;
+
+    //always hold calls back, even if they can never be quick enough
+    if( shortCallTicks == 0 )
+      shortCallTicks = 1;
+  }
+}
+
+/*
+===============
+throttleSlot
+
+Find the calling thread's cache slot for a function
+===============
+*/
+static throttleSlot_t *throttleSlot( aggThread_t *t, void *this_fn )
+{
+  unsigned long h = (unsigned long)this_fn;
+
+  if( t->throttle == NULL &&
+      ( t->throttle = (throttleSlot_t *)calloc( THROTTLE_SLOTS,
+                                        sizeof( throttleSlot_t ) ) ) == NULL )
+    return NULL;
+
+  //functions are at least a few bytes apart
+  return &t->throttle[ ( h ^ ( h >> 12 ) ) >> 4 & ( THROTTLE_SLOTS - 1 ) ];
+}
+
+/*
+===============
+updateThrottle
+
+Count a call and decide at the end of each window whether the function
+should be throttled
+===============
+*/
+static void updateThrottle( aggThread_t *t, void *this_fn,
+                            timeStamp_t ts, timeStamp_t duration )
+{
+  throttleSlot_t  *s;
+  timeStamp_t     elapsed;
+  boolean         hot;
+
+  if( throttleRate == 0 || ( s = throttleSlot( t, this_fn ) ) == NULL )
+    return;
+
+  //another function had the slot; start again
+  if( s->this_fn != this_fn )
+  {
+    s->this_fn = this_fn;
+    s->windowStart = ts;
+    s->time = 0;
+    s->calls = 0;
+    s->throttled = false;
+  }
+
+  s->calls++;
+  s->time += duration;
+
+  if( ( elapsed = ts - s->windowStart ) < windowTicks )
+    return;
+
+  //stop throttling only once the rate has halved, so as not to flap
+  hot = s->calls * clockRate( ) >=
+        ( s->throttled ? throttleRate / 2 : throttleRate ) * elapsed &&
+        s->time <= tinyTicks * s->calls;
+
+  s->throttled = hot;
+  s->windowStart = ts;
+  s->time = 0;
+  s->calls = 0;
+}
+
+/*
+===============
+shortCallEnd
+
+When a short call held back as FRAME_PENDING should be taken to have
+returned by some clock, allowing for the part of the hooks' cost inside it
+===============
+*/
+static timeStamp_t shortCallEnd( timeStamp_t entry, timeStamp_t exit,
+                                 timeStamp_t overhead )
+{
+  timeStamp_t hook = overhead / OVERHEAD_SCALE;
+
+  return ( exit - entry > hook ) ? exit - hook : entry;
+}
+
+/*
+===============
+releasePending
+
+Send the entry of a function held back as FRAME_PENDING at the top of a
+thread's shadow stack, which has turned out not to be a short leaf call
+after all
+===============
+*/
+void releasePending( aggThread_t *t )
+{
+  aggFrame_t  *f;
+
+  if( t->depth == 0 )
+    return;
+
+  f = &t->frames[ t->depth - 1 ];
+
+  if( f->mode == FRAME_PENDING )
+  {
+    queueEvent( EV_ENTER, f->this_fn, f->callSite, f->entryTime,
+                f->entryCpu, &f->entryCounters );
+    f->mode = FRAME_STREAMED;
+  }
+}
+
+/*
+===============
+throttleEnter
+
+Entry hook for throttling mode
+===============
+*/
+void throttleEnter( void *this_fn, void *callSite, timeStamp_t ts,
+                    timeStamp_t cpu, const counters_t *counters )
+{
+  aggThread_t     *t;
+  aggFrame_t      *f = NULL;
+  throttleSlot_t  *s;
+
+  if( ( t = aggregateThread( ) ) == NULL )
+  {
+    queueEvent( EV_ENTER, this_fn, callSite, ts, cpu, counters );
+    return;
+  }
+
+  //a held back caller isn't a leaf after all; send its entry late
+  releasePending( t );
+
+  if( t->depth > 0 )
+    f = &t->frames[ t->depth - 1 ];
+
+  //everything below a throttled function is aggregated too
+  if( f != NULL && f->mode != FRAME_STREAMED )
+    pushFrame( t, this_fn, callSite, compensate( t, ts ),
+               compensateCpu( t, cpu ), counters, FRAME_AGGREGATED );
+  else if( throttleRate > 0 && ( s = throttleSlot( t, this_fn ) ) != NULL &&
+           s->this_fn == this_fn && s->throttled )
+    pushFrame( t, this_fn, callSite, compensate( t, ts ),
+               compensateCpu( t, cpu ), counters, FRAME_THROTTLED );
+  else if( shortCallTicks > 0 )
+    pushFrame( t, this_fn, callSite, ts, cpu, counters, FRAME_PENDING );
+  else if( pushFrame( t, this_fn, callSite, ts, cpu, counters,
+                      FRAME_STREAMED ) )
+    queueEvent( EV_ENTER, this_fn, callSite, ts, cpu, counters );
+}
+
+/*
+===============
+throttleExit
+
+Exit hook for throttling mode
+===============
+*/
+void throttleExit( void *this_fn, timeStamp_t ts, timeStamp_t cpu,
+                   const counters_t *counters )
+{
+  aggThread_t *t = aggregateThread( );
+  aggFrame_t  *f;
+  timeStamp_t adjusted = ts, adjustedCpu = cpu;
+
+  //streamed events are left for rtprof to compensate
+  if( t != NULL && t->depth > 0 &&
+      ( t->frames[ t->depth - 1 ].mode == FRAME_AGGREGATED ||
+        t->frames[ t->depth - 1 ].mode == FRAME_THROTTLED ) )
+  {
+    adjusted = compensate( t, ts );
+    adjustedCpu = compensateCpu( t, cpu );
+  }
+
+  if( t == NULL ||
+      ( f = popFrame( t, adjusted, adjustedCpu, counters ) ) == NULL )
+  {
+    queueEvent( EV_EXIT, this_fn, NULL, ts, cpu, counters );
+    return;
+  }
+
+  switch( f->mode )
+  {
+    case FRAME_STREAMED:
+      queueEvent( EV_EXIT, this_fn, NULL, ts, cpu, counters );
+      updateThrottle( t, f->this_fn, ts, ts - f->entryTime );
+      break;
+
+    case FRAME_THROTTLED:
+      recordFrame( t, f, adjusted, adjustedCpu, counters );
+      updateThrottle( t, f->this_fn, ts, adjusted - f->entryTime );
+      break;
+
+    case FRAME_PENDING:
+      if( ts - f->entryTime < shortCallTicks )
+        recordFrame( t, f, shortCallEnd( f->entryTime, ts, hookOverhead ),
+                     shortCallEnd( f->entryCpu, cpu, hookCpuOverhead ),
+                     counters );
+      else
+      {
+        queueEvent( EV_ENTER, f->this_fn, f->callSite, f->entryTime,
+                    f->entryCpu, &f->entryCounters );
+        queueEvent( EV_EXIT, f->this_fn, NULL, ts, cpu, counters );
+      }
+
+      updateThrottle( t, f->this_fn, ts, ts - f->entryTime );
+      break;
+
+    default:
+      recordFrame( t, f, adjusted, adjustedCpu, counters );
+      break;
+  }
+}
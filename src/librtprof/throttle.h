@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2003 Tim Angus
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef THROTTLE_H
+#define THROTTLE_H
+
+#include "../rtprof/com_common.h"
+#include "aggregate.h"
+#include "counters.h"
+
+#define RTPROF_THROTTLE     "RTPROF_THROTTLE"
+#define RTPROF_SHORT        "RTPROF_SHORT"
+
+//a function is hot if a thread calls it more than RTPROF_THROTTLE times a
+//second over a window of this many milliseconds...
+#define THROTTLE_WINDOW     10
+
+//...and its calls take no longer than this on average
+#define THROTTLE_TINY_NSEC  2000
+
+//per thread function cache; must be a power of two
+#define THROTTLE_SLOTS      1024
+
+typedef struct throttleSlot_s
+{
+  void          *this_fn;
+  timeStamp_t   windowStart;
+  timeStamp_t   time;
+  unsigned int  calls;
+  boolean       throttled;
+} throttleSlot_t;
+
+//calls a second above which tiny functions are throttled, or 0 for never
+extern unsigned int throttleRate;
+
+//leaf calls quicker than this many ticks are totalled up rather than
+//streamed, or 0 to stream them all
+extern timeStamp_t  shortCallTicks;
+
+void  initThrottle( void );
+void  throttleEnter( void *this_fn, void *callSite, timeStamp_t ts,
+                     timeStamp_t cpu, const counters_t *counters );
+void  throttleExit( void *this_fn, timeStamp_t ts, timeStamp_t cpu,
+                    const counters_t *counters );
+void  releasePending( aggThread_t *t );
+
+#endif
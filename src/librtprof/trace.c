@@ -0,0 +1,197 @@
+/*
+ * Copyright (C) 2003 Tim Angus
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+
+#include "trace.h"
+#include "comms.h"
+#include "../rtprof/com_protocol.h"
+#include "../rtprof/com_trace.h"
+
+static int                traceFd = -1;
+static unsigned char      *traceBase = NULL;
+static unsigned long long capacity;
+static unsigned long long written;
+
+/*
+===============
+mapTrace
+
+Size the trace file to hold size stream bytes and map it
+===============
+*/
+static boolean mapTrace( unsigned long long size )
+{
+  unsigned char *base;
+
+  if( ftruncate( traceFd, TRACE_HEADER_SIZE + size ) < 0 )
+    return false;
+
+  base = (unsigned char *)mmap( NULL, TRACE_HEADER_SIZE + size,
+                                PROT_READ | PROT_WRITE, MAP_SHARED,
+                                traceFd, 0 );
+
+  if( base == MAP_FAILED )
+    return false;
+
+  if( traceBase != NULL )
+    munmap( traceBase, TRACE_HEADER_SIZE + capacity );
+
+  traceBase = base;
+  capacity = size;
+
+  return true;
+}
+
+/*
+===============
+connectToTrace
+
+Create a trace file to write the stream to
+The first process to trace writes path itself; anything it forks or
+execs is told apart by writing path.<pid> instead
+===============
+*/
+int connectToTrace( char *path )
+{
+  traceHeader_t *header;
+  char          name[ PATH_MAX ];
+
+  if( getenv( RTPROF_TRACE_OWNER ) == NULL )
+  {
+    snprintf( name, sizeof( name ), "%d", (int)getpid( ) );
+    setenv( RTPROF_TRACE_OWNER, name, 1 );
+    snprintf( name, sizeof( name ), "%s", path );
+  }
+  else
+    snprintf( name, sizeof( name ), "%s.%d", path, (int)getpid( ) );
+
+  if( ( traceFd = open( name, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC,
+                        0644 ) ) < 0 )
+    return -1;
+
+  written = 0;
+
+  if( !mapTrace( TRACE_INITIAL_SIZE ) )
+  {
+    close( traceFd );
+    traceFd = -1;
+    return -1;
+  }
+
+  header = (traceHeader_t *)traceBase;
+  header->magic = TRACE_MAGIC;
+  header->version = PROTOCOL_VERSION;
+  header->length = 0;
+
+  //nobody to negotiate with, so use everything except what needs a reply
+  protocolVersion = PROTOCOL_VERSION;
+  protocolCapabilities = clientCapabilities( ) & ~CAP_CONTROL;
+
+  return traceFd;
+}
+
+/*
+===============
+disconnectFromTrace
+
+Trim the trace file to what was written and unmap it
+The caller closes the descriptor
+===============
+*/
+void disconnectFromTrace( void )
+{
+  if( traceBase == NULL )
+    return;
+
+  munmap( traceBase, TRACE_HEADER_SIZE + capacity );
+  ftruncate( traceFd, TRACE_HEADER_SIZE + written );
+
+  traceBase = NULL;
+  traceFd = -1;
+}
+
+/*
+===============
+abandonTrace
+
+Drop the mapping inherited across a fork, leaving the file to the parent
+===============
+*/
+void abandonTrace( void )
+{
+  if( traceBase != NULL )
+    munmap( traceBase, TRACE_HEADER_SIZE + capacity );
+
+  traceBase = NULL;
+  traceFd = -1;
+}
+
+/*
+===============
+reserveTrace
+
+Return length bytes of space at the end of the trace, growing it if needed
+===============
+*/
+unsigned char *reserveTrace( int length )
+{
+  unsigned long long size = capacity;
+
+  if( traceBase == NULL )
+    return NULL;
+
+  while( written + length > size )
+    size *= 2;
+
+  if( size != capacity && !mapTrace( size ) )
+  {
+    fprintf( stderr, "WARNING: librtprof could not grow trace file\n" );
+    return NULL;
+  }
+
+  return traceBase + TRACE_HEADER_SIZE + written;
+}
+
+/*
+===============
+commitTrace
+
+Add length bytes written at the reserved position to the trace
+===============
+*/
+int commitTrace( int length )
+{
+  if( traceBase == NULL )
+    return -1;
+
+  written += length;
+
+  //a reader of a trace left by a crashed client stops here
+  __atomic_store_n( &( (traceHeader_t *)traceBase )->length, written,
+                    __ATOMIC_RELEASE );
+
+  return 0;
+}
@@ -0,0 +1,32 @@
+/*
+ * Copyright (C) 2003 Tim Angus
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+
+#ifndef TRACE_H
+#define TRACE_H
+
+//set by the first process to write a trace, so its children can tell
+#define RTPROF_TRACE_OWNER "RTPROF_TRACE_OWNER"
+
+int           connectToTrace( char *path );
+void          disconnectFromTrace( void );
+void          abandonTrace( void );
+unsigned char *reserveTrace( int length );
+int           commitTrace( int length );
+
+#endif
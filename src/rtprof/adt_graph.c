@@ -272,15 +272,74 @@ graphNode_t *searchNodes( void *symbol, void *parentSymbol, graph_t *g )
 }
 
 
+/*
+===============
+renameNodes
+
+Look up every node's name again, after more symbols have been loaded
+===============
+*/
+void renameNodes( graph_t *g )
+{
+  graphNode_t *p;
+  char        *t;
+  int         i;
+
+  for( i = 0; i < MAX_BUCKETS; i++ )
+  {
+    for( p = g->nodeBuckets[ i ]; p != NULL; p = p->next )
+    {
+      if( !p->recursiveDummy && !p->zone &&
+          ( t = lookupSymbol( p->symbol ) ) != NULL )
+        snprintf( p->textSymbol, MAX_SYMBOL_TEXT, "%s", t );
+    }
+  }
+}
+
+
+/*
+===============
+searchCallSites
+
+Return the edge for the calls along edge from one call site, allocating
+a new one if it doesn't exist
+===============
+*/
+static graphEdge_t *searchCallSites( graphEdge_t *edge, void *callSite )
+{
+  graphEdge_t *p;
+
+  for( p = edge->sites; p != NULL; p = p->next )
+  {
+    if( p->callSite == callSite )
+      return p;
+  }
+
+  p = (graphEdge_t *)malloc( sizeof( graphEdge_t ) );
+
+  memset( p, 0, sizeof( graphEdge_t ) );
+  p->from = edge->from;
+  p->to = edge->to;
+  p->callSite = callSite;
+  p->collapsed = edge;
+  p->next = edge->sites;
+  edge->sites = p;
+
+  return p;
+}
+
 /*
 ===============
 searchEdges
 
 Search for a graph edge in the bucket-chain hash
 and allocate a new one if it doesn't exist
+Given a callSite, returns the edge for that call site alone, whose
+collapsed is the edge for them all
 ===============
 */
-graphEdge_t *searchEdges( graphNode_t *fNode, graphNode_t *tNode, graph_t *g )
+graphEdge_t *searchEdges( graphNode_t *fNode, graphNode_t *tNode,
+                          void *callSite, graph_t *g )
 {
   graphEdge_t *edge;
   int         index = (int)( ( (long)fNode + (long)tNode ) % MAX_BUCKETS );
@@ -321,11 +380,152 @@ graphEdge_t *searchEdges( graphNode_t *fNode, graphNode_t *tNode, graph_t *g )
       edge->recursiveDummy = dummyNode;
     }
   }
+
+  if( callSite != NULL )
+    return searchCallSites( edge, callSite );
     
   return edge;
 }
 
 
+/*
+===============
+searchThreads
+
+Return the totals for a thread, growing the table if needed, or NULL
+if it can't be
+===============
+*/
+graphThread_t *searchThreads( unsigned int tid, graph_t *g )
+{
+  graphThread_t *threads;
+  int           newSize;
+
+  if( tid >= g->numThreads )
+  {
+    newSize = g->numThreads ? g->numThreads : 16;
+
+    while( newSize <= tid )
+      newSize *= 2;
+
+    if( ( threads = (graphThread_t *)realloc( g->threads,
+            newSize * sizeof( graphThread_t ) ) ) == NULL )
+      return NULL;
+
+    memset( threads + g->numThreads, 0,
+            ( newSize - g->numThreads ) * sizeof( graphThread_t ) );
+    g->threads = threads;
+    g->numThreads = newSize;
+  }
+
+  return &g->threads[ tid ];
+}
+
+
+/*
+===============
+searchCounters
+
+Return the index of a counter, adding it if it's new
+===============
+*/
+int searchCounters( const char *name, graph_t *g )
+{
+  graphCounter_t  *counters;
+  int             i;
+
+  for( i = 0; i < g->numCounters; i++ )
+  {
+    if( !strcmp( g->counters[ i ].name, name ) )
+      return i;
+  }
+
+  counters = (graphCounter_t *)realloc( g->counters,
+                                        ( i + 1 ) * sizeof( graphCounter_t ) );
+
+  if( counters == NULL )
+    return -1;
+
+  g->counters = counters;
+  memset( &counters[ i ], 0, sizeof( graphCounter_t ) );
+  snprintf( counters[ i ].name, MAX_SYMBOL_TEXT, "%s", name );
+  g->numCounters++;
+
+  return i;
+}
+
+
+/*
+===============
+addSample
+
+Add a value to a counter's history
+===============
+*/
+void addSample( graphCounter_t *k, timeStamp_t time, long long value )
+{
+  graphSample_t *samples;
+  int           newSize;
+
+  if( k->numSamples == 0 || value < k->min )
+    k->min = value;
+
+  if( k->numSamples == 0 || value > k->max )
+    k->max = value;
+
+  if( k->numSamples == 0 || time >= k->latestTime )
+  {
+    k->latest = value;
+    k->latestTime = time;
+  }
+
+  if( k->numSamples == k->size && k->size < COUNTER_SAMPLES )
+  {
+    newSize = k->size ? k->size * 2 : 256;
+
+    if( ( samples = (graphSample_t *)realloc( k->samples,
+            newSize * sizeof( graphSample_t ) ) ) == NULL )
+      return;
+
+    k->samples = samples;
+    k->size = newSize;
+  }
+
+  k->samples[ k->numSamples & ( COUNTER_SAMPLES - 1 ) ].time = time;
+  k->samples[ k->numSamples & ( COUNTER_SAMPLES - 1 ) ].value = value;
+  k->numSamples++;
+}
+
+
+/*
+===============
+keptSamples
+
+How many of a counter's values are still held
+===============
+*/
+long keptSamples( graphCounter_t *k )
+{
+  return k->numSamples < COUNTER_SAMPLES ? k->numSamples : COUNTER_SAMPLES;
+}
+
+
+/*
+===============
+listSample
+
+Return the i'th of the values a counter still holds, oldest first
+===============
+*/
+graphSample_t *listSample( graphCounter_t *k, long i )
+{
+  if( k->numSamples <= COUNTER_SAMPLES )
+    return &k->samples[ i ];
+
+  return &k->samples[ ( k->numSamples + i ) & ( COUNTER_SAMPLES - 1 ) ];
+}
+
+
 /*
 ===============
 initGraph
@@ -342,6 +542,14 @@ void initGraph( graph_t *g )
   
   for( i = 0; i < MAX_BUCKETS; i++ )
     g->edgeBuckets[ i ] = NULL;
+
+  g->numNodes = g->numEdges = 0;
+  g->numCounters = 0;
+  g->counters = NULL;
+  clearGraph( g );
+
+  g->numThreads = 0;
+  g->threads = NULL;
 }
 
 /*
@@ -355,7 +563,7 @@ void shutdownGraph( graph_t *g )
 {
   int         i;
   graphNode_t *p, *q;
-  graphEdge_t *r, *s;
+  graphEdge_t *r, *s, *t;
 
   for( i = 0; i < MAX_BUCKETS; i++ )
   {
@@ -378,12 +586,30 @@ void shutdownGraph( graph_t *g )
     while( r )
     {
       s = r->next;
+
+      while( r->sites )
+      {
+        t = r->sites->next;
+        free( r->sites );
+        r->sites = t;
+      }
       
       free( r );
 
       r = s;
     }
   }
+
+  free( g->threads );
+  g->threads = NULL;
+  g->numThreads = 0;
+
+  for( i = 0; i < g->numCounters; i++ )
+    free( g->counters[ i ].samples );
+
+  free( g->counters );
+  g->counters = NULL;
+  g->numCounters = 0;
 }
 
 
@@ -567,3 +793,370 @@ graphEdge_t **listEdges( int *n, graph_t *g )
   
   return edgeArray;
 }
+
+
+/*
+===============
+updateGraph
+
+Work out the fractions and inactive times used for display
+===============
+*/
+void updateGraph( graph_t *g, timeStamp_t now )
+{
+  graphNode_t **nodes;
+  graphEdge_t **edges;
+  int         numNodes, numEdges;
+  int         i, j;
+
+  nodes = listNodes( SF_NONE, &numNodes, g );
+  edges = listEdges( &numEdges, g );
+
+  g->maxInactiveTime = 0;
+
+  for( i = 0; i < numNodes; i++ )
+  {
+    nodes[ i ]->inactiveTime = now - nodes[ i ]->lastActive;
+
+    if( nodes[ i ]->inactiveTime > g->maxInactiveTime )
+      g->maxInactiveTime = nodes[ i ]->inactiveTime;
+
+    nodes[ i ]->localTimeFraction = (float)nodes[ i ]->localTime /
+                                    (float)g->totalLocalTime;
+    
+    nodes[ i ]->totalTimeFraction = (float)nodes[ i ]->totalTime /
+                                    (float)g->totalTotalTime;
+
+    if( g->totalLocalCpuTime > 0 )
+    {
+      nodes[ i ]->localCpuFraction = (float)nodes[ i ]->localCpuTime /
+                                     (float)g->totalLocalCpuTime;
+
+      nodes[ i ]->totalCpuFraction = (float)nodes[ i ]->totalCpuTime /
+                                     (float)g->totalTotalCpuTime;
+    }
+
+    //the two clocks aren't read at quite the same moment
+    if( nodes[ i ]->localCpuTime >= nodes[ i ]->localTime )
+      nodes[ i ]->onCpuFraction = nodes[ i ]->localTime > 0 ? 1.0f : 0.0f;
+    else
+      nodes[ i ]->onCpuFraction = (float)nodes[ i ]->localCpuTime /
+                                  (float)nodes[ i ]->localTime;
+
+    for( j = 0; j < NUM_COUNTERS; j++ )
+    {
+      if( g->totalLocalCounts[ j ] > 0 )
+        nodes[ i ]->localCountFractions[ j ] =
+          (float)nodes[ i ]->localCounts[ j ] /
+          (float)g->totalLocalCounts[ j ];
+    }
+
+    nodes[ i ]->heapFraction = g->totalHeapBytes > 0 ?
+                               (float)nodes[ i ]->heapBytes /
+                               (float)g->totalHeapBytes : 0.0f;
+    
+    nodes[ i ]->callsFraction = (float)nodes[ i ]->calls /
+                                (float)g->totalCalls;
+  }
+
+  for( i = 0; i < numEdges; i++ )
+  {
+    edges[ i ]->inactiveTime = now - edges[ i ]->lastActive;
+
+    if( edges[ i ]->inactiveTime > g->maxInactiveTime )
+      g->maxInactiveTime = edges[ i ]->inactiveTime;
+    
+    edges[ i ]->callsFraction = (float)edges[ i ]->calls /
+                                (float)g->totalCalls;
+  }
+  
+  free( edges );
+  free( nodes );
+}
+
+
+/*
+===============
+clearGraph
+
+Zero every total, keeping the nodes and edges (and their layout)
+===============
+*/
+void clearGraph( graph_t *g )
+{
+  graphNode_t *p;
+  graphEdge_t *r, *s;
+  int         i;
+
+  for( i = 0; i < MAX_BUCKETS; i++ )
+  {
+    for( p = g->nodeBuckets[ i ]; p != NULL; p = p->next )
+    {
+      p->totalTime = p->localTime = 0;
+      p->totalCpuTime = p->localCpuTime = 0;
+      p->localTimeOwed = p->localCpuTimeOwed = 0;
+      memset( p->totalCounts, 0, sizeof( p->totalCounts ) );
+      memset( p->localCounts, 0, sizeof( p->localCounts ) );
+      memset( p->localCountsOwed, 0, sizeof( p->localCountsOwed ) );
+      p->calls = 0;
+      p->active = false;
+    }
+
+    for( r = g->edgeBuckets[ i ]; r != NULL; r = r->next )
+    {
+      r->calls = 0;
+      memset( r->counts, 0, sizeof( r->counts ) );
+      r->active = false;
+
+      for( s = r->sites; s != NULL; s = s->next )
+      {
+        s->calls = 0;
+        memset( s->counts, 0, sizeof( s->counts ) );
+        s->active = false;
+      }
+    }
+  }
+
+  g->totalLocalTime = g->totalTotalTime = 0;
+  g->maxLocalTime = g->maxTotalTime = g->maxInactiveTime = 0;
+  g->totalLocalCpuTime = g->totalTotalCpuTime = 0;
+  g->maxLocalCpuTime = g->maxTotalCpuTime = 0;
+  memset( g->totalLocalCounts, 0, sizeof( g->totalLocalCounts ) );
+  memset( g->maxLocalCounts, 0, sizeof( g->maxLocalCounts ) );
+  g->maxEdgeCalls = g->maxNodeCalls = 0;
+  g->totalCalls = 0;
+
+  for( i = 0; i < g->numCounters; i++ )
+    g->counters[ i ].numSamples = 0;
+
+  if( g->threads != NULL )
+    memset( g->threads, 0, g->numThreads * sizeof( graphThread_t ) );
+
+  clearHeap( g );
+  clearLocks( g );
+}
+
+
+/*
+===============
+clearHeap
+
+Forget the live heap, which each REC_HEAP snapshot replaces rather than
+adds to
+===============
+*/
+void clearHeap( graph_t *g )
+{
+  graphNode_t *p;
+  int         i;
+
+  for( i = 0; i < MAX_BUCKETS; i++ )
+  {
+    for( p = g->nodeBuckets[ i ]; p != NULL; p = p->next )
+      p->heapBytes = p->heapAllocs = p->totalHeapBytes = 0;
+  }
+
+  g->totalHeapBytes = g->maxHeapBytes = 0;
+}
+
+/*
+===============
+clearLocks
+
+Forget which locks were waited for, which each REC_LOCKS snapshot
+replaces rather than adds to
+===============
+*/
+void clearLocks( graph_t *g )
+{
+  graphNode_t *p;
+  int         i;
+
+  for( i = 0; i < MAX_BUCKETS; i++ )
+  {
+    for( p = g->nodeBuckets[ i ]; p != NULL; p = p->next )
+    {
+      p->lockAddress = NULL;
+      p->lockWaits = p->lockWaitTime = 0;
+    }
+  }
+}
+
+
+/*
+===============
+mergeGraph
+
+Add the totals in one graph to another, matching nodes by symbol
+===============
+*/
+void mergeGraph( graph_t *to, graph_t *from )
+{
+  graphNode_t     **nodes, *p, *q;
+  graphEdge_t     **edges, *e, *f;
+  graphCounter_t  *k, *l;
+  graphThread_t   *t, *u;
+  int             numNodes, numEdges;
+  int             i, j, before;
+  long            n;
+  boolean         empty;
+
+  nodes = listNodes( SF_NONE, &numNodes, from );
+  edges = listEdges( &numEdges, from );
+
+  for( i = 0; i < numNodes; i++ )
+  {
+    p = nodes[ i ];
+
+    //to makes its own
+    if( p->recursiveDummy )
+      continue;
+
+    before = to->numNodes;
+    q = searchNodes( p->symbol, NULL, to );
+
+    //start off where it already is in from
+    if( to->numNodes != before )
+      VectorCopy( p->layoutPosition, q->layoutPosition );
+
+    //from may have been renamed since
+    if( strcmp( q->textSymbol, p->textSymbol ) )
+      strcpy( q->textSymbol, p->textSymbol );
+
+    q->zone = p->zone;
+
+    q->totalTime += p->totalTime;
+    q->localTime += p->localTime;
+    q->totalCpuTime += p->totalCpuTime;
+    q->localCpuTime += p->localCpuTime;
+    q->calls += p->calls;
+    q->active = q->active || p->active;
+
+    if( p->lastActive > q->lastActive )
+      q->lastActive = p->lastActive;
+
+    if( q->totalTime > to->maxTotalTime )
+      to->maxTotalTime = q->totalTime;
+
+    if( q->localTime > to->maxLocalTime )
+      to->maxLocalTime = q->localTime;
+
+    if( q->totalCpuTime > to->maxTotalCpuTime )
+      to->maxTotalCpuTime = q->totalCpuTime;
+
+    if( q->localCpuTime > to->maxLocalCpuTime )
+      to->maxLocalCpuTime = q->localCpuTime;
+
+    if( q->calls > to->maxNodeCalls )
+      to->maxNodeCalls = q->calls;
+
+    for( j = 0; j < NUM_COUNTERS; j++ )
+    {
+      q->totalCounts[ j ] += p->totalCounts[ j ];
+      q->localCounts[ j ] += p->localCounts[ j ];
+
+      if( q->localCounts[ j ] > to->maxLocalCounts[ j ] )
+        to->maxLocalCounts[ j ] = q->localCounts[ j ];
+    }
+
+    q->heapBytes += p->heapBytes;
+    q->heapAllocs += p->heapAllocs;
+    q->totalHeapBytes += p->totalHeapBytes;
+
+    if( q->heapBytes > to->maxHeapBytes )
+      to->maxHeapBytes = q->heapBytes;
+
+    //different processes' locks can't be added together
+    if( p->lockWaitTime > q->lockWaitTime )
+    {
+      q->lockAddress = p->lockAddress;
+      q->lockWaits = p->lockWaits;
+      q->lockWaitTime = p->lockWaitTime;
+    }
+  }
+
+  for( i = 0; i < numEdges; i++ )
+  {
+    //the edge for all call sites first, then each of them
+    for( f = edges[ i ]; f != NULL;
+         f = ( f == edges[ i ] ) ? f->sites : f->next )
+    {
+      e = searchEdges( searchNodes( f->from->symbol, NULL, to ),
+                       searchNodes( f->to->symbol, NULL, to ),
+                       f->callSite, to );
+
+      e->calls += f->calls;
+
+      for( j = 0; j < NUM_COUNTERS; j++ )
+        e->counts[ j ] += f->counts[ j ];
+
+      e->active = e->active || f->active;
+
+      if( f->lastActive > e->lastActive )
+        e->lastActive = f->lastActive;
+
+      if( e->calls > to->maxEdgeCalls )
+        to->maxEdgeCalls = e->calls;
+    }
+  }
+
+  to->totalLocalTime += from->totalLocalTime;
+  to->totalTotalTime += from->totalTotalTime;
+  to->totalLocalCpuTime += from->totalLocalCpuTime;
+  to->totalTotalCpuTime += from->totalTotalCpuTime;
+
+  for( j = 0; j < NUM_COUNTERS; j++ )
+    to->totalLocalCounts[ j ] += from->totalLocalCounts[ j ];
+
+  to->totalHeapBytes += from->totalHeapBytes;
+  to->totalCalls += from->totalCalls;
+
+  //thread ids are per process, so the same id in two is added together
+  for( i = from->numThreads - 1; i >= 0; i-- )
+  {
+    t = &from->threads[ i ];
+
+    if( t->calls == 0 && t->totalTime == 0 )
+      continue;
+
+    if( ( u = searchThreads( i, to ) ) == NULL )
+      break;
+
+    u->calls += t->calls;
+    u->localTime += t->localTime;
+    u->totalTime += t->totalTime;
+    u->localCpuTime += t->localCpuTime;
+    u->totalCpuTime += t->totalCpuTime;
+  }
+
+  //counters of the same name from different processes share a history
+  for( i = 0; i < from->numCounters; i++ )
+  {
+    k = &from->counters[ i ];
+
+    if( k->numSamples == 0 || ( j = searchCounters( k->name, to ) ) < 0 )
+      continue;
+
+    l = &to->counters[ j ];
+    empty = l->numSamples == 0;
+
+    for( n = 0; n < keptSamples( k ); n++ )
+      addSample( l, listSample( k, n )->time, listSample( k, n )->value );
+
+    //the extremes may be among those no longer kept
+    if( empty || k->min < l->min )
+      l->min = k->min;
+
+    if( empty || k->max > l->max )
+      l->max = k->max;
+
+    if( empty || k->latestTime >= l->latestTime )
+    {
+      l->latest = k->latest;
+      l->latestTime = k->latestTime;
+    }
+  }
+
+  free( edges );
+  free( nodes );
+}
@@ -25,6 +25,9 @@
 
 #define MAX_BUCKETS 1024
 
+//values kept for each counter; must be a power of two
+#define COUNTER_SAMPLES 65536
+
 typedef enum
 {
   SF_SYMBOLP,
@@ -47,6 +50,38 @@ typedef struct graphNode_s
   float               localTimeFraction;
   float               totalTimeFraction;
 
+  //thread cpu time, when the client sends it
+  timeStamp_t         totalCpuTime;
+  timeStamp_t         localCpuTime;
+  float               localCpuFraction;
+  float               totalCpuFraction;
+
+  //how much of localTime was spent on a cpu rather than waiting
+  float               onCpuFraction;
+
+  //software counters, indexed by counter_t, when the client sends them
+  unsigned long long  totalCounts[ NUM_COUNTERS ];
+  unsigned long long  localCounts[ NUM_COUNTERS ];
+  float               localCountFractions[ NUM_COUNTERS ];
+
+  //local time a REC_SUMMARY took back before it had been counted, to be
+  //taken out of what is counted next; likewise for counts
+  timeStamp_t         localTimeOwed;
+  timeStamp_t         localCpuTimeOwed;
+  unsigned long long  localCountsOwed[ NUM_COUNTERS ];
+
+  //the client's live heap as last sampled: what this function allocated
+  //itself, and what it and everything it called allocated
+  unsigned long long  heapBytes;
+  unsigned long long  heapAllocs;
+  unsigned long long  totalHeapBytes;
+  float               heapFraction;
+
+  //the lock this function has waited longest for, by REC_LOCKS
+  void                *lockAddress;
+  unsigned long long  lockWaits;
+  unsigned long long  lockWaitTime;
+
   timeStamp_t         lastActive;
   timeStamp_t         inactiveTime;
   boolean             active;
@@ -59,6 +94,10 @@ typedef struct graphNode_s
   vec3_t              move;
 
   boolean             recursiveDummy;
+
+  //a zone the client marked out itself, named by it rather than by its
+  //symbol
+  boolean             zone;
   
   //needed for hashtable chains
   struct graphNode_s  *next;
@@ -75,12 +114,58 @@ typedef struct graphEdge_s
   
   long                calls;
   float               callsFraction;
+
+  //what calls along this edge counted, callees included
+  unsigned long long  counts[ NUM_COUNTERS ];
+
+  //with CAP_CALLSITES, the calls from each return address in from hang
+  //off the edge for them all, chained through next; they aren't in the
+  //hash and numEdges doesn't count them
+  void                *callSite;
+  struct graphEdge_s  *sites;
+  struct graphEdge_s  *collapsed;
   
   //needed for hashtable chains
   struct graphEdge_s  *next;
 } graphEdge_t;
 
 
+//a value a client reported for a counter of its own
+typedef struct graphSample_s
+{
+  timeStamp_t  time;
+  long long    value;
+} graphSample_t;
+
+
+//with CAP_ZONES, a counter and the values reported for it; once there
+//are COUNTER_SAMPLES the oldest are overwritten, but the extremes and
+//the latest are over every value since the graph was last cleared
+typedef struct graphCounter_s
+{
+  char          name[ MAX_SYMBOL_TEXT ];
+
+  long long     latest, min, max;
+  timeStamp_t   latestTime;
+
+  long          numSamples;   //ever added, so also where the next goes
+  int           size;
+  graphSample_t *samples;
+} graphCounter_t;
+
+
+//totals for a single client thread
+typedef struct graphThread_s
+{
+  timeStamp_t  localTime;
+  timeStamp_t  totalTime;
+  timeStamp_t  localCpuTime;
+  timeStamp_t  totalCpuTime;
+
+  long         calls;
+} graphThread_t;
+
+
 typedef struct graph_s
 {
   int          numNodes;
@@ -96,20 +181,55 @@ typedef struct graph_s
   timeStamp_t  maxTotalTime;
   timeStamp_t  maxInactiveTime;
 
+  timeStamp_t  totalLocalCpuTime;
+  timeStamp_t  totalTotalCpuTime;
+
+  timeStamp_t  maxLocalCpuTime;
+  timeStamp_t  maxTotalCpuTime;
+
+  unsigned long long  totalLocalCounts[ NUM_COUNTERS ];
+  unsigned long long  maxLocalCounts[ NUM_COUNTERS ];
+
+  unsigned long long  totalHeapBytes;
+  unsigned long long  maxHeapBytes;
+
   long         maxEdgeCalls;
   long         maxNodeCalls;
 
   long         totalCalls;
+
+  //indexed by thread id
+  int           numThreads;
+  graphThread_t *threads;
+
+  //never removed, so clients can remember them by index
+  int            numCounters;
+  graphCounter_t *counters;
 } graph_t;
 
 
 graphNode_t *searchNodes( void *symbol, void *parentSymbol, graph_t *g );
-graphEdge_t *searchEdges( graphNode_t *fNode, graphNode_t *tNode, graph_t *g );
+void        renameNodes( graph_t *g );
+graphEdge_t *searchEdges( graphNode_t *fNode, graphNode_t *tNode,
+                          void *callSite, graph_t *g );
 
 graphNode_t **listNodes( sortField_t sf, int *n, graph_t *g );
 graphEdge_t **listEdges( int *n, graph_t *g );
 
+graphThread_t *searchThreads( unsigned int tid, graph_t *g );
+
+int           searchCounters( const char *name, graph_t *g );
+void          addSample( graphCounter_t *k, timeStamp_t time,
+                         long long value );
+graphSample_t *listSample( graphCounter_t *k, long i );
+long          keptSamples( graphCounter_t *k );
+
 void        initGraph( graph_t *g );
 void        shutdownGraph( graph_t *g );
+void        updateGraph( graph_t *g, timeStamp_t now );
+void        clearGraph( graph_t *g );
+void        clearHeap( graph_t *g );
+void        clearLocks( graph_t *g );
+void        mergeGraph( graph_t *to, graph_t *from );
   
 #endif
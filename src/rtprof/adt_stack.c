@@ -18,6 +18,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "adt_stack.h"
 
 /*
@@ -31,6 +32,11 @@ void initStack( callStack_t *s )
 {
   s->count = 0;
   s->top = NULL;
+  s->overhead = s->lastTime = 0;
+  s->cpuOverhead = s->lastCpu = 0;
+  s->running = NULL;
+  s->suspendTime = s->suspendCpu = 0;
+  memset( s->suspendCounts, 0, sizeof( s->suspendCounts ) );
 }
 
 /*
@@ -110,3 +116,106 @@ boolean emptyStack( callStack_t *s )
 {
   return (boolean)( s->count == 0 );
 }
+
+
+/*
+===============
+initThreadStacks
+
+Initialise a set of per thread stacks
+===============
+*/
+void initThreadStacks( threadStacks_t *ts )
+{
+  ts->numStacks = 0;
+  ts->stacks = NULL;
+}
+
+/*
+===============
+shutdownThreadStacks
+
+Shutdown a set of per thread stacks
+===============
+*/
+void shutdownThreadStacks( threadStacks_t *ts )
+{
+  int i;
+
+  for( i = 0; i < ts->numStacks; i++ )
+  {
+    if( ts->stacks[ i ] )
+    {
+      shutdownStack( ts->stacks[ i ] );
+      free( ts->stacks[ i ] );
+    }
+  }
+
+  free( ts->stacks );
+  initThreadStacks( ts );
+}
+
+/*
+===============
+threadStack
+
+Return the stack for a thread, allocating it if it doesn't exist
+===============
+*/
+callStack_t *threadStack( unsigned int tid, threadStacks_t *ts )
+{
+  int newSize;
+
+  if( tid >= MAX_THREADS )
+    return NULL;
+
+  if( tid >= ts->numStacks )
+  {
+    newSize = ts->numStacks ? ts->numStacks : 16;
+
+    while( newSize <= tid )
+      newSize *= 2;
+
+    ts->stacks = (callStack_t **)realloc( ts->stacks,
+                                          newSize * sizeof( callStack_t * ) );
+    memset( ts->stacks + ts->numStacks, 0,
+            ( newSize - ts->numStacks ) * sizeof( callStack_t * ) );
+    ts->numStacks = newSize;
+  }
+
+  if( ts->stacks[ tid ] == NULL )
+  {
+    ts->stacks[ tid ] = (callStack_t *)malloc( sizeof( callStack_t ) );
+    initStack( ts->stacks[ tid ] );
+  }
+
+  return ts->stacks[ tid ];
+}
+
+/*
+===============
+retireStack
+
+Throw away the stack for a thread that has ended, so its id can be
+used again
+===============
+*/
+void retireStack( unsigned int tid, threadStacks_t *ts )
+{
+  callStack_t *s;
+  int         i;
+
+  if( tid >= ts->numStacks || ( s = ts->stacks[ tid ] ) == NULL )
+    return;
+
+  //no thread is running it any more
+  for( i = 0; i < ts->numStacks; i++ )
+  {
+    if( ts->stacks[ i ] != NULL && ts->stacks[ i ]->running == s )
+      ts->stacks[ i ]->running = NULL;
+  }
+
+  shutdownStack( s );
+  free( s );
+  ts->stacks[ tid ] = NULL;
+}
@@ -24,19 +24,50 @@
 typedef struct stackFrame_s
 {
   void                *symbol;
+  struct graphNode_s  *node;    //symbol's node in the call graph
+  void                *callSite;  //where it was called from, if known
 
   timeStamp_t         calleeEntryTime;
   timeStamp_t         calleeExitTime;
+  timeStamp_t         calleeEntryCpu;
+  timeStamp_t         calleeExitCpu;
+  unsigned long long  calleeEntryCounts[ NUM_COUNTERS ];
+  unsigned long long  calleeExitCounts[ NUM_COUNTERS ];
 
   struct stackFrame_s *next;
 } stackFrame_t;
 
 typedef struct stack_s
 {
-  int           count;
-  stackFrame_t  *top;
+  int                 count;
+  stackFrame_t        *top;
+
+  //the client's hook overhead so far on this thread, times OVERHEAD_SCALE,
+  //and the last timestamp it was taken out of; likewise for cpu time
+  timeStamp_t         overhead;
+  timeStamp_t         lastTime;
+  timeStamp_t         cpuOverhead;
+  timeStamp_t         lastCpu;
+
+  //on a thread's own stack, the fiber's it is running instead, if any
+  struct stack_s      *running;
+
+  //when a fiber's stack was last switched away from
+  timeStamp_t         suspendTime;
+  timeStamp_t         suspendCpu;
+  unsigned long long  suspendCounts[ NUM_COUNTERS ];
 } callStack_t;
 
+//upper bound on thread ids, to guard against a garbled stream
+#define MAX_THREADS 65536
+
+//one call stack per client thread, indexed by thread id
+typedef struct threadStacks_s
+{
+  int           numStacks;
+  callStack_t   **stacks;
+} threadStacks_t;
+
 void          initStack( callStack_t *s );
 void          shutdownStack( callStack_t *s );
 void          pushStack( stackFrame_t sf, callStack_t *s );
@@ -44,4 +75,9 @@ stackFrame_t  *peekStack( callStack_t *s );
 stackFrame_t  popStack( callStack_t *s );
 boolean       emptyStack( callStack_t *s );
 
+void          initThreadStacks( threadStacks_t *ts );
+void          shutdownThreadStacks( threadStacks_t *ts );
+callStack_t   *threadStack( unsigned int tid, threadStacks_t *ts );
+void          retireStack( unsigned int tid, threadStacks_t *ts );
+
 #endif
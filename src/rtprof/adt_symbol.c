@@ -132,19 +132,28 @@ void addSymbol( void *symbol, char *textSymbol )
 //this hack is employed.
 #define BFD_HACK    "gcc2_compiled."
 
-//FIXME: hard wired for pc-linux
-#define BFD_TARGET  "i686-pc-linux-gnu"
+//an object whose symbols have been loaded, and where
+typedef struct symbolModule_s
+{
+  char                  *path;
+  unsigned long long    bias;
+
+  struct symbolModule_s *next;
+} symbolModule_t;
+
+static symbolModule_t *modules = NULL;
 
 /*
 ===============
-resolveSymbols
+readSymbols
 
-Open a binary file and get symbols
+Add the symbols in an open binary file, or its dynamic symbols, to the
+symbol table at their link-time addresses plus bias
 ===============
 */
-void resolveSymbols( char *binFile )
+static boolean readSymbols( bfd *file, boolean dynamic,
+                            unsigned long long bias )
 {
-  bfd           *file;
   long          symcount;
   PTR           minisyms;
   unsigned int  size;
@@ -152,74 +161,126 @@ void resolveSymbols( char *binFile )
   bfd_byte      *from, *fromend;
   symbol_info   syminfo;
 
-  if( !bfd_set_default_target( BFD_TARGET ) )
+  symcount = bfd_read_minisymbols( file, dynamic, &minisyms, &size );
+
+  //nothing there, or something broke
+  if( symcount <= 0 )
+    return false;
+
+  if( ( store = bfd_make_empty_symbol( file ) ) == NULL )
   {
-    fprintf( stderr, "rtprof: unable to set default target\n" );
-    return;
+    fprintf( stderr, "rtprof: bfd_make_empty_symbol\n" );
+    free( minisyms );
+    return false;
   }
-  
-  if( ( file = bfd_openr( binFile, NULL ) ) != NULL )
+
+  from = (bfd_byte *)minisyms;
+  fromend = from + symcount * size;
+
+  for( ; from < fromend; from += size )
   {
-    //hmm?
-    if( !bfd_check_format_matches( file, bfd_object, NULL ) )
+    if( ( sym = bfd_minisymbol_to_symbol( file, dynamic, from, store ) ) == NULL )
     {
-      fprintf( stderr, "rtprof: bfd format doesn't match\n" );
-      return;
-    }
-      
-    //no symbols
-    if( !( bfd_get_file_flags( file ) & HAS_SYMS ) )
-    {
-      fprintf( stderr, "rtprof: file has no symbols\n" );
-      return;
+      fprintf( stderr, "rtprof: bfd_minisymbol_to_symbol\n" );
+      break;
     }
 
-    symcount = bfd_read_minisymbols( file, 0, &minisyms, &size );
-    
-    //something broke FIXME: be more verbose
-    if( symcount < 0 )
-    {
-      fprintf( stderr, "rtprof: unable to resolve symbols\n" );
-      return;
-    }
+    bfd_get_symbol_info( file, sym, &syminfo );
 
-    //no symbols
-    if( symcount == 0 )
-    {
-      fprintf( stderr, "rtprof: symcount = 0\n" );
-      return;
-    }
-     
-    if( ( store = bfd_make_empty_symbol( file ) ) == NULL )
-    {
-      fprintf( stderr, "rtprof: bfd_make_empty_symbol\n" );
-      return;
-    }
-    
-    from = (bfd_byte *)minisyms;    
-    fromend = from + symcount * size;
-
-    for( ; from < fromend; from += size )
-    { 
-      if( ( sym = bfd_minisymbol_to_symbol( file, 0, from, store ) ) == NULL )
-      {
-        fprintf( stderr, "rtprof: bfd_minisymbol_to_symbol\n" );
-        return;
-      }
-         
-      bfd_get_symbol_info( file, sym, &syminfo );
-      
-      if( syminfo.value && strlen( syminfo.name ) && strcmp( syminfo.name, BFD_HACK ) )
-      {
-        addSymbol( (void *)syminfo.value, (char *)syminfo.name );
-        /*printf( "%p \"%s\" \"%s\"\n", syminfo.value, syminfo.name, lookupSymbol( (void *)syminfo.value ) );*/
-      }
-    }    
-    
-    bfd_close( file );
+    if( syminfo.value && strlen( syminfo.name ) && strcmp( syminfo.name, BFD_HACK ) )
+      addSymbol( (void *)(unsigned long)( syminfo.value + bias ),
+                 (char *)syminfo.name );
   }
-  else
+
+  free( minisyms );
+
+  return true;
+}
+
+/*
+===============
+loadSymbols
+
+Open a binary file and get symbols, adding bias to each address; bfd's
+default target is the machine it was built for, and the file's own
+format is found from there
+===============
+*/
+static void loadSymbols( const char *binFile, unsigned long long bias )
+{
+  bfd *file;
+
+  if( ( file = bfd_openr( binFile, NULL ) ) == NULL )
+  {
     fprintf( stderr, "rtprof: unable to open file %s\n", binFile );
+    return;
+  }
+
+  if( !bfd_check_format_matches( file, bfd_object, NULL ) )
+  {
+    fprintf( stderr, "rtprof: bfd format of %s doesn't match\n", binFile );
+    bfd_close( file );
+    return;
+  }
+
+  //stripped objects, shared libraries especially, still have the
+  //symbols they export
+  if( !( ( bfd_get_file_flags( file ) & HAS_SYMS ) &&
+         readSymbols( file, false, bias ) ) &&
+      !( ( bfd_get_file_flags( file ) & DYNAMIC ) &&
+         readSymbols( file, true, bias ) ) )
+    fprintf( stderr, "rtprof: %s has no symbols\n", binFile );
+
+  bfd_close( file );
+}
+
+/*
+===============
+resolveSymbols
+
+Get the symbols of a binary file named on the command line, which are
+taken to be at their link-time addresses
+===============
+*/
+void resolveSymbols( char *binFile )
+{
+  loadSymbols( binFile, 0 );
+}
+
+/*
+===============
+resolveModule
+
+Get the symbols of an object a client has loaded at bias, unless they
+already have been
+Returns true if they are new
+===============
+*/
+boolean resolveModule( const char *path, unsigned long long bias )
+{
+  symbolModule_t  *m;
+
+  //every process a client forks sends the same map
+  for( m = modules; m != NULL; m = m->next )
+  {
+    if( m->bias == bias && !strcmp( m->path, path ) )
+      return false;
+  }
+
+  if( ( m = (symbolModule_t *)malloc( sizeof( symbolModule_t ) ) ) == NULL ||
+      ( m->path = strdup( path ) ) == NULL )
+  {
+    free( m );
+    return false;
+  }
+
+  m->bias = bias;
+  m->next = modules;
+  modules = m;
+
+  loadSymbols( path, bias );
+
+  return true;
 }
 
 
@@ -249,8 +310,9 @@ Shutdown symbol table
 */
 void shutdownSymbolTable( void )
 {
-  int           i;
-  symbolNode_t  *p, *q;
+  int             i;
+  symbolNode_t    *p, *q;
+  symbolModule_t  *m;
 
   for( i = 0; i < MAX_SYMBOL_BUCKETS; i++ )
   {
@@ -265,4 +327,14 @@ void shutdownSymbolTable( void )
       p = q;
     }
   }
+
+  while( modules != NULL )
+  {
+    m = modules->next;
+
+    free( modules->path );
+    free( modules );
+
+    modules = m;
+  }
 }
@@ -19,6 +19,8 @@
 #ifndef SYMBOL_H
 #define SYMBOL_H
 
+#include "com_common.h"
+
 #define MAX_SYMBOL_BUCKETS  1024
 #define MAX_SYMBOL_TEXT     256
 
@@ -32,6 +34,7 @@ typedef struct symbolNode_s
 } symbolNode_t;
 
 void          resolveSymbols( char *binFile );
+boolean       resolveModule( const char *path, unsigned long long bias );
 void          addSymbol( void *symbol, char *textSymbol );
 char          *lookupSymbol( void *symbol );
 
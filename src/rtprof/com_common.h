@@ -29,13 +29,44 @@ typedef enum
 
 typedef unsigned long long timeStamp_t;
 
+//for EV_THREAD the ts field holds the id of the thread that all
+//following events belong to, until the next EV_THREAD
+//for EV_CLOCKRATE the ts field holds the number of timestamp ticks per
+//second; clients that never send it are assumed to use microseconds
+//EV_HELLO is described in com_protocol.h
 typedef enum
 {
   EV_ENTER,
   EV_EXIT,
-  EV_PROCEXIT
+  EV_PROCEXIT,
+  EV_THREAD,
+  EV_CLOCKRATE,
+  EV_HELLO
 } event_t;
 
+#define LEGACY_CLOCK_RATE 1000000ULL
+
+//counters a client can attribute to functions; see CAP_COUNTERS
+typedef enum
+{
+  CNT_FAULTS,       //page faults
+  CNT_SWITCHES,     //context switches
+  CNT_MIGRATIONS,   //moves to another cpu
+  CNT_ALLOCS,       //calls to malloc, calloc and realloc
+  CNT_ALLOC_BYTES,  //bytes they were asked for
+  CNT_FREES,        //calls to free
+  CNT_ALLOC_TIME,   //nanoseconds spent in all of them
+  CNT_LOCK_WAITS,   //mutexes and rwlocks found already held
+  CNT_LOCK_TIME,    //nanoseconds spent waiting for them
+  CNT_COND_WAITS,   //waits on condition variables
+  CNT_COND_TIME,    //nanoseconds spent in them
+  CNT_IO_CALLS,     //calls to read, write, poll and the like
+  CNT_IO_BYTES_IN,  //bytes they read or received
+  CNT_IO_BYTES_OUT, //bytes they wrote or sent
+  CNT_IO_TIME,      //nanoseconds spent in them
+  NUM_COUNTERS
+} counter_t;
+
 typedef struct functionEvent_s
 {
   unsigned char type;
@@ -0,0 +1,276 @@
+/*
+ * Copyright (C) 2003 Tim Angus
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef COM_COMPRESS_H
+#define COM_COMPRESS_H
+
+#include <string.h>
+
+#include "com_common.h"
+
+/*
+ * Block compression
+ *
+ * A byte oriented LZ77 codec laid out like an LZ4 block: a sequence of
+ *   token           literal count << 4 | ( match length - LZ_MIN_MATCH )
+ *   literal count   extra bytes while either field of the token is 15,
+ *   literals        each 255 except the last, added to it
+ *   offset          2 bytes little endian, back from the current position
+ *   match length    extra bytes, as for the literal count
+ * where the last sequence is literals only and stops at the end of the
+ * block. The event stream is very repetitive, so this does well on it
+ * without needing anything cleverer than a single hash probe.
+ */
+
+#define LZ_MIN_MATCH      4
+#define LZ_MAX_OFFSET     65535
+
+//the last match must start this far from the end, and end this far
+#define LZ_MATCH_LIMIT    12
+#define LZ_LAST_LITERALS  5
+
+#define LZ_HASH_BITS      12
+#define LZ_HASH_SIZE      ( 1 << LZ_HASH_BITS )
+
+//compressed size of n bytes can't exceed this
+#define LZ_BOUND(n)       ( (n) + (n) / 255 + 16 )
+
+/*
+===============
+lzRead32
+
+Unaligned 32 bit load
+===============
+*/
+static inline unsigned int lzRead32( const unsigned char *p )
+{
+  unsigned int v;
+
+  memcpy( &v, p, sizeof( v ) );
+
+  return v;
+}
+
+/*
+===============
+lzHash
+
+Hash the four bytes at p
+===============
+*/
+static inline unsigned int lzHash( const unsigned char *p )
+{
+  return ( lzRead32( p ) * 2654435761U ) >> ( 32 - LZ_HASH_BITS );
+}
+
+/*
+===============
+lzWriteLength
+
+Write the part of a length that didn't fit in its token nibble
+===============
+*/
+static inline unsigned char *lzWriteLength( unsigned char *op, int length )
+{
+  for( length -= 15; length >= 255; length -= 255 )
+    *op++ = 255;
+
+  *op++ = (unsigned char)length;
+
+  return op;
+}
+
+/*
+===============
+lzWriteSequence
+
+Write literals [anchor, anchor + literals) followed by a match, which
+is left out if matchLength is 0
+===============
+*/
+static inline unsigned char *lzWriteSequence( unsigned char *op,
+                                              const unsigned char *anchor,
+                                              int literals, int offset,
+                                              int matchLength )
+{
+  unsigned char *token = op++;
+  int           m = matchLength - LZ_MIN_MATCH;
+
+  *token = (unsigned char)( ( literals < 15 ? literals : 15 ) << 4 );
+
+  if( literals >= 15 )
+    op = lzWriteLength( op, literals );
+
+  memcpy( op, anchor, literals );
+  op += literals;
+
+  if( matchLength == 0 )
+    return op;
+
+  *op++ = (unsigned char)offset;
+  *op++ = (unsigned char)( offset >> 8 );
+
+  *token |= (unsigned char)( m < 15 ? m : 15 );
+
+  if( m >= 15 )
+    op = lzWriteLength( op, m );
+
+  return op;
+}
+
+/*
+===============
+compressBlock
+
+Compress size bytes from src into dst, which must have room for
+LZ_BOUND( size ). table is scratch space of LZ_HASH_SIZE ints
+Returns the compressed size
+===============
+*/
+static inline int compressBlock( const unsigned char *src, int size,
+                                 unsigned char *dst, int *table )
+{
+  const unsigned char *ip = src;
+  const unsigned char *anchor = src;
+  const unsigned char *end = src + size;
+  const unsigned char *matchLimit = end - LZ_MATCH_LIMIT;
+  const unsigned char *lastLiterals = end - LZ_LAST_LITERALS;
+  const unsigned char *ref;
+  unsigned char       *op = dst;
+  unsigned int        h;
+  int                 length;
+
+  memset( table, 0, LZ_HASH_SIZE * sizeof( int ) );
+
+  while( ip < matchLimit )
+  {
+    h = lzHash( ip );
+    ref = src + table[ h ];
+    table[ h ] = (int)( ip - src );
+
+    if( ref >= ip || ip - ref > LZ_MAX_OFFSET ||
+        lzRead32( ref ) != lzRead32( ip ) )
+    {
+      //skip faster through data that isn't compressing
+      ip += 1 + ( ( ip - anchor ) >> 6 );
+      continue;
+    }
+
+    for( length = LZ_MIN_MATCH;
+         ip + length < lastLiterals && ref[ length ] == ip[ length ];
+         length++ );
+
+    op = lzWriteSequence( op, anchor, (int)( ip - anchor ),
+                          (int)( ip - ref ), length );
+
+    ip += length;
+    anchor = ip;
+  }
+
+  op = lzWriteSequence( op, anchor, (int)( end - anchor ), 0, 0 );
+
+  return (int)( op - dst );
+}
+
+/*
+===============
+lzReadLength
+
+Read the rest of a length whose token nibble was 15
+Returns false if it runs off the end of the block
+===============
+*/
+static inline boolean lzReadLength( const unsigned char **ip,
+                                    const unsigned char *end, int *length )
+{
+  unsigned char b;
+
+  do
+  {
+    if( *ip >= end )
+      return false;
+
+    b = *(*ip)++;
+    *length += b;
+  } while( b == 255 );
+
+  return true;
+}
+
+/*
+===============
+decompressBlock
+
+Decompress size bytes from src into dst, which has room for capacity
+Returns the decompressed size, or -1 if the block is garbled or too big
+===============
+*/
+static inline int decompressBlock( const unsigned char *src, int size,
+                                   unsigned char *dst, int capacity )
+{
+  const unsigned char *ip = src;
+  const unsigned char *end = src + size;
+  const unsigned char *ref;
+  unsigned char       *op = dst;
+  unsigned char       token;
+  int                 length, offset;
+
+  while( ip < end )
+  {
+    token = *ip++;
+
+    if( ( length = token >> 4 ) == 15 && !lzReadLength( &ip, end, &length ) )
+      return -1;
+
+    if( end - ip < length || capacity - ( op - dst ) < length )
+      return -1;
+
+    memcpy( op, ip, length );
+    op += length;
+    ip += length;
+
+    //the last sequence has no match
+    if( ip == end )
+      break;
+
+    if( end - ip < 2 )
+      return -1;
+
+    offset = ip[ 0 ] | ( ip[ 1 ] << 8 );
+    ip += 2;
+
+    if( offset == 0 || offset > op - dst )
+      return -1;
+
+    if( ( length = token & 15 ) == 15 && !lzReadLength( &ip, end, &length ) )
+      return -1;
+
+    length += LZ_MIN_MATCH;
+
+    if( capacity - ( op - dst ) < length )
+      return -1;
+
+    //may overlap what it is copying, so a byte at a time
+    for( ref = op - offset; length > 0; length-- )
+      *op++ = *ref++;
+  }
+
+  return (int)( op - dst );
+}
+
+#endif
@@ -0,0 +1,355 @@
+/*
+ * Copyright (C) 2003 Tim Angus
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef COM_PROTOCOL_H
+#define COM_PROTOCOL_H
+
+#include "com_common.h"
+
+/*
+ * Protocol negotiation
+ *
+ * A client starts by sending its announcement as ordinary 17 byte
+ * functionEvent_ts (EV_CLOCKRATE, ...) ending with EV_HELLO. Old servers
+ * silently ignore event types they don't know. A server that understands
+ * EV_HELLO replies with a helloReply_t; the client then switches to the
+ * agreed version. A client that gets no reply carries on with version 1.
+ *
+ * EV_HELLO: ts    = PROTOCOL_MAGIC << 32 | pointer size << 8 | version
+ *           this_fn = capability bits
+ */
+
+#define PROTOCOL_MAGIC      0x52545046U   //"RTPF"
+#define PROTOCOL_VERSION    2
+
+//milliseconds a client waits for a helloReply_t
+#define HELLO_TIMEOUT       1000
+
+#define HELLO_TS(v,p)       ( ( (timeStamp_t)PROTOCOL_MAGIC << 32 ) | \
+                              ( (p) << 8 ) | (v) )
+#define HELLO_MAGIC(ts)     ( (unsigned int)( (ts) >> 32 ) )
+#define HELLO_PTRSIZE(ts)   ( (unsigned int)( ( (ts) >> 8 ) & 0xff ) )
+#define HELLO_VERSION(ts)   ( (unsigned int)( (ts) & 0xff ) )
+
+//capability bits; each side offers what it understands and the
+//intersection is used
+#define CAP_FUNCIDS         ( 1 << 0 )    //see REC_FUNCTION
+#define CAP_SUMMARY         ( 1 << 1 )    //see REC_SUMMARY
+#define CAP_CONTROL         ( 1 << 2 )    //see controlMessage_t
+#define CAP_COMPRESS        ( 1 << 3 )    //see REC_BLOCK
+#define CAP_CPUTIME         ( 1 << 4 )    //see REC_BATCH and REC_SUMMARY
+#define CAP_COUNTERS        ( 1 << 5 )    //likewise
+#define CAP_ALLOCS          ( 1 << 6 )    //likewise
+#define CAP_HEAP            ( 1 << 7 )    //see REC_HEAP
+#define CAP_MODULES         ( 1 << 8 )    //see REC_MODULE
+#define CAP_LOCKS           ( 1 << 9 )    //see REC_BATCH and REC_LOCKS
+#define CAP_IO              ( 1 << 10 )   //see REC_BATCH
+#define CAP_CALLSITES       ( 1 << 11 )   //see REC_BATCH and REC_SUMMARY
+#define CAP_FIBERS          ( 1 << 12 )   //see REC_BATCH
+#define CAP_ZONES           ( 1 << 13 )   //see REC_FUNCTION and REC_COUNTER
+
+/*
+===============
+counterCapability
+
+The capability that brings a counter_t into the stream
+===============
+*/
+static inline unsigned int counterCapability( int counter )
+{
+  if( counter < CNT_ALLOCS )
+    return CAP_COUNTERS;
+
+  if( counter < CNT_LOCK_WAITS )
+    return CAP_ALLOCS;
+
+  return counter < CNT_IO_CALLS ? CAP_LOCKS : CAP_IO;
+}
+
+typedef struct helloReply_s
+{
+  unsigned int  magic;
+  unsigned int  version;
+  unsigned int  capabilities;
+} helloReply_t;
+
+
+/*
+ * Control messages
+ *
+ * With CAP_CONTROL rtprof may send controlMessage_ts back to the client at
+ * any point after its helloReply_t; on the shm transport they go through
+ * a small ring in the shmHeader_t instead.
+ *
+ * CTL_FILTER:  stop reporting functions with addresses in [start, end],
+ *              along with anything they call
+ * CTL_RESUME:  lift any filters lying entirely within [start, end]
+ * CTL_DETACH:  stop sending, finish the stream as if exiting and go back
+ *              to waiting for a profiler to attach; start and end unused
+ */
+
+typedef enum
+{
+  CTL_NONE,
+  CTL_FILTER,
+  CTL_RESUME,
+  CTL_DETACH
+} control_t;
+
+typedef struct controlMessage_s
+{
+  unsigned int        type;
+  unsigned int        reserved;
+  unsigned long long  start;
+  unsigned long long  end;
+} controlMessage_t;
+
+
+/*
+ * Version 2 stream
+ *
+ * A sequence of records, each a tag byte, a varint body length and the
+ * body. Unknown tags can be skipped using the length.
+ *
+ * REC_BATCH:     varint thread id, varint timestamp, then events until the
+ *                end of the body. Each event is
+ *                  varint ( zigzag( ts - previous ts ) << 2 ) | kind
+ *                  varint zigzag( this_fn - previous this_fn )
+ *                where kind is an event_t (EV_ENTER or EV_EXIT). The first
+ *                event is relative to the batch timestamp and a NULL this_fn.
+ *                With CAP_FUNCIDS the second varint is replaced by the
+ *                function id for EV_ENTER and left out for EV_EXIT.
+ *                With CAP_CALLSITES, which needs CAP_FUNCIDS, an EV_ENTER's
+ *                function id is followed by
+ *                  varint call site id + 1, or 0 if unknown
+ *                With CAP_FIBERS an event may also be an EV_THREAD,
+ *                meaning the thread has switched to running another
+ *                stack of calls, such as a coroutine's. In place of
+ *                this_fn or a function id it has
+ *                  varint stack id + 1, or 0 for the thread's own stack
+ *                where stack ids come from the same space as thread ids,
+ *                and it doesn't count as the previous this_fn.
+ *                The thread's events, in this batch and later ones, are
+ *                on that stack until its next EV_THREAD, and nothing on a
+ *                stack is charged for the time it spends switched away
+ *                from.
+ *                With CAP_CPUTIME the batch timestamp is followed by the
+ *                thread's cpu time in nanoseconds, and each event by
+ *                  varint zigzag( cpu time - previous cpu time )
+ *                The batch header then gives the thread's counters, one
+ *                varint for each counter_t whose counterCapability was
+ *                agreed, in counter_t order, and each event ends with one
+ *                varint for each of those
+ *                  zigzag( count - previous count )
+ * REC_PROCEXIT:  empty body; the client is exiting
+ * REC_HELLO:     varint version, varint pointer size, varint clock rate,
+ *                varint capabilities, varint pid, varint overhead; takes
+ *                the place of EV_HELLO and EV_CLOCKRATE on transports with
+ *                no way to reply, and otherwise starts the stream once
+ *                they have been answered, restating what was agreed. The
+ *                pid tells apart the processes of a client that forks.
+ *                overhead is the clock ticks OVERHEAD_SCALE calls to the
+ *                client's hooks take; rtprof takes it out of the time
+ *                between streamed events, and the client has already
+ *                taken it out of REC_SUMMARY times. Older clients leave
+ *                out the fields they don't know.
+ * REC_FUNCTION:  varint id, varint this_fn; defines a function id. Ids are
+ *                dense, start at 0 and are defined before first use.
+ *                With CAP_CALLSITES call sites, the addresses calls return
+ *                to in their callers, are given ids the same way.
+ *                With CAP_ZONES, which needs CAP_FUNCIDS, the rest of the
+ *                body, if there is any, is the name of a zone: a stretch
+ *                of the client's code it marked out itself, whose this_fn
+ *                is the address of the name. It is entered and exited
+ *                like a function.
+ * REC_SUMMARY:   varint thread id, then until the end of the body
+ *                  varint ( caller id + 1, or 0 for the thread's root ) << 1
+ *                         | streamed
+ *                  varint callee id
+ *                  varint call site id + 1, or 0  } CAP_CALLSITES only
+ *                  varint calls
+ *                  varint local time
+ *                  varint total time
+ *                  varint local cpu time     } CAP_CPUTIME only
+ *                  varint total cpu time     }
+ *                  varint local count        } for each counter_t in
+ *                  varint total count        } the stream, in turn
+ *                giving what has been added to each caller -> callee edge
+ *                since the last REC_SUMMARY. Times are in clock ticks, and
+ *                cpu times in nanoseconds, and cover calls that have
+ *                returned; counts split into local and total the same
+ *                way. streamed is set when the caller's own events are
+ *                in the stream, so its local time as worked out from them
+ *                already includes the callee.
+ * REC_BLOCK:     varint uncompressed length, then the rest of the body is
+ *                compressed as in com_compress.h. It unpacks to whole
+ *                records, none of them REC_BLOCKs, which are read as if
+ *                they had been in the stream instead. Only used with
+ *                CAP_COMPRESS.
+ * REC_HEAP:      varint first, then until the end of the body
+ *                  varint depth
+ *                  varint function id, depth times, outermost first
+ *                  varint live bytes
+ *                  varint live allocations
+ *                giving what is still allocated by each call path, as
+ *                estimated from a sample of the client's allocations. A
+ *                call path is at most the innermost HEAP_MAX_DEPTH calls.
+ *                With first set the record starts a snapshot of the whole
+ *                live heap that replaces the last one; otherwise it
+ *                carries on the snapshot in the previous REC_HEAP. Only
+ *                used with CAP_HEAP, which needs CAP_FUNCIDS.
+ * REC_MODULE:    varint load bias, then the rest of the body is the path
+ *                of an executable or shared object mapped into the client,
+ *                whose symbols are at their link-time addresses plus the
+ *                bias. The client's whole load map is sent this way at the
+ *                start of the stream and again whenever it changes, so
+ *                functions in a newly loaded object can turn up just
+ *                before their REC_MODULE. Only used with CAP_MODULES.
+ * REC_LOCKS:     varint first, then until the end of the body
+ *                  varint function id
+ *                  varint lock address
+ *                  varint waits
+ *                  varint wait time
+ *                giving how often, and for how many nanoseconds in all,
+ *                each function has had to wait for each mutex or rwlock
+ *                since the stream started. first works as for REC_HEAP.
+ *                Only used with CAP_LOCKS, which needs CAP_FUNCIDS.
+ * REC_COUNTER:   varint counter id, varint timestamp,
+ *                varint zigzag( value ), then the first time an id is
+ *                used in the stream the rest of the body is the counter's
+ *                name. Gives a value the client reported for a counter of
+ *                its own, at a time on the same clock as REC_BATCH. Only
+ *                used with CAP_ZONES.
+ * REC_RETIRE:    varint thread id; the thread or stack with that id has
+ *                ended, and whatever is still on its stack is dropped.
+ *                Nothing uses the id again until after this record, and
+ *                then it is for a new thread or stack, so a client with
+ *                many short-lived threads never runs out of ids.
+ */
+
+typedef enum
+{
+  REC_NONE,
+  REC_BATCH,
+  REC_PROCEXIT,
+  REC_HELLO,
+  REC_FUNCTION,
+  REC_SUMMARY,
+  REC_BLOCK,
+  REC_HEAP,
+  REC_MODULE,
+  REC_LOCKS,
+  REC_COUNTER,
+  REC_RETIRE
+} record_t;
+
+//hook overhead is given per this many events, to keep the fraction
+#define OVERHEAD_SCALE      1024
+
+//longest call path in a REC_HEAP; must be a power of two
+#define HEAP_MAX_DEPTH      64
+
+#define BATCH_KIND_BITS     2
+#define BATCH_KIND_MASK     ( ( 1 << BATCH_KIND_BITS ) - 1 )
+
+//longest possible varint encoding of a 64 bit value
+#define MAX_VARINT          10
+
+//record lengths are written as fixed width varints so they can be
+//filled in after the body; this many bytes allows bodies up to 2MB
+#define RECORD_LENGTH_BYTES 3
+#define MAX_RECORD_BODY     ( 1 << ( 7 * RECORD_LENGTH_BYTES ) )
+
+#define ZIGZAG(x)           ( ( (unsigned long long)(x) << 1 ) ^ \
+                              (unsigned long long)( (long long)(x) >> 63 ) )
+#define UNZIGZAG(x)         ( (long long)( ( (x) >> 1 ) ^ -( (x) & 1 ) ) )
+
+/*
+===============
+writeVarint
+
+Encode a value as a LEB128 varint, returning the number of bytes written
+===============
+*/
+static inline int writeVarint( unsigned char *p, unsigned long long v )
+{
+  int n = 0;
+
+  while( v >= 0x80 )
+  {
+    p[ n++ ] = (unsigned char)( v | 0x80 );
+    v >>= 7;
+  }
+
+  p[ n++ ] = (unsigned char)v;
+
+  return n;
+}
+
+/*
+===============
+writeFixedVarint
+
+Encode a value as a varint padded to exactly n bytes
+===============
+*/
+static inline void writeFixedVarint( unsigned char *p, unsigned long long v,
+                                     int n )
+{
+  int i;
+
+  for( i = 0; i < n - 1; i++, v >>= 7 )
+    p[ i ] = (unsigned char)( ( v & 0x7f ) | 0x80 );
+
+  p[ i ] = (unsigned char)( v & 0x7f );
+}
+
+/*
+===============
+readVarint
+
+Decode a varint from [*p, end), advancing *p
+Returns false if the varint is truncated or malformed
+===============
+*/
+static inline boolean readVarint( const unsigned char **p,
+                                  const unsigned char *end,
+                                  unsigned long long *v )
+{
+  const unsigned char *q = *p;
+  unsigned long long  r = 0;
+  int                 shift = 0;
+
+  while( q < end && shift < 64 )
+  {
+    r |= (unsigned long long)( *q & 0x7f ) << shift;
+
+    if( !( *q++ & 0x80 ) )
+    {
+      *v = r;
+      *p = q;
+      return true;
+    }
+
+    shift += 7;
+  }
+
+  return false;
+}
+
+#endif
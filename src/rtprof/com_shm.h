@@ -0,0 +1,151 @@
+/*
+ * Copyright (C) 2003 Tim Angus
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef COM_SHM_H
+#define COM_SHM_H
+
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "com_common.h"
+#include "com_protocol.h"
+
+/*
+ * Shared memory transport
+ *
+ * rtprof creates a POSIX shared memory object holding a shmHeader_t page
+ * followed by a ring of bytes. librtprof attaches as the only writer and
+ * appends a version 2 record stream, starting with REC_HELLO. Both sides
+ * map the ring twice back to back, so a record that wraps around the end
+ * of the ring is still contiguous in memory and can be used in place.
+ * Once a client has claimed a ring rtprof unlinks it and puts up a fresh
+ * one under the same name for the next client.
+ *
+ * The writer only makes a futex call when the reader has said it is
+ * about to sleep.
+ *
+ * Control messages travel the other way through a ring of
+ * SHM_CONTROL_SLOTS in the header, with rtprof as the writer.
+ */
+
+#define SHM_MAGIC         0x52545053U   //"RTPS"
+#define SHM_HEADER_SIZE   4096
+
+//bytes in the ring; a power of two and a multiple of the page size
+#define SHM_RING_SIZE     ( 16 * 1024 * 1024 )
+
+//must be a power of two and fit in the header page
+#define SHM_CONTROL_SLOTS 64
+
+typedef struct shmHeader_s
+{
+  unsigned int                magic;
+  unsigned int                version;        //highest version rtprof reads
+  unsigned int                capabilities;   //what rtprof understands
+  unsigned int                size;           //bytes in the ring
+
+  int                         readerPid;
+  volatile int                writerPid;      //0 until a client attaches
+
+  volatile unsigned int       readerWaiting;
+  volatile unsigned int       wakeCount;      //futex word
+
+  //free running byte counts; ring offset is count & ( size - 1 )
+  volatile unsigned long long head __attribute__ ( ( aligned( 64 ) ) );
+  volatile unsigned long long tail __attribute__ ( ( aligned( 64 ) ) );
+
+  volatile unsigned int       controlHead __attribute__ ( ( aligned( 64 ) ) );
+  volatile unsigned int       controlTail;
+  controlMessage_t            control[ SHM_CONTROL_SLOTS ];
+} shmHeader_t;
+
+/*
+===============
+mapShmRing
+
+Map a shared memory ring with the data area mirrored
+===============
+*/
+static inline unsigned char *mapShmRing( int fd, unsigned int size )
+{
+  unsigned char *base;
+
+  base = (unsigned char *)mmap( NULL, SHM_HEADER_SIZE + 2 * size, PROT_NONE,
+                                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+
+  if( base == MAP_FAILED )
+    return NULL;
+
+  if( mmap( base, SHM_HEADER_SIZE + size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_FIXED, fd, 0 ) == MAP_FAILED ||
+      mmap( base + SHM_HEADER_SIZE + size, size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_FIXED, fd, SHM_HEADER_SIZE ) == MAP_FAILED )
+  {
+    munmap( base, SHM_HEADER_SIZE + 2 * size );
+    return NULL;
+  }
+
+  return base;
+}
+
+/*
+===============
+unmapShmRing
+
+Undo mapShmRing
+===============
+*/
+static inline void unmapShmRing( unsigned char *base, unsigned int size )
+{
+  munmap( base, SHM_HEADER_SIZE + 2 * size );
+}
+
+/*
+===============
+futexWait
+
+Sleep while *addr == val, for at most msec milliseconds
+===============
+*/
+static inline void futexWait( volatile unsigned int *addr, unsigned int val,
+                              int msec )
+{
+  struct timespec tp;
+
+  tp.tv_sec = msec / 1000;
+  tp.tv_nsec = ( msec % 1000 ) * 1000000;
+
+  syscall( SYS_futex, addr, FUTEX_WAIT, val, &tp, NULL, 0 );
+}
+
+/*
+===============
+futexWake
+
+Wake anything sleeping on addr
+===============
+*/
+static inline void futexWake( volatile unsigned int *addr )
+{
+  syscall( SYS_futex, addr, FUTEX_WAKE, 1, NULL, NULL, 0 );
+}
+
+#endif
@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2003 Tim Angus
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+
+#ifndef COM_TRACE_H
+#define COM_TRACE_H
+
+#include "com_common.h"
+#include "com_protocol.h"
+
+/*
+ * Trace files
+ *
+ * With RTPROF_SKT=file://path librtprof writes to a file instead of a live
+ * rtprof, for replaying later with rtprof --replay. The file is a
+ * traceHeader_t page followed by a version 2 record stream starting with
+ * REC_HELLO, just as on the shm transport. The client maps the file and
+ * grows it as needed; length is the number of stream bytes written so
+ * far, so a trace from a client that died part way is still readable up
+ * to that point. Control messages can't be sent to a trace.
+ */
+
+#define TRACE_MAGIC         0x52545054U   //"RTPT"
+#define TRACE_HEADER_SIZE   4096
+
+//initial stream space preallocated by the client; it doubles when full
+#define TRACE_INITIAL_SIZE  ( 64 * 1024 * 1024 )
+
+typedef struct traceHeader_s
+{
+  unsigned int                magic;
+  unsigned int                version;        //of the record stream
+  volatile unsigned long long length;         //stream bytes written
+} traceHeader_t;
+
+#endif
@@ -44,6 +44,15 @@ camera_t            camera;
 static timeStamp_t  lastTS;
 static int          width, height;
 
+//toggled from the keyboard; see GLfrontend
+static boolean      sizeByCpu = false;
+static boolean      sizeByHeap = false;
+static boolean      sizeByLocks = false;
+static boolean      sizeByIo = false;
+static boolean      colourByCpu = false;
+static int          colourByCounter = -1;   //a counter_t, or -1 for none
+static boolean      showThreads = false;
+
 /*
 ===============
 positionCamera
@@ -123,8 +132,131 @@ void addFPSCounter( void )
 }
 
 
+#define MAX_THREAD_LINES  40
+#define THREAD_LINE_SPACE 14
+
+/*
+===============
+addThreadTotals
+
+List the calls made and the time spent by each thread down the top left
+of the screen, as many as fit
+===============
+*/
+static void addThreadTotals( graph_t *g )
+{
+  graphThread_t *t;
+  int           i, y = height - 20, lines = 0;
+
+  glDisable( GL_LIGHTING );
+  glDisable( GL_DEPTH_TEST );
+
+  glMatrixMode( GL_PROJECTION );
+  glPushMatrix( );
+  glLoadIdentity( );
+  gluOrtho2D( 0, width, 0, height );
+
+  glMatrixMode( GL_MODELVIEW );
+  glPushMatrix( );
+  glLoadIdentity( );
+  glColor3f( 1.0f, 1.0f, 1.0f );
+
+  for( i = 0; i < g->numThreads && lines < MAX_THREAD_LINES && y > 20; i++ )
+  {
+    t = &g->threads[ i ];
+
+    if( t->calls == 0 && t->totalTime == 0 )
+      continue;
+
+    glRasterPos2i( 10, y );
+    glPrintf( "thread %d: %ld calls, %.3fms local, %.3fms cpu", i, t->calls,
+              t->localTime / 1.0e6, t->localCpuTime / 1.0e6 );
+
+    y -= THREAD_LINE_SPACE;
+    lines++;
+  }
+
+  glPopMatrix( );
+  glMatrixMode( GL_PROJECTION );
+  glPopMatrix( );
+  glMatrixMode( GL_MODELVIEW );
+
+  glEnable( GL_DEPTH_TEST );
+  glEnable( GL_LIGHTING );
+}
+
+
 #define FADE_TIME 5000000.0f
 
+/*
+===============
+nodeScale
+
+How big to draw a node: its share of the local time, by the wall clock
+or the cpu clock, of the live heap, or of the time spent waiting for
+locks or for i/o
+===============
+*/
+static float nodeScale( graphNode_t *n )
+{
+  if( sizeByHeap )
+    return n->heapFraction;
+
+  if( sizeByLocks )
+    return n->localCountFractions[ CNT_LOCK_TIME ];
+
+  if( sizeByIo )
+    return n->localCountFractions[ CNT_IO_TIME ];
+
+  return sizeByCpu ? n->localCpuFraction : n->localTimeFraction;
+}
+
+/*
+===============
+nodeLabel
+
+What to write by a node: its name, and when sizing by lock waits the
+lock it has waited longest for
+===============
+*/
+static char *nodeLabel( graphNode_t *n )
+{
+  static char label[ MAX_SYMBOL_TEXT + 32 ];
+
+  if( !sizeByLocks || n->lockAddress == NULL )
+    return n->textSymbol;
+
+  snprintf( label, sizeof( label ), "%s [%p x%llu]", n->textSymbol,
+            n->lockAddress, n->lockWaits );
+
+  return label;
+}
+
+/*
+===============
+nodeColour
+
+Where in the colour table a node's colour comes from: normally fading
+towards blue as it goes inactive, or from blue when it spends all its
+time waiting to red when it spends it all on a cpu, or from blue for
+none of a counter's local counts to red for the most of any node
+===============
+*/
+static float nodeColour( graph_t *g, graphNode_t *n, float aScale )
+{
+  unsigned long long max;
+
+  if( colourByCounter >= 0 )
+  {
+    max = g->maxLocalCounts[ colourByCounter ];
+
+    return max > 0 ? (float)n->localCounts[ colourByCounter ] / (float)max :
+                     0.0f;
+  }
+
+  return colourByCpu ? n->onCpuFraction : aScale;
+}
+
 /*
 ===============
 renderScene
@@ -153,6 +285,9 @@ void renderScene( graph_t *g )
 
   addFPSCounter( );
 
+  if( showThreads )
+    addThreadTotals( g );
+
   //light attached to the camera
   positionCamera( );
   VectorCopy( camera.origin, lightPos );
@@ -183,11 +318,11 @@ void renderScene( graph_t *g )
         
         positionCamera( );
         addNode( nodes[ i ]->layoutPosition,
-                 nodes[ i ]->localTimeFraction,
+                 nodeScale( nodes[ i ] ),
                  //nodes[ i ]->callsFraction,
-                 aScale,
-                 1.0f,
-                 nodes[ i ]->textSymbol, textColour,
+                 nodeColour( g, nodes[ i ], aScale ),
+                 colourByCpu || colourByCounter >= 0 ? aScale : 1.0f,
+                 nodeLabel( nodes[ i ] ), textColour,
                  nodes[ i ]->active ? true : false, colour
                );
       }
@@ -221,7 +356,7 @@ void renderScene( graph_t *g )
         
         positionCamera( );
         addRecursiveEdge( edges[ i ]->from->layoutPosition, dir,
-                          edges[ i ]->from->localTimeFraction,
+                          nodeScale( edges[ i ]->from ),
                           0.1f,
                           /*edges[ i ]->callsFraction,*/
                           aScale,
@@ -237,7 +372,7 @@ void renderScene( graph_t *g )
                       dir );
 
       edgeLength = VectorNormalise( dir ) -
-                   nodeScaleToSize( edges[ i ]->to->localTimeFraction );
+                   nodeScaleToSize( nodeScale( edges[ i ]->to ) );
 
       VectorSubtract( camera.origin, edges[ i ]->from->layoutPosition,
                       dirToPos );
@@ -313,6 +448,42 @@ boolean GLfrontend( graph_t *g )
             quit = true;
             break;
 
+          case SDLK_c:
+            colourByCpu = !colourByCpu;
+            colourByCounter = -1;
+            break;
+
+          case SDLK_k:
+            if( ++colourByCounter == NUM_COUNTERS )
+              colourByCounter = -1;
+
+            colourByCpu = false;
+            break;
+
+          case SDLK_p:
+            sizeByCpu = !sizeByCpu;
+            sizeByHeap = sizeByLocks = sizeByIo = false;
+            break;
+
+          case SDLK_h:
+            sizeByHeap = !sizeByHeap;
+            sizeByCpu = sizeByLocks = sizeByIo = false;
+            break;
+
+          case SDLK_l:
+            sizeByLocks = !sizeByLocks;
+            sizeByCpu = sizeByHeap = sizeByIo = false;
+            break;
+
+          case SDLK_i:
+            sizeByIo = !sizeByIo;
+            sizeByCpu = sizeByHeap = sizeByLocks = false;
+            break;
+
+          case SDLK_t:
+            showThreads = !showThreads;
+            break;
+
           default:
             break;
         }
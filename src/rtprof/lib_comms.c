@@ -18,6 +18,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
@@ -26,17 +27,22 @@
 #include <sys/types.h>
 #include <netdb.h>
 #include <sys/time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <signal.h>
+#include <poll.h>
 #include <assert.h>
+#include <limits.h>
 
 #include "com_common.h"
+#include "com_protocol.h"
+#include "com_compress.h"
 #include "adt_graph.h"
 #include "adt_stack.h"
+#include "adt_symbol.h"
 #include "term_output.h"
 #include "lib_comms.h"
 
-//server socket
-static int serverSocket;
-
 /*
 ===============
 getusecs
@@ -84,7 +90,7 @@ static int listenOnFile( char *file )
     return -1;
   }
   
-  listen( s, 1 );
+  listen( s, LISTEN_BACKLOG );
   return s;
 }
 
@@ -140,260 +146,2030 @@ static int listenOnPort( int port )
     return -1;
   }
   
-  listen( s, 1 );
+  listen( s, LISTEN_BACKLOG );
   return s;
 }
 
 /*
 ===============
-acceptConnection
+newConnection
 
-Accept a connection from a client
+Allocate and initialise a connection_t
 ===============
 */
-int acceptConnection( int type, char *socketFile )
+static connection_t *newConnection( connectionType_t type )
 {
-  int connection;
-  int flags;
-  
+  connection_t *c;
+
+  if( ( c = (connection_t *)malloc( sizeof( connection_t ) ) ) == NULL )
+    return NULL;
+
+  c->type = type;
+  c->socket = -1;
+
+  c->shm = NULL;
+  c->shmData = NULL;
+  c->shmHead = c->shmTail = 0;
+
+  c->trace = NULL;
+  c->traceData = NULL;
+  c->traceSize = c->traceHead = c->traceTail = 0;
+  c->realtime = c->replayStarted = false;
+  c->replayStart = c->traceStart = 0;
+
+  c->version = 1;
+  c->capabilities = 0;
+  c->pointerSize = sizeof( void * );
+  c->clockRate = LEGACY_CLOCK_RATE;
+  c->pid = 0;
+  c->overhead = c->cpuOverhead = 0;
+  c->backlog = false;
+
+  c->numFunctions = 0;
+  c->functions = NULL;
+  c->numCounters = 0;
+  c->counters = NULL;
+
+  c->tid = 0;
+  c->stack = c->ownStack = NULL;
+  c->thread = NULL;
+  initThreadStacks( &c->stacks );
+
+  c->bufferStart = c->bufferEnd = 0;
+
+  c->block = NULL;
+  c->blockStart = c->blockEnd = 0;
+  c->inBlock = false;
+
+  return c;
+}
+
+/*
+===============
+listenForConnections
+
+Start listening for clients on a socket
+===============
+*/
+listener_t *listenForConnections( int type, char *socketFile )
+{
+  listener_t  *l;
+  int         s;
+
   if( type == AF_INET )
   {
-    if( ( serverSocket = listenOnPort( RTPROF_PORT ) ) < 0 )
-      return -1;
+    if( ( s = listenOnPort( RTPROF_PORT ) ) < 0 )
+      return NULL;
   }
   else if( type == AF_UNIX && socketFile )
   {
-    if( ( serverSocket = listenOnFile( socketFile ) ) < 0 )
-     return -1;
+    if( ( s = listenOnFile( socketFile ) ) < 0 )
+     return NULL;
   }
   else
-    return -1;
+    return NULL;
 
-  if( ( connection = accept( serverSocket, 0, 0 ) ) < 0 )
-    return -1;
+  if( ( l = (listener_t *)calloc( 1, sizeof( listener_t ) ) ) == NULL )
+  {
+    close( s );
+    return NULL;
+  }
 
-  return connection;
+  l->type = CT_SOCKET;
+  l->socket = s;
+
+  return l;
 }
 
+/*
+===============
+createShmRing
 
-#define SFE sizeof(functionEvent_t)
+Put up an empty shared memory ring for the next client to claim
+===============
+*/
+static boolean createShmRing( listener_t *l )
+{
+  unsigned char *base;
+  shmHeader_t   *header;
+  int           fd;
+
+  shm_unlink( l->name );
+
+  if( ( fd = shm_open( l->name, O_RDWR | O_CREAT | O_EXCL, 0600 ) ) < 0 )
+  {
+    fprintf( stderr, "shm_open < 0 errno: %s\n", strerror( errno ) );
+    return false;
+  }
+
+  if( ftruncate( fd, SHM_HEADER_SIZE + SHM_RING_SIZE ) < 0 ||
+      ( base = mapShmRing( fd, SHM_RING_SIZE ) ) == NULL )
+  {
+    fprintf( stderr, "shm map failed errno: %s\n", strerror( errno ) );
+    close( fd );
+    shm_unlink( l->name );
+    return false;
+  }
+
+  //the mapping keeps the object alive
+  close( fd );
+
+  header = (shmHeader_t *)base;
+  header->version = PROTOCOL_VERSION;
+  header->capabilities = SERVER_CAPABILITIES;
+  header->size = SHM_RING_SIZE;
+  header->readerPid = getpid( );
+  header->writerPid = 0;
+  header->readerWaiting = 0;
+  header->wakeCount = 0;
+  header->head = header->tail = 0;
+  header->controlHead = header->controlTail = 0;
+  __atomic_store_n( &header->magic, SHM_MAGIC, __ATOMIC_RELEASE );
+
+  l->shm = header;
+
+  return true;
+}
 
 /*
 ===============
-readFromConnection
+listenForShmConnections
 
-Make a nonblocking read from connection to fe
+Start offering shared memory rings to clients
 ===============
 */
-static int readFromConnection( int connection, int size, functionEvent_t *fe )
+listener_t *listenForShmConnections( char *name )
 {
-  int count;
-  
-  count = recv( connection, ( (unsigned char *)fe ) + size, SFE - size, MSG_DONTWAIT );
+  listener_t *l;
 
-  if( count > 0 )
-    size += count;
-  
-  return size;
+  if( ( l = (listener_t *)calloc( 1, sizeof( listener_t ) ) ) == NULL )
+    return NULL;
+
+  l->type = CT_SHM;
+  l->socket = -1;
+  snprintf( l->name, sizeof( l->name ), "/%s", name );
+
+  if( !createShmRing( l ) )
+  {
+    free( l );
+    return NULL;
+  }
+
+  return l;
+}
+
+/*
+===============
+closeListener
+
+Stop accepting clients
+===============
+*/
+void closeListener( listener_t *l )
+{
+  if( l->socket >= 0 )
+    close( l->socket );
+
+  if( l->shm != NULL )
+  {
+    shm_unlink( l->name );
+    unmapShmRing( (unsigned char *)l->shm, SHM_RING_SIZE );
+  }
+
+  free( l );
 }
 
+/*
+===============
+acceptConnection
+
+Wait up to msec milliseconds (forever if negative) for a new client
+Returns NULL if none turned up
+===============
+*/
+connection_t *acceptConnection( listener_t *l, int msec )
+{
+  connection_t  *c;
+  struct pollfd pfd;
+  shmHeader_t   *header;
+  int           s, waited = 0;
+
+  if( l->type == CT_SHM )
+  {
+    header = l->shm;
+
+    //wait for a writer
+    while( header != NULL &&
+           __atomic_load_n( &header->writerPid, __ATOMIC_ACQUIRE ) == 0 )
+    {
+      if( msec >= 0 && waited >= msec )
+        return NULL;
+
+      usleep( SHM_ACCEPT_MSEC * 1000 );
+      waited += SHM_ACCEPT_MSEC;
+    }
+
+    if( header == NULL || ( c = newConnection( CT_SHM ) ) == NULL )
+      return NULL;
+
+    c->shm = header;
+    c->shmData = (unsigned char *)header + SHM_HEADER_SIZE;
+
+    //there's no way to reply on this transport, so the ring header told
+    //the client what we understand and it will start with a REC_HELLO
+    c->version = PROTOCOL_VERSION;
+
+    //the next client gets a ring of its own under the same name
+    l->shm = NULL;
+    createShmRing( l );
+
+    return c;
+  }
+
+  pfd.fd = l->socket;
+  pfd.events = POLLIN;
+
+  if( poll( &pfd, 1, msec ) <= 0 )
+    return NULL;
+
+  if( ( s = accept( l->socket, 0, 0 ) ) < 0 )
+    return NULL;
+
+  if( ( c = newConnection( CT_SOCKET ) ) == NULL )
+  {
+    close( s );
+    return NULL;
+  }
+
+  c->socket = s;
+
+  return c;
+}
 
 /*
 ===============
-serviceConnection
+openReplay
 
-Function to service a librtprof connection
-maxEvents is the maximum number of events to read this call
+Open a trace file written by a client for replaying
 ===============
 */
-boolean serviceConnection( int connection, callStack_t *s,
-                           graph_t *g, int maxEvents )
+connection_t *openReplay( char *path, boolean realtime )
 {
-  static functionEvent_t fe;
-  static int             size = 0;
-  
-  boolean         clientConnected = true;
-  graphNode_t     *parent, *child;
-  graphEdge_t     *edge;
-  void            *parentSymbol;
-  stackFrame_t    sf, *sfp;
-  timeStamp_t     ts, delta;
-  int             count = 0;
-  int             eventCount = 0;
-
-  graphNode_t     **nodes;
-  graphEdge_t     **edges;
-  int             numNodes, numEdges;
-  int             i;
-  
-  //while there are events to be processed read from the socket
-  while( ( size = readFromConnection( connection, size, &fe ) ) == SFE &&
-         eventCount++ < maxEvents )
+  connection_t  *c;
+  traceHeader_t *header;
+  struct stat   st;
+  int           fd;
+
+  if( ( fd = open( path, O_RDONLY ) ) < 0 )
+  {
+    fprintf( stderr, "open %s errno: %s\n", path, strerror( errno ) );
+    return NULL;
+  }
+
+  if( fstat( fd, &st ) < 0 || st.st_size < TRACE_HEADER_SIZE )
+  {
+    fprintf( stderr, "%s is not a trace file\n", path );
+    close( fd );
+    return NULL;
+  }
+
+  header = (traceHeader_t *)mmap( NULL, st.st_size, PROT_READ, MAP_SHARED,
+                                  fd, 0 );
+  close( fd );
+
+  if( header == MAP_FAILED )
+  {
+    fprintf( stderr, "mmap %s errno: %s\n", path, strerror( errno ) );
+    return NULL;
+  }
+
+  if( header->magic != TRACE_MAGIC || header->version < 2 ||
+      ( c = newConnection( CT_TRACE ) ) == NULL )
   {
-    child = parent = NULL;
-    parentSymbol = NULL;
+    fprintf( stderr, "%s is not a trace file\n", path );
+    munmap( header, st.st_size );
+    return NULL;
+  }
+
+  madvise( header, st.st_size, MADV_SEQUENTIAL );
+
+  c->trace = header;
+  c->traceData = (unsigned char *)header + TRACE_HEADER_SIZE;
+  c->traceSize = st.st_size - TRACE_HEADER_SIZE;
+  c->realtime = realtime;
+
+  //like shm, the stream starts with a REC_HELLO
+  c->version = header->version;
+
+  return c;
+}
+
+/*
+===============
+closeConnection
+
+Close a connection and free it
+===============
+*/
+void closeConnection( connection_t *c )
+{
+  if( c->socket >= 0 )
+    close( c->socket );
+
+  if( c->shm != NULL )
+    unmapShmRing( (unsigned char *)c->shm, SHM_RING_SIZE );
 
-    assert( size == SFE );
-    size = 0;
+  if( c->trace != NULL )
+    munmap( c->trace, TRACE_HEADER_SIZE + c->traceSize );
 
-    //deal with the event
-    switch( fe.type )
+  shutdownThreadStacks( &c->stacks );
+  free( c->functions );
+  free( c->counters );
+  free( c->block );
+  free( c );
+}
+
+
+/*
+===============
+ticksToNsecs
+
+Convert a client timestamp to nanoseconds
+===============
+*/
+static timeStamp_t ticksToNsecs( timeStamp_t ticks, timeStamp_t rate )
+{
+  //split to avoid overflowing 64 bits
+  return ( ticks / rate ) * 1000000000ULL +
+         ( ( ticks % rate ) * 1000000000ULL ) / rate;
+}
+
+
+/*
+===============
+readFromTrace
+
+readFromConnection for CT_TRACE
+When replaying in real time, records are let through one at a time once
+the replay has caught up with their timestamps
+===============
+*/
+static int readFromTrace( connection_t *c )
+{
+  unsigned long long  length, tid, ts, size;
+  const unsigned char *p, *end;
+  timeStamp_t         due;
+
+  length = c->trace->length;
+
+  //a client that died mid-write may have left the length past the data
+  if( length > c->traceSize )
+    length = c->traceSize;
+
+  if( c->traceHead >= length )
+    return -1;
+
+  end = c->traceData + length;
+
+  if( c->realtime )
+  {
+    p = c->traceData + c->traceHead + 1;
+
+    if( !readVarint( &p, end, &size ) || end - p < size )
+      size = end - ( c->traceData + c->traceHead );
+    else
     {
-      case EV_ENTER:
-          
-        if( !emptyStack( s ) )
-        {
-          sfp = peekStack( s );
-          
-          if( ( parent = searchNodes( sfp->symbol, NULL, g ) ) != NULL )
-          {
-            delta = ( fe.ts - sfp->calleeExitTime );
-            
-            parent->totalTime += delta;
-            if( parent->totalTime > g->maxTotalTime )
-              g->maxTotalTime = parent->totalTime;
-            
-            g->totalTotalTime += delta;
-            
-            parent->localTime += delta;
-            if( parent->localTime > g->maxLocalTime )
-              g->maxLocalTime = parent->localTime;
-
-            g->totalLocalTime += delta;
-          }
-
-          sfp->calleeEntryTime = fe.ts;
-          
-          parentSymbol = sfp->symbol;
-        }
-        
-        sf.symbol = fe.this_fn;
-        sf.calleeExitTime = fe.ts;   
-        pushStack( sf, s );
-       
-        if( ( child = searchNodes( sf.symbol, parentSymbol, g ) ) != NULL )
-        {
-          g->totalCalls++;
-
-          child->calls++;
-          child->active = true;
-          child->lastActive = getusecs( );
-
-          if( child->calls > g->maxNodeCalls )
-            g->maxNodeCalls = child->calls;
-
-          if( parent != NULL )
-          {
-            edge = searchEdges( parent, child, g );
-            edge->calls++;
-            edge->active = true;
-            edge->lastActive = child->lastActive;
-            
-            if( edge->calls > g->maxEdgeCalls )
-              g->maxEdgeCalls = edge->calls;
-          }
-        }
-        break;
+      size += p - ( c->traceData + c->traceHead );
 
-      case EV_EXIT:
-        
-        if( !emptyStack( s ) )
+      if( c->traceData[ c->traceHead ] == REC_BATCH &&
+          readVarint( &p, end, &tid ) && readVarint( &p, end, &ts ) )
+      {
+        due = ticksToNsecs( ts, c->clockRate ) / 1000;
+
+        if( !c->replayStarted )
         {
-          sf = popStack( s );
-          
-          if( ( child = searchNodes( sf.symbol, NULL, g ) ) != NULL )
-          {
-            delta = ( fe.ts - sf.calleeExitTime );
-            
-            child->totalTime += delta;
-            if( child->totalTime > g->maxTotalTime )
-              g->maxTotalTime = child->totalTime;
-            
-            g->totalTotalTime += delta;
-            
-            child->localTime += delta;
-            if( child->localTime > g->maxLocalTime )
-              g->maxLocalTime = child->localTime;
-
-            g->totalLocalTime += delta;
-            
-            child->active = false;
-            child->lastActive = getusecs( );
-          }
-          
-          if( !emptyStack( s ) )
-          {
-            sfp = peekStack( s );
-            
-            if( ( parent = searchNodes( sfp->symbol, NULL, g ) ) != NULL )
-            {
-              delta = ( fe.ts - sfp->calleeEntryTime );
-            
-              parent->totalTime += delta;
-              if( parent->totalTime > g->maxTotalTime )
-                g->maxTotalTime = parent->totalTime;
-              
-              g->totalTotalTime += delta;
-              
-              edge = searchEdges( parent, child, g );
-              edge->active = false;
-              edge->lastActive = getusecs( );
-            }
-            
-            sfp->calleeExitTime = fe.ts;
-          }
+          c->replayStart = getusecs( );
+          c->traceStart = due;
+          c->replayStarted = true;
         }
 
-        break;
+        if( due > c->traceStart &&
+            getusecs( ) - c->replayStart < due - c->traceStart )
+          return 0;
+      }
+    }
 
-      case EV_PROCEXIT:
-        close( connection );
-        close( serverSocket );
-        clientConnected = false;
-        break;
+    c->traceHead += size;
+    return (int)size;
+  }
 
-      default:
-        break;
+  //everything at once, as a bounded chunk so the count fits in an int
+  size = length - c->traceHead;
+
+  if( size > MAX_RECORD_BODY )
+    size = MAX_RECORD_BODY;
+
+  c->traceHead += size;
+  return (int)size;
+}
+
+/*
+===============
+readFromConnection
+
+Make a nonblocking read from the client
+Returns the number of new bytes, 0 if none were waiting or -1 if
+the client has gone away
+===============
+*/
+static int readFromConnection( connection_t *c )
+{
+  unsigned long long  head;
+  int                 count;
+
+  if( c->type == CT_SHM )
+  {
+    head = __atomic_load_n( &c->shm->head, __ATOMIC_ACQUIRE );
+
+    if( head != c->shmHead )
+    {
+      count = (int)( head - c->shmHead );
+      c->shmHead = head;
+      return count;
     }
+
+    //a client that died without saying goodbye
+    if( kill( c->shm->writerPid, 0 ) < 0 && errno == ESRCH )
+      return -1;
+
+    return 0;
   }
+  else if( c->type == CT_TRACE )
+    return readFromTrace( c );
 
-  ts = getusecs( );
-  
-  nodes = listNodes( SF_NONE, &numNodes, g );
-  edges = listEdges( &numEdges, g );
+  //shuffle any partial record down to make room
+  if( c->bufferStart == c->bufferEnd )
+    c->bufferStart = c->bufferEnd = 0;
+  else if( c->bufferStart > 0 && c->bufferEnd == RECV_BUFFER )
+  {
+    memmove( c->buffer, c->buffer + c->bufferStart,
+             c->bufferEnd - c->bufferStart );
+    c->bufferEnd -= c->bufferStart;
+    c->bufferStart = 0;
+  }
+
+  count = recv( c->socket, c->buffer + c->bufferEnd,
+                RECV_BUFFER - c->bufferEnd, MSG_DONTWAIT );
+
+  if( count > 0 )
+  {
+    c->bufferEnd += count;
+    return count;
+  }
+  else if( count < 0 && ( errno == EAGAIN || errno == EINTR ) )
+    return 0;
+
+  return -1;
+}
 
-  g->maxInactiveTime = 0;
+/*
+===============
+peekConnection
 
-  for( i = 0; i < numNodes; i++ )
+Point *data at the unprocessed bytes and return how many there are
+===============
+*/
+static int peekConnection( connection_t *c, const unsigned char **data )
+{
+  if( ( c->inBlock = ( c->blockStart < c->blockEnd ) ) )
+  {
+    *data = c->block + c->blockStart;
+    return c->blockEnd - c->blockStart;
+  }
+  else if( c->type == CT_SHM )
+  {
+    //the ring is mapped twice so this never needs to wrap
+    *data = c->shmData + ( c->shmTail & ( c->shm->size - 1 ) );
+    return (int)( c->shmHead - c->shmTail );
+  }
+  else if( c->type == CT_TRACE )
   {
-    nodes[ i ]->inactiveTime = ts - nodes[ i ]->lastActive;
+    *data = c->traceData + c->traceTail;
+    return (int)( c->traceHead - c->traceTail );
+  }
 
-    if( nodes[ i ]->inactiveTime > g->maxInactiveTime )
-      g->maxInactiveTime = nodes[ i ]->inactiveTime;
+  *data = c->buffer + c->bufferStart;
+  return c->bufferEnd - c->bufferStart;
+}
 
-    nodes[ i ]->localTimeFraction = (float)nodes[ i ]->localTime /
-                                    (float)g->totalLocalTime;
-    
-    nodes[ i ]->totalTimeFraction = (float)nodes[ i ]->totalTime /
-                                    (float)g->totalTotalTime;
-    
-    nodes[ i ]->callsFraction = (float)nodes[ i ]->calls /
-                                (float)g->totalCalls;
+/*
+===============
+consumeConnection
+
+Mark bytes returned by peekConnection as processed
+===============
+*/
+static void consumeConnection( connection_t *c, int used )
+{
+  if( c->inBlock )
+    c->blockStart += used;
+  else if( c->type == CT_SHM )
+  {
+    c->shmTail += used;
+    __atomic_store_n( &c->shm->tail, c->shmTail, __ATOMIC_RELEASE );
+  }
+  else if( c->type == CT_TRACE )
+    c->traceTail += used;
+  else
+    c->bufferStart += used;
+}
+
+/*
+===============
+sendControl
+
+Send a control message to the client
+Returns false if the client can't take it
+===============
+*/
+boolean sendControl( connection_t *c, control_t type,
+                     unsigned long long start, unsigned long long end )
+{
+  controlMessage_t  msg;
+  unsigned int      head;
+
+  if( !( c->capabilities & CAP_CONTROL ) )
+    return false;
+
+  msg.type = type;
+  msg.reserved = 0;
+  msg.start = start;
+  msg.end = end;
+
+  if( c->type == CT_SHM )
+  {
+    head = c->shm->controlHead;
+
+    if( head - __atomic_load_n( &c->shm->controlTail, __ATOMIC_ACQUIRE ) >=
+        SHM_CONTROL_SLOTS )
+      return false;
+
+    c->shm->control[ head & ( SHM_CONTROL_SLOTS - 1 ) ] = msg;
+    __atomic_store_n( &c->shm->controlHead, head + 1, __ATOMIC_RELEASE );
+
+    return true;
   }
 
-  for( i = 0; i < numEdges; i++ )
+  return (boolean)( c->socket >= 0 &&
+                    send( c->socket, &msg, sizeof( controlMessage_t ),
+                          MSG_NOSIGNAL ) == sizeof( controlMessage_t ) );
+}
+
+/*
+===============
+waitForConnection
+
+Sleep until the client has sent something or msec have passed
+===============
+*/
+void waitForConnection( connection_t *c, int msec )
+{
+  struct pollfd pfd;
+  unsigned int  wakeCount;
+
+  if( c->backlog )
+    return;
+
+  if( c->type == CT_SHM )
   {
-    edges[ i ]->inactiveTime = ts - edges[ i ]->lastActive;
+    wakeCount = c->shm->wakeCount;
+    c->shm->readerWaiting = 1;
 
-    if( edges[ i ]->inactiveTime > g->maxInactiveTime )
-      g->maxInactiveTime = edges[ i ]->inactiveTime;
-    
-    edges[ i ]->callsFraction = (float)edges[ i ]->calls /
-                                (float)g->totalCalls;
+    //pairs with the fence in the client's commitShm
+    __atomic_thread_fence( __ATOMIC_SEQ_CST );
+
+    if( __atomic_load_n( &c->shm->head, __ATOMIC_ACQUIRE ) == c->shmTail )
+      futexWait( &c->shm->wakeCount, wakeCount, msec );
+
+    c->shm->readerWaiting = 0;
   }
-  
-  free( edges );
-  free( nodes );
+  else if( c->type == CT_TRACE )
+  {
+    //only a real time replay ever has to wait
+    usleep( ( msec < 1 ? msec : 1 ) * 1000 );
+  }
+  else if( c->socket >= 0 )
+  {
+    pfd.fd = c->socket;
+    pfd.events = POLLIN;
+
+    poll( &pfd, 1, msec );
+  }
+}
+
+
+/*
+===============
+waitForConnections
+
+Sleep until any of n clients has sent something, a new client is
+waiting on l (which may be NULL) or msec have passed
+===============
+*/
+void waitForConnections( listener_t *l, connection_t **c, int n, int msec )
+{
+  struct pollfd pfd[ MAX_WAIT_FDS ];
+  int           i, numFds = 0;
+  boolean       sockets = true;
+
+  for( i = 0; i < n; i++ )
+  {
+    if( c[ i ]->backlog )
+      return;
+
+    if( c[ i ]->type != CT_SOCKET )
+      sockets = false;
+  }
+
+  //the common case of a single client, with nobody else to notice
+  if( n == 1 && ( l == NULL || l->type == CT_SHM ) )
+  {
+    waitForConnection( c[ 0 ], l == NULL ? msec :
+                       ( msec < SHM_ACCEPT_MSEC ? msec : SHM_ACCEPT_MSEC ) );
+    return;
+  }
+
+  if( !sockets || ( l != NULL && l->type != CT_SOCKET ) || n >= MAX_WAIT_FDS )
+  {
+    //nothing to poll on; shared memory clients are checked periodically
+    usleep( ( msec < SHM_ACCEPT_MSEC ? msec : SHM_ACCEPT_MSEC ) * 1000 );
+    return;
+  }
+
+  for( i = 0; i < n; i++ )
+  {
+    if( c[ i ]->socket >= 0 )
+    {
+      pfd[ numFds ].fd = c[ i ]->socket;
+      pfd[ numFds++ ].events = POLLIN;
+    }
+  }
+
+  if( l != NULL )
+  {
+    pfd[ numFds ].fd = l->socket;
+    pfd[ numFds++ ].events = POLLIN;
+  }
+
+  poll( pfd, numFds, msec );
+}
+
+
+/*
+===============
+switchThread
+
+Direct subsequent events to the stack of another client thread
+Returns false for a thread id too big to keep a stack or totals for
+===============
+*/
+static boolean switchThread( connection_t *c, graph_t *g, unsigned int tid )
+{
+  callStack_t   *s;
+  graphThread_t *thread;
+
+  if( c->stack != NULL && tid == c->tid )
+    return true;
+
+  if( ( s = threadStack( tid, &c->stacks ) ) == NULL ||
+      ( thread = searchThreads( tid, g ) ) == NULL )
+    return false;
+
+  c->tid = tid;
+  c->ownStack = s;
+  c->stack = ( s->running != NULL ) ? s->running : s;
+  c->thread = thread;
+
+  return true;
+}
+
+
+/*
+===============
+retireThread
+
+Deal with a REC_RETIRE body; the id's next thread starts from nothing
+===============
+*/
+static boolean retireThread( connection_t *c, graph_t *g,
+                             const unsigned char *p, const unsigned char *end )
+{
+  unsigned long long  tid;
+  callStack_t         *s;
+
+  if( !readVarint( &p, end, &tid ) || tid >= MAX_THREADS )
+    return false;
+
+  if( tid < c->stacks.numStacks &&
+      ( s = c->stacks.stacks[ tid ] ) != NULL )
+  {
+    //the next batch switches to whichever thread it is for afresh
+    if( s == c->ownStack )
+      c->stack = c->ownStack = NULL;
+    else if( s == c->stack )
+      c->stack = c->ownStack;
+  }
+
+  retireStack( (unsigned int)tid, &c->stacks );
+
+  if( tid < g->numThreads )
+    memset( &g->threads[ tid ], 0, sizeof( graphThread_t ) );
+
+  return true;
+}
+
+
+/*
+===============
+settleOwed
+
+Pay off as much as possible of what a node owes from some local time
+about to be added to it, returning what is left to add
+===============
+*/
+static timeStamp_t settleOwed( timeStamp_t *owed, timeStamp_t local )
+{
+  timeStamp_t paid = *owed < local ? *owed : local;
+
+  *owed -= paid;
+
+  return local - paid;
+}
+
+
+/*
+===============
+addCpuTime
+
+Charge cpu time to a node, as enterFunction and exitFunction charge
+wall time
+===============
+*/
+static void addCpuTime( graph_t *g, graphThread_t *thread, graphNode_t *node,
+                        timeStamp_t local, timeStamp_t total )
+{
+  local = settleOwed( &node->localCpuTimeOwed, local );
+
+  node->totalCpuTime += total;
+  if( node->totalCpuTime > g->maxTotalCpuTime )
+    g->maxTotalCpuTime = node->totalCpuTime;
+
+  node->localCpuTime += local;
+  if( node->localCpuTime > g->maxLocalCpuTime )
+    g->maxLocalCpuTime = node->localCpuTime;
+
+  g->totalTotalCpuTime += total;
+  g->totalLocalCpuTime += local;
+
+  thread->totalCpuTime += total;
+  thread->localCpuTime += local;
+}
+
+
+/*
+===============
+countsBetween
+
+Work out how much each counter went up between two readings
+===============
+*/
+static void countsBetween( unsigned long long *delta,
+                           const unsigned long long *start,
+                           const unsigned long long *end )
+{
+  int i;
+
+  for( i = 0; i < NUM_COUNTERS; i++ )
+    delta[ i ] = end[ i ] - start[ i ];
+}
+
+
+/*
+===============
+addCounts
+
+Charge counts to a node, as addCpuTime charges cpu time; local may be
+NULL when none of them are local
+===============
+*/
+static void addCounts( graph_t *g, graphNode_t *node,
+                       const unsigned long long *local,
+                       const unsigned long long *total )
+{
+  unsigned long long  delta;
+  int                 i;
+
+  for( i = 0; i < NUM_COUNTERS; i++ )
+  {
+    node->totalCounts[ i ] += total[ i ];
+
+    if( local == NULL )
+      continue;
+
+    delta = settleOwed( &node->localCountsOwed[ i ], local[ i ] );
+
+    node->localCounts[ i ] += delta;
+    if( node->localCounts[ i ] > g->maxLocalCounts[ i ] )
+      g->maxLocalCounts[ i ] = node->localCounts[ i ];
+
+    g->totalLocalCounts[ i ] += delta;
+  }
+}
+
+
+/*
+===============
+pauseCaller
+
+Charge the function in a frame for the time up to ts, as it stops
+running to call something or to be switched away from
+===============
+*/
+static void pauseCaller( connection_t *c, graph_t *g, stackFrame_t *sfp,
+                         timeStamp_t ts, timeStamp_t cpu,
+                         const unsigned long long *counts )
+{
+  graphThread_t       *thread = c->thread;
+  graphNode_t         *parent;
+  timeStamp_t         delta;
+  unsigned long long  counted[ NUM_COUNTERS ];
+
+  if( ( parent = sfp->node ) != NULL )
+  {
+    delta = ( ts - sfp->calleeExitTime );
+    
+    parent->totalTime += delta;
+    if( parent->totalTime > g->maxTotalTime )
+      g->maxTotalTime = parent->totalTime;
+    
+    g->totalTotalTime += delta;
+    thread->totalTime += delta;
+
+    delta = settleOwed( &parent->localTimeOwed, delta );
+    
+    parent->localTime += delta;
+    if( parent->localTime > g->maxLocalTime )
+      g->maxLocalTime = parent->localTime;
+
+    g->totalLocalTime += delta;
+    thread->localTime += delta;
+
+    delta = ( cpu - sfp->calleeExitCpu );
+    addCpuTime( g, thread, parent, delta, delta );
+
+    countsBetween( counted, sfp->calleeExitCounts, counts );
+    addCounts( g, parent, counted, counted );
+  }
+
+  sfp->calleeEntryTime = ts;
+  sfp->calleeEntryCpu = cpu;
+  memcpy( sfp->calleeEntryCounts, counts, sizeof( sfp->calleeEntryCounts ) );
+}
+
+
+/*
+===============
+enterFunction
+
+Account for a function entry event
+node is this_fn's node if the caller already knows it, otherwise NULL;
+likewise callSite for the return address it was called from
+Returns this_fn's node
+===============
+*/
+static graphNode_t *enterFunction( connection_t *c, graph_t *g,
+                                   void *this_fn, graphNode_t *node,
+                                   void *callSite, timeStamp_t ts,
+                                   timeStamp_t cpu,
+                                   const unsigned long long *counts )
+{
+  callStack_t         *s = c->stack;
+  graphThread_t       *thread = c->thread;
+  graphNode_t         *parent = NULL, *child;
+  graphEdge_t         *edge;
+  void                *parentSymbol = NULL;
+  stackFrame_t        sf, *sfp;
+
+  if( !emptyStack( s ) )
+  {
+    sfp = peekStack( s );
+    pauseCaller( c, g, sfp, ts, cpu, counts );
+
+    parent = sfp->node;
+    parentSymbol = sfp->symbol;
+  }
+  
+  if( ( child = node ) == NULL )
+    child = searchNodes( this_fn, parentSymbol, g );
+
+  sf.symbol = this_fn;
+  sf.node = child;
+  sf.callSite = callSite;
+  sf.calleeExitTime = ts;   
+  sf.calleeExitCpu = cpu;
+  memcpy( sf.calleeExitCounts, counts, sizeof( sf.calleeExitCounts ) );
+  pushStack( sf, s );
+ 
+  if( child != NULL )
+  {
+    g->totalCalls++;
+    thread->calls++;
+
+    child->calls++;
+    child->active = true;
+    child->lastActive = getusecs( );
+
+    if( child->calls > g->maxNodeCalls )
+      g->maxNodeCalls = child->calls;
+
+    if( parent != NULL )
+    {
+      //a call site's edge, then the edge for them all
+      for( edge = searchEdges( parent, child, callSite, g ); edge != NULL;
+           edge = edge->collapsed )
+      {
+        edge->calls++;
+        edge->active = true;
+        edge->lastActive = child->lastActive;
+      
+        if( edge->calls > g->maxEdgeCalls )
+          g->maxEdgeCalls = edge->calls;
+      }
+    }
+  }
+
+  return child;
+}
+
+
+/*
+===============
+exitFunction
+
+Account for a function exit event
+===============
+*/
+static void exitFunction( connection_t *c, graph_t *g, timeStamp_t ts,
+                          timeStamp_t cpu, const unsigned long long *counts )
+{
+  callStack_t         *s = c->stack;
+  graphThread_t       *thread = c->thread;
+  graphNode_t         *parent, *child;
+  graphEdge_t         *edge;
+  stackFrame_t        sf, *sfp;
+  timeStamp_t         delta;
+  unsigned long long  counted[ NUM_COUNTERS ];
+  int                 i;
+
+  if( emptyStack( s ) )
+    return;
+
+  sf = popStack( s );
+  
+  if( ( child = sf.node ) != NULL )
+  {
+    delta = ( ts - sf.calleeExitTime );
+    
+    child->totalTime += delta;
+    if( child->totalTime > g->maxTotalTime )
+      g->maxTotalTime = child->totalTime;
+    
+    g->totalTotalTime += delta;
+    thread->totalTime += delta;
+
+    delta = settleOwed( &child->localTimeOwed, delta );
+    
+    child->localTime += delta;
+    if( child->localTime > g->maxLocalTime )
+      g->maxLocalTime = child->localTime;
+
+    g->totalLocalTime += delta;
+    thread->localTime += delta;
+
+    delta = ( cpu - sf.calleeExitCpu );
+    addCpuTime( g, thread, child, delta, delta );
+
+    countsBetween( counted, sf.calleeExitCounts, counts );
+    addCounts( g, child, counted, counted );
+    
+    child->active = false;
+    child->lastActive = getusecs( );
+  }
+  
+  if( !emptyStack( s ) )
+  {
+    sfp = peekStack( s );
+    
+    if( ( parent = sfp->node ) != NULL )
+    {
+      delta = ( ts - sfp->calleeEntryTime );
+    
+      parent->totalTime += delta;
+      if( parent->totalTime > g->maxTotalTime )
+        g->maxTotalTime = parent->totalTime;
+      
+      g->totalTotalTime += delta;
+      thread->totalTime += delta;
+
+      addCpuTime( g, thread, parent, 0, cpu - sfp->calleeEntryCpu );
+
+      countsBetween( counted, sfp->calleeEntryCounts, counts );
+      addCounts( g, parent, NULL, counted );
+      
+      for( edge = searchEdges( parent, child, sf.callSite, g ); edge != NULL;
+           edge = edge->collapsed )
+      {
+        edge->active = false;
+        edge->lastActive = getusecs( );
+
+        for( i = 0; i < NUM_COUNTERS; i++ )
+          edge->counts[ i ] += counted[ i ];
+      }
+    }
+    
+    sfp->calleeExitTime = ts;
+    sfp->calleeExitCpu = cpu;
+    memcpy( sfp->calleeExitCounts, counts, sizeof( sfp->calleeExitCounts ) );
+  }
+}
+
+
+/*
+===============
+switchStack
+
+Account for a client thread switching to running another stack of calls,
+given as in an EV_THREAD in a REC_BATCH. What was running is charged up
+to ts, and the frames on the stack switched to take up where they left
+off, so nothing is charged for the time in between
+Returns false for a stack id too big to keep a stack for
+===============
+*/
+static boolean switchStack( connection_t *c, graph_t *g,
+                            unsigned long long id, timeStamp_t ts,
+                            timeStamp_t cpu, const unsigned long long *counts )
+{
+  callStack_t   *from = c->stack, *to = c->ownStack;
+  stackFrame_t  *sfp;
+  int           i;
+
+  if( id > MAX_THREADS ||
+      ( id > 0 && ( to = threadStack( (unsigned int)( id - 1 ),
+                                      &c->stacks ) ) == NULL ) )
+    return false;
+
+  if( to == from )
+    return true;
+
+  if( !emptyStack( from ) )
+    pauseCaller( c, g, peekStack( from ), ts, cpu, counts );
+
+  from->suspendTime = ts;
+  from->suspendCpu = cpu;
+  memcpy( from->suspendCounts, counts, sizeof( from->suspendCounts ) );
+
+  for( sfp = to->top; sfp != NULL; sfp = sfp->next )
+  {
+    sfp->calleeEntryTime += ts - to->suspendTime;
+    sfp->calleeEntryCpu += cpu - to->suspendCpu;
+
+    for( i = 0; i < NUM_COUNTERS; i++ )
+      sfp->calleeEntryCounts[ i ] += counts[ i ] - to->suspendCounts[ i ];
+  }
+
+  //the top frame carries on as if a call it made had just returned
+  if( !emptyStack( to ) )
+  {
+    sfp = peekStack( to );
+    sfp->calleeExitTime = ts;
+    sfp->calleeExitCpu = cpu;
+    memcpy( sfp->calleeExitCounts, counts, sizeof( sfp->calleeExitCounts ) );
+  }
+
+  c->stack = to;
+  c->ownStack->running = ( to != c->ownStack ) ? to : NULL;
+
+  return true;
+}
+
+
+/*
+===============
+negotiate
+
+Answer a client's EV_HELLO
+===============
+*/
+static void negotiate( connection_t *c, functionEvent_t *fe )
+{
+  helloReply_t reply;
+
+  if( HELLO_MAGIC( fe->ts ) != PROTOCOL_MAGIC )
+    return;
+
+  reply.magic = PROTOCOL_MAGIC;
+  reply.version = HELLO_VERSION( fe->ts ) < PROTOCOL_VERSION ?
+                  HELLO_VERSION( fe->ts ) : PROTOCOL_VERSION;
+  reply.capabilities = (unsigned int)(unsigned long)fe->this_fn &
+                       SERVER_CAPABILITIES;
+
+  if( send( c->socket, &reply, sizeof( helloReply_t ), MSG_NOSIGNAL ) !=
+      sizeof( helloReply_t ) )
+    return;
+
+  c->version = reply.version;
+  c->capabilities = reply.capabilities;
+  c->pointerSize = HELLO_PTRSIZE( fe->ts );
+}
+
+
+#define SFE sizeof(functionEvent_t)
+
+/*
+===============
+parseFrame
+
+Deal with a single version 1 functionEvent_t from the buffer
+Returns the number of bytes used, 0 if more are needed or -1 if a
+thread couldn't be switched to
+===============
+*/
+static int parseFrame( connection_t *c, graph_t *g,
+                       const unsigned char *data, int size,
+                       int *eventCount, boolean *clientConnected )
+{
+  static const unsigned long long noCounts[ NUM_COUNTERS ];
+  functionEvent_t                 fe;
+
+  if( size < SFE )
+    return 0;
+
+  memcpy( &fe, data, SFE );
+
+  //deal with the event
+  switch( fe.type )
+  {
+    case EV_ENTER:
+      enterFunction( c, g, fe.this_fn, NULL, NULL,
+                     ticksToNsecs( fe.ts, c->clockRate ), 0, noCounts );
+      (*eventCount)++;
+      break;
+
+    case EV_EXIT:
+      exitFunction( c, g, ticksToNsecs( fe.ts, c->clockRate ), 0, noCounts );
+      (*eventCount)++;
+      break;
+
+    case EV_THREAD:
+      if( !switchThread( c, g, (unsigned int)fe.ts ) )
+        return -1;
+      break;
+
+    case EV_CLOCKRATE:
+      if( fe.ts > 0 )
+        c->clockRate = fe.ts;
+      break;
+
+    case EV_HELLO:
+      negotiate( c, &fe );
+      break;
+
+    case EV_PROCEXIT:
+      *clientConnected = false;
+      break;
+
+    default:
+      break;
+  }
+
+  return SFE;
+}
+
+
+/*
+===============
+defineFunction
+
+Deal with a REC_FUNCTION body
+A zone gets its node straight away, so it can be named
+===============
+*/
+static boolean defineFunction( connection_t *c, graph_t *g,
+                               const unsigned char *p, const unsigned char *end )
+{
+  unsigned long long  id, symbol;
+  clientFunction_t    *functions;
+  graphNode_t         *node;
+  int                 n;
+
+  if( !readVarint( &p, end, &id ) || !readVarint( &p, end, &symbol ) ||
+      id >= MAX_FUNCTIONS )
+    return false;
+
+  if( id >= c->numFunctions )
+  {
+    for( n = c->numFunctions ? c->numFunctions : 1024; n <= id; n *= 2 );
+
+    if( ( functions = (clientFunction_t *)realloc( c->functions,
+            n * sizeof( clientFunction_t ) ) ) == NULL )
+      return false;
+
+    memset( functions + c->numFunctions, 0,
+            ( n - c->numFunctions ) * sizeof( clientFunction_t ) );
+
+    c->functions = functions;
+    c->numFunctions = n;
+  }
+
+  c->functions[ id ].symbol = (void *)(unsigned long)symbol;
+  c->functions[ id ].node = NULL;
+
+  if( ( c->capabilities & CAP_ZONES ) && p < end )
+  {
+    node = searchNodes( c->functions[ id ].symbol, NULL, g );
+    node->zone = true;
+    snprintf( node->textSymbol, MAX_SYMBOL_TEXT, "%.*s",
+              (int)( end - p ), (const char *)p );
+
+    c->functions[ id ].node = node;
+  }
+
+  return true;
+}
+
+
+/*
+===============
+compensate
+
+Take what the client's hooks have cost so far on a thread out of a
+reading of one of its clocks, never letting time run backwards
+*skew is the cost so far times OVERHEAD_SCALE and *last the previous
+adjusted reading
+===============
+*/
+static timeStamp_t compensate( timeStamp_t *skew, timeStamp_t *last,
+                               timeStamp_t ts, timeStamp_t overhead )
+{
+  timeStamp_t adjusted = ts - *skew / OVERHEAD_SCALE;
+
+  //the hooks can't have taken longer than the time that passed
+  if( *skew / OVERHEAD_SCALE > ts || adjusted < *last )
+  {
+    adjusted = *last;
+    *skew = ( ts - adjusted ) * OVERHEAD_SCALE;
+  }
+
+  *last = adjusted;
+  *skew += overhead;
+
+  return adjusted;
+}
+
+/*
+===============
+parseBatch
+
+Deal with the events in a REC_BATCH body
+===============
+*/
+static boolean parseBatch( connection_t *c, graph_t *g,
+                           const unsigned char *p, const unsigned char *end,
+                           int *eventCount )
+{
+  unsigned long long  tid, ts, v, deltaFn, id = 0, cpu = 0, deltaCpu;
+  unsigned long long  siteId = 0;
+  unsigned long long  counts[ NUM_COUNTERS ] = { 0 }, deltaCount;
+  timeStamp_t         nsecs, cpuNsecs = 0;
+  unsigned long       fn = 0;
+  boolean             useIds = ( c->capabilities & CAP_FUNCIDS ) != 0;
+  boolean             useSites = ( c->capabilities & CAP_CALLSITES ) != 0;
+  boolean             useFibers = ( c->capabilities & CAP_FIBERS ) != 0;
+  boolean             useCpu = ( c->capabilities & CAP_CPUTIME ) != 0;
+  callStack_t         *s;
+  clientFunction_t    *f;
+  int                 i;
+
+  if( !readVarint( &p, end, &tid ) || !readVarint( &p, end, &ts ) ||
+      ( useCpu && !readVarint( &p, end, &cpu ) ) )
+    return false;
+
+  for( i = 0; i < NUM_COUNTERS; i++ )
+  {
+    if( ( c->capabilities & counterCapability( i ) ) &&
+        !readVarint( &p, end, &counts[ i ] ) )
+      return false;
+  }
+
+  if( !switchThread( c, g, (unsigned int)tid ) )
+    return false;
+
+  //a thread's clocks go with it from one fiber to another
+  s = c->ownStack;
+
+  while( p < end )
+  {
+    if( !readVarint( &p, end, &v ) )
+      return false;
+
+    ts += UNZIGZAG( v >> BATCH_KIND_BITS );
+
+    nsecs = ticksToNsecs( compensate( &s->overhead, &s->lastTime, ts,
+                                      c->overhead ), c->clockRate );
+
+    if( useFibers && ( v & BATCH_KIND_MASK ) == EV_THREAD )
+    {
+      if( !readVarint( &p, end, &id ) )
+        return false;
+    }
+    else if( useIds )
+    {
+      switch( v & BATCH_KIND_MASK )
+      {
+        case EV_ENTER:
+          if( !readVarint( &p, end, &id ) || id >= c->numFunctions )
+            return false;
+
+          if( useSites && ( !readVarint( &p, end, &siteId ) ||
+                            siteId > c->numFunctions ) )
+            return false;
+          break;
+
+        case EV_EXIT:
+          break;
+
+        default:
+          return false;
+      }
+    }
+    else
+    {
+      if( !readVarint( &p, end, &deltaFn ) )
+        return false;
+
+      fn += UNZIGZAG( deltaFn );
+    }
+
+    if( useCpu )
+    {
+      if( !readVarint( &p, end, &deltaCpu ) )
+        return false;
+
+      cpu += UNZIGZAG( deltaCpu );
+      cpuNsecs = compensate( &s->cpuOverhead, &s->lastCpu, cpu,
+                             c->cpuOverhead );
+    }
+
+    for( i = 0; i < NUM_COUNTERS; i++ )
+    {
+      if( !( c->capabilities & counterCapability( i ) ) )
+        continue;
+
+      if( !readVarint( &p, end, &deltaCount ) )
+        return false;
+
+      counts[ i ] += UNZIGZAG( deltaCount );
+    }
+
+    switch( v & BATCH_KIND_MASK )
+    {
+      case EV_ENTER:
+        if( !useIds )
+        {
+          enterFunction( c, g, (void *)fn, NULL, NULL, nsecs, cpuNsecs,
+                         counts );
+          break;
+        }
+
+        //the node is looked up once, then remembered
+        f = &c->functions[ id ];
+        f->node = enterFunction( c, g, f->symbol, f->node,
+                                 siteId > 0 ?
+                                 c->functions[ siteId - 1 ].symbol : NULL,
+                                 nsecs, cpuNsecs, counts );
+        break;
+
+      case EV_EXIT:
+        exitFunction( c, g, nsecs, cpuNsecs, counts );
+        break;
+
+      case EV_THREAD:
+        if( !switchStack( c, g, id, nsecs, cpuNsecs, counts ) )
+          return false;
+        break;
+
+      default:
+        break;
+    }
+
+    (*eventCount)++;
+  }
+
+  return true;
+}
+
+
+/*
+===============
+functionNode
+
+Return the graph node for a function id, creating it near parent if needed
+===============
+*/
+static graphNode_t *functionNode( connection_t *c, graph_t *g,
+                                  unsigned long long id, graphNode_t *parent )
+{
+  clientFunction_t *f;
+
+  if( id >= c->numFunctions )
+    return NULL;
+
+  f = &c->functions[ id ];
+
+  if( f->node == NULL )
+    f->node = searchNodes( f->symbol, parent ? parent->symbol : NULL, g );
+
+  return f->node;
+}
+
+
+/*
+===============
+applySummary
+
+Add the totals in a REC_SUMMARY body to the graph
+===============
+*/
+static boolean applySummary( connection_t *c, graph_t *g,
+                             const unsigned char *p, const unsigned char *end,
+                             int *eventCount )
+{
+  unsigned long long  tid, callerId, calleeId, siteId = 0;
+  unsigned long long  calls, local, total;
+  unsigned long long  localCpu = 0, totalCpu = 0;
+  unsigned long long  localCounts[ NUM_COUNTERS ] = { 0 };
+  unsigned long long  totalCounts[ NUM_COUNTERS ] = { 0 };
+  boolean             useSites = ( c->capabilities & CAP_CALLSITES ) != 0;
+  boolean             useCpu = ( c->capabilities & CAP_CPUTIME ) != 0;
+  boolean             streamed;
+  graphNode_t         *parent, *child;
+  graphEdge_t         *edge;
+  graphThread_t       *thread;
+  timeStamp_t         now = getusecs( );
+  int                 i;
+
+  if( !readVarint( &p, end, &tid ) )
+    return false;
+
+  if( !switchThread( c, g, (unsigned int)tid ) )
+    return false;
+  thread = c->thread;
+
+  while( p < end )
+  {
+    if( !readVarint( &p, end, &callerId ) ||
+        !readVarint( &p, end, &calleeId ) ||
+        ( useSites && !readVarint( &p, end, &siteId ) ) ||
+        !readVarint( &p, end, &calls ) ||
+        !readVarint( &p, end, &local ) ||
+        !readVarint( &p, end, &total ) )
+      return false;
+
+    if( useCpu && ( !readVarint( &p, end, &localCpu ) ||
+                    !readVarint( &p, end, &totalCpu ) ) )
+      return false;
+
+    for( i = 0; i < NUM_COUNTERS; i++ )
+    {
+      if( ( c->capabilities & counterCapability( i ) ) &&
+          ( !readVarint( &p, end, &localCounts[ i ] ) ||
+            !readVarint( &p, end, &totalCounts[ i ] ) ) )
+        return false;
+    }
+
+    parent = NULL;
+    streamed = ( callerId & 1 ) != 0;
+    callerId >>= 1;
+
+    if( callerId > 0 && ( parent = functionNode( c, g, callerId - 1,
+                                                 NULL ) ) == NULL )
+      return false;
+
+    if( ( child = functionNode( c, g, calleeId, parent ) ) == NULL )
+      return false;
+
+    if( siteId > c->numFunctions )
+      return false;
+
+    local = ticksToNsecs( local, c->clockRate );
+    total = ticksToNsecs( total, c->clockRate );
+
+    child->calls += calls;
+    if( child->calls > g->maxNodeCalls )
+      g->maxNodeCalls = child->calls;
+
+    local = settleOwed( &child->localTimeOwed, local );
+
+    child->localTime += local;
+    if( child->localTime > g->maxLocalTime )
+      g->maxLocalTime = child->localTime;
+
+    child->totalTime += total;
+    if( child->totalTime > g->maxTotalTime )
+      g->maxTotalTime = child->totalTime;
+
+    child->active = false;
+    child->lastActive = now;
+
+    g->totalCalls += calls;
+    g->totalLocalTime += local;
+    g->totalTotalTime += total;
+
+    thread->calls += calls;
+    thread->localTime += local;
+    thread->totalTime += total;
+
+    addCpuTime( g, thread, child, localCpu, totalCpu );
+    addCounts( g, child, localCounts, totalCounts );
+
+    //the caller's events covered this time, so it has been or will be
+    //counted as the caller's local time
+    if( streamed && parent != NULL )
+    {
+      local = parent->localTime < total ? parent->localTime : total;
+
+      parent->localTime -= local;
+      parent->localTimeOwed += total - local;
+      g->totalLocalTime -= local;
+
+      //and was charged to this thread, but only what it has been charged
+      thread->localTime -= thread->localTime < local ? thread->localTime :
+                                                       local;
+
+      local = parent->localCpuTime < totalCpu ? parent->localCpuTime :
+                                                totalCpu;
+
+      parent->localCpuTime -= local;
+      parent->localCpuTimeOwed += totalCpu - local;
+      g->totalLocalCpuTime -= local;
+      thread->localCpuTime -= thread->localCpuTime < local ?
+                              thread->localCpuTime : local;
+
+      for( i = 0; i < NUM_COUNTERS; i++ )
+      {
+        local = parent->localCounts[ i ] < totalCounts[ i ] ?
+                parent->localCounts[ i ] : totalCounts[ i ];
+
+        parent->localCounts[ i ] -= local;
+        parent->localCountsOwed[ i ] += totalCounts[ i ] - local;
+        g->totalLocalCounts[ i ] -= local;
+      }
+    }
+
+    if( parent != NULL )
+    {
+      for( edge = searchEdges( parent, child, siteId > 0 ?
+                               c->functions[ siteId - 1 ].symbol : NULL, g );
+           edge != NULL; edge = edge->collapsed )
+      {
+        edge->calls += calls;
+        edge->active = false;
+        edge->lastActive = now;
+
+        for( i = 0; i < NUM_COUNTERS; i++ )
+          edge->counts[ i ] += totalCounts[ i ];
+
+        if( edge->calls > g->maxEdgeCalls )
+          g->maxEdgeCalls = edge->calls;
+      }
+    }
+
+    (*eventCount) += calls;
+  }
+
+  return true;
+}
+
+
+/*
+===============
+applyHeap
+
+Charge the live heap in a REC_HEAP body to the functions on each call
+path: the innermost as having allocated it, and all of them as having
+it allocated beneath them
+===============
+*/
+static boolean applyHeap( connection_t *c, graph_t *g,
+                          const unsigned char *p, const unsigned char *end )
+{
+  unsigned long long  first, depth, id, bytes, allocs;
+  graphNode_t         *path[ HEAP_MAX_DEPTH ], *parent, *leaf;
+  int                 i, j, n;
+
+  if( !readVarint( &p, end, &first ) )
+    return false;
+
+  if( first )
+    clearHeap( g );
+
+  while( p < end )
+  {
+    if( !readVarint( &p, end, &depth ) || depth == 0 ||
+        depth > HEAP_MAX_DEPTH )
+      return false;
+
+    n = (int)depth;
+    parent = NULL;
+
+    for( i = 0; i < n; i++ )
+    {
+      if( !readVarint( &p, end, &id ) ||
+          ( path[ i ] = functionNode( c, g, id, parent ) ) == NULL )
+        return false;
+
+      parent = path[ i ];
+    }
+
+    if( !readVarint( &p, end, &bytes ) ||
+        !readVarint( &p, end, &allocs ) )
+      return false;
+
+    leaf = path[ n - 1 ];
+    leaf->heapBytes += bytes;
+    leaf->heapAllocs += allocs;
+
+    if( leaf->heapBytes > g->maxHeapBytes )
+      g->maxHeapBytes = leaf->heapBytes;
+
+    //a recursive function is on the path more than once
+    for( i = 0; i < n; i++ )
+    {
+      for( j = 0; j < i && path[ j ] != path[ i ]; j++ );
+
+      if( j == i )
+        path[ i ]->totalHeapBytes += bytes;
+    }
+
+    g->totalHeapBytes += bytes;
+  }
+
+  return true;
+}
+
+
+/*
+===============
+applyLocks
+
+Note the lock each function in a REC_LOCKS body has waited longest for
+===============
+*/
+static boolean applyLocks( connection_t *c, graph_t *g,
+                           const unsigned char *p, const unsigned char *end )
+{
+  unsigned long long  first, id, lock, waits, waitTime;
+  graphNode_t         *node;
+
+  if( !readVarint( &p, end, &first ) )
+    return false;
+
+  if( first )
+    clearLocks( g );
+
+  while( p < end )
+  {
+    if( !readVarint( &p, end, &id ) ||
+        !readVarint( &p, end, &lock ) ||
+        !readVarint( &p, end, &waits ) ||
+        !readVarint( &p, end, &waitTime ) ||
+        ( node = functionNode( c, g, id, NULL ) ) == NULL )
+      return false;
+
+    if( waitTime > node->lockWaitTime )
+    {
+      node->lockAddress = (void *)(unsigned long)lock;
+      node->lockWaits = waits;
+      node->lockWaitTime = waitTime;
+    }
+  }
+
+  return true;
+}
+
+/*
+===============
+defineModule
+
+Deal with a REC_MODULE body, renaming any nodes its symbols belong to
+===============
+*/
+static boolean defineModule( graph_t *g,
+                             const unsigned char *p, const unsigned char *end )
+{
+  unsigned long long  bias;
+  char                path[ PATH_MAX ];
+
+  if( !readVarint( &p, end, &bias ) || end - p >= PATH_MAX )
+    return false;
+
+  memcpy( path, p, end - p );
+  path[ end - p ] = '\0';
+
+  if( resolveModule( path, bias ) )
+    renameNodes( g );
+
+  return true;
+}
+
+
+/*
+===============
+applyCounter
+
+Deal with a REC_COUNTER body
+===============
+*/
+static boolean applyCounter( connection_t *c, graph_t *g,
+                             const unsigned char *p, const unsigned char *end )
+{
+  unsigned long long  id, ts, value;
+  char                name[ MAX_SYMBOL_TEXT ];
+  int                 *counters, n, index;
+
+  if( !readVarint( &p, end, &id ) || !readVarint( &p, end, &ts ) ||
+      !readVarint( &p, end, &value ) || id >= MAX_CLIENT_COUNTERS )
+    return false;
+
+  if( id >= c->numCounters )
+  {
+    for( n = c->numCounters ? c->numCounters : 64; n <= id; n *= 2 );
+
+    if( ( counters = (int *)realloc( c->counters,
+                                     n * sizeof( int ) ) ) == NULL )
+      return false;
+
+    memset( counters + c->numCounters, 0,
+            ( n - c->numCounters ) * sizeof( int ) );
+
+    c->counters = counters;
+    c->numCounters = n;
+  }
+
+  //the first time, the name follows
+  if( p < end )
+  {
+    snprintf( name, MAX_SYMBOL_TEXT, "%.*s", (int)( end - p ),
+              (const char *)p );
+
+    if( ( index = searchCounters( name, g ) ) < 0 )
+      return false;
+
+    c->counters[ id ] = index + 1;
+  }
+
+  //a counter can't be kept without a name
+  if( c->counters[ id ] == 0 )
+    return true;
+
+  addSample( &g->counters[ c->counters[ id ] - 1 ],
+             ticksToNsecs( ts, c->clockRate ), UNZIGZAG( value ) );
+
+  return true;
+}
+
+
+/*
+===============
+parseHello
+
+Deal with a REC_HELLO body
+===============
+*/
+static boolean parseHello( connection_t *c,
+                           const unsigned char *p, const unsigned char *end )
+{
+  unsigned long long version, pointerSize, clockRate, capabilities, pid;
+  unsigned long long overhead;
+
+  if( !readVarint( &p, end, &version ) ||
+      !readVarint( &p, end, &pointerSize ) ||
+      !readVarint( &p, end, &clockRate ) ||
+      !readVarint( &p, end, &capabilities ) )
+    return false;
+
+  //added later, so optional
+  if( readVarint( &p, end, &pid ) )
+    c->pid = (unsigned int)pid;
+
+  if( readVarint( &p, end, &overhead ) )
+    c->overhead = overhead;
+
+  c->pointerSize = (unsigned int)pointerSize;
+  c->capabilities = (unsigned int)capabilities & SERVER_CAPABILITIES;
+
+  if( clockRate > 0 )
+    c->clockRate = clockRate;
+
+  c->cpuOverhead = ticksToNsecs( c->overhead, c->clockRate );
+
+  return true;
+}
+
+
+/*
+===============
+unpackBlock
+
+Deal with a REC_BLOCK body, leaving the records in it for
+peekConnection to return next
+===============
+*/
+static boolean unpackBlock( connection_t *c,
+                            const unsigned char *p, const unsigned char *end )
+{
+  unsigned long long length;
+
+  if( !readVarint( &p, end, &length ) || length > MAX_RECORD_BODY )
+    return false;
+
+  if( c->block == NULL &&
+      ( c->block = (unsigned char *)malloc( MAX_RECORD_BODY ) ) == NULL )
+    return false;
+
+  if( decompressBlock( p, (int)( end - p ), c->block, (int)length ) !=
+      (int)length )
+    return false;
+
+  c->blockStart = 0;
+  c->blockEnd = (int)length;
+
+  return true;
+}
+
+
+/*
+===============
+parseRecord
+
+Deal with a single version 2 record from the buffer
+Returns the number of bytes used, 0 if more are needed or -1 if the
+stream is garbled
+===============
+*/
+static int parseRecord( connection_t *c, graph_t *g,
+                        const unsigned char *data, int size,
+                        int *eventCount, boolean *clientConnected )
+{
+  const unsigned char *start = data;
+  const unsigned char *end = data + size;
+  const unsigned char *p = start + 1;
+  unsigned long long  length;
+
+  if( start >= end )
+    return 0;
+
+  if( !readVarint( &p, end, &length ) )
+    return ( c->inBlock || end - p >= MAX_VARINT ) ? -1 : 0;
+
+  if( length > MAX_RECORD_BODY )
+    return -1;
+
+  if( end - p < length )
+    return c->inBlock ? -1 : 0;
+
+  switch( *start )
+  {
+    case REC_BATCH:
+      if( !parseBatch( c, g, p, p + length, eventCount ) )
+        return -1;
+      break;
+
+    case REC_PROCEXIT:
+      *clientConnected = false;
+      break;
+
+    case REC_HELLO:
+      if( !parseHello( c, p, p + length ) )
+        return -1;
+      break;
+
+    case REC_FUNCTION:
+      if( !defineFunction( c, g, p, p + length ) )
+        return -1;
+      break;
+
+    case REC_SUMMARY:
+      if( !applySummary( c, g, p, p + length, eventCount ) )
+        return -1;
+      break;
+
+    case REC_HEAP:
+      if( !applyHeap( c, g, p, p + length ) )
+        return -1;
+      break;
+
+    case REC_MODULE:
+      if( !defineModule( g, p, p + length ) )
+        return -1;
+      break;
+
+    case REC_LOCKS:
+      if( !applyLocks( c, g, p, p + length ) )
+        return -1;
+      break;
+
+    case REC_COUNTER:
+      if( !applyCounter( c, g, p, p + length ) )
+        return -1;
+      break;
+
+    case REC_RETIRE:
+      if( !retireThread( c, g, p, p + length ) )
+        return -1;
+      break;
+
+    case REC_BLOCK:
+      //blocks don't nest
+      if( c->inBlock || !unpackBlock( c, p, p + length ) )
+        return -1;
+      break;
+
+    default:
+      //something from a newer client; skip it
+      break;
+  }
+
+  return ( p - start ) + length;
+}
+
+
+/*
+===============
+serviceConnection
+
+Function to service a librtprof connection
+maxEvents is the maximum number of events to read this call
+===============
+*/
+boolean serviceConnection( connection_t *c, graph_t *g, int maxEvents )
+{
+  boolean             clientConnected = true;
+  int                 eventCount = 0;
+  int                 used, size;
+  const unsigned char *data;
+
+  if( c->stack == NULL )
+    switchThread( c, g, 0 );
+  
+  //while there are events to be processed read from the socket
+  while( clientConnected && eventCount < maxEvents )
+  {
+    size = peekConnection( c, &data );
+
+    if( c->version >= 2 )
+      used = parseRecord( c, g, data, size, &eventCount, &clientConnected );
+    else
+      used = parseFrame( c, g, data, size, &eventCount, &clientConnected );
+
+    if( used < 0 )
+    {
+      fprintf( stderr, "rtprof: garbled stream from client\n" );
+      clientConnected = false;
+    }
+    else if( used > 0 )
+      consumeConnection( c, used );
+    else if( ( used = readFromConnection( c ) ) < 0 )
+      clientConnected = false;
+    else if( used == 0 )
+      break;
+  }
+
+  c->backlog = ( clientConnected && eventCount >= maxEvents );
+
+  if( !clientConnected && c->socket >= 0 )
+  {
+    close( c->socket );
+    c->socket = -1;
+  }
+
+  if( !clientConnected && c->shm != NULL )
+  {
+    unmapShmRing( (unsigned char *)c->shm, SHM_RING_SIZE );
+    c->shm = NULL;
+  }
+
+  updateGraph( g, getusecs( ) );
 
   return clientConnected;
 }
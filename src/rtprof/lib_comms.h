@@ -21,14 +21,137 @@
 
 #include "adt_graph.h"
 #include "adt_stack.h"
+#include "com_protocol.h"
+#include "com_shm.h"
+#include "com_trace.h"
 
 #define MAX_HOST_NAME 64
 
 #define RTPROF_PORT 4004
 #define RTPROF_FILE "rtprof.sock"
 
-int         acceptConnection( int type, char *socketFile );
-boolean     serviceConnection( int connection, callStack_t *s, graph_t *g, int maxEvents );
-timeStamp_t getusecs( void );
+//capability bits this rtprof understands
+#define SERVER_CAPABILITIES ( CAP_FUNCIDS | CAP_SUMMARY | CAP_CONTROL | \
+                              CAP_COMPRESS | CAP_CPUTIME | CAP_COUNTERS | \
+                              CAP_ALLOCS | CAP_HEAP | CAP_MODULES | \
+                              CAP_LOCKS | CAP_IO | CAP_CALLSITES | \
+                              CAP_FIBERS | CAP_ZONES )
+
+//clients that can be waiting to be accepted at once
+#define LISTEN_BACKLOG 16
+
+//how often a shared memory listener checks for a writer
+#define SHM_ACCEPT_MSEC 10
+
+//clients waitForConnections can poll on at once
+#define MAX_WAIT_FDS 256
+
+//upper bound on function ids, to guard against a garbled stream
+#define MAX_FUNCTIONS ( 1 << 24 )
+
+//likewise for counter ids
+#define MAX_CLIENT_COUNTERS ( 1 << 16 )
+
+//must hold the largest possible record
+#define RECV_BUFFER ( 1 + MAX_VARINT + MAX_RECORD_BODY )
+
+typedef enum
+{
+  CT_SOCKET,
+  CT_SHM,
+  CT_TRACE
+} connectionType_t;
+
+//a function id defined by REC_FUNCTION
+typedef struct clientFunction_s
+{
+  void                *symbol;
+  graphNode_t         *node;    //NULL until first entered
+} clientFunction_t;
+
+//somewhere clients connect to
+typedef struct listener_s
+{
+  connectionType_t    type;
+  int                 socket;
+
+  //CT_SHM; the ring waiting to be claimed by the next client
+  char                name[ MAX_HOST_NAME + 2 ];
+  shmHeader_t         *shm;
+} listener_t;
+
+typedef struct connection_s
+{
+  connectionType_t    type;
+  int                 socket;
+
+  //CT_SHM; the ring is read in place
+  shmHeader_t         *shm;
+  unsigned char       *shmData;
+  unsigned long long  shmHead, shmTail;
+
+  //CT_TRACE; the file is read in place, optionally paced to the
+  //client's own timestamps
+  traceHeader_t       *trace;
+  unsigned char       *traceData;
+  unsigned long long  traceSize, traceHead, traceTail;
+  boolean             realtime, replayStarted;
+  timeStamp_t         replayStart, traceStart;
+
+  //negotiated with the client
+  int                 version;
+  unsigned int        capabilities;
+  unsigned int        pointerSize;
+  timeStamp_t         clockRate;
+
+  //from REC_HELLO; 0 for a client too old to say
+  unsigned int        pid;
+  timeStamp_t         overhead;     //ticks per OVERHEAD_SCALE events
+  timeStamp_t         cpuOverhead;  //the same in nanoseconds
+
+  //serviceConnection stopped with events still waiting
+  boolean             backlog;
+
+  //CAP_FUNCIDS; indexed by function id
+  int                 numFunctions;
+  clientFunction_t    *functions;
+
+  //CAP_ZONES; indexed by counter id, the graph's index for the counter
+  //plus one, or 0 until REC_COUNTER has named it
+  int                 numCounters;
+  int                 *counters;
+
+  //the client thread events are currently being accounted to; with
+  //CAP_FIBERS stack can be a fiber's, while ownStack, the thread's own,
+  //keeps the thread's clocks
+  unsigned int        tid;
+  callStack_t         *stack;
+  callStack_t         *ownStack;
+  graphThread_t       *thread;
+  threadStacks_t      stacks;
+
+  //CT_SOCKET; received but not yet processed
+  unsigned char       buffer[ RECV_BUFFER ];
+  int                 bufferStart, bufferEnd;
+
+  //records unpacked from a REC_BLOCK, read before anything after it
+  unsigned char       *block;
+  int                 blockStart, blockEnd;
+  boolean             inBlock;      //peekConnection returned the block
+} connection_t;
+
+listener_t    *listenForConnections( int type, char *socketFile );
+listener_t    *listenForShmConnections( char *name );
+void          closeListener( listener_t *l );
+connection_t  *acceptConnection( listener_t *l, int msec );
+connection_t  *openReplay( char *path, boolean realtime );
+void          closeConnection( connection_t *c );
+void          waitForConnection( connection_t *c, int msec );
+void          waitForConnections( listener_t *l, connection_t **c, int n,
+                                  int msec );
+boolean       sendControl( connection_t *c, control_t type,
+                           unsigned long long start, unsigned long long end );
+boolean       serviceConnection( connection_t *c, graph_t *g, int maxEvents );
+timeStamp_t   getusecs( void );
 
 #endif
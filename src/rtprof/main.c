@@ -21,6 +21,8 @@
 #include <string.h>
 #include <signal.h>
 #include <getopt.h>
+#include <unistd.h>
+#include <poll.h>
 #include <sys/socket.h>
 
 #include "com_common.h"
@@ -32,18 +34,58 @@
 
 static debugLevel_t dl = DL_ZERO;
 
-static callStack_t  callStack;
+#define MAX_PROCESSES 256
+
+//how long to wait for another client once none are left; a forked child
+//only connects once it reaches its first instrumented function, which
+//may be after its parent has gone
+#define LINGER_MSEC   2000
+
+//every client seen, connected or not, with a graph of its own
+typedef struct process_s
+{
+  connection_t  *connection;    //NULL once it has gone
+  unsigned int  pid;
+  graph_t       graph;
+} process_t;
+
+static listener_t   *listener = NULL;
+static process_t    *processes[ MAX_PROCESSES ];
+static int          numProcesses = 0;
+
+//the process being looked at, or NULL for every process combined
+static process_t    *viewProcess = NULL;
+
+//the combined view, once there is more than one process
 static graph_t      callGraph;
 
+//the processes that have gone, folded together to make room for more
+static graph_t      pastGraph;
+static boolean      folded = false;
+
 #define MAX_FILENAME_LENGTH 1024
 
 static boolean      writeDotFile = false;
 static char         dotFile[ MAX_FILENAME_LENGTH ];
+static boolean      dotCallSites = false;
+static boolean      writeCounterFile = false;
+static char         counterFile[ MAX_FILENAME_LENGTH ];
 static boolean      disableGL = false;
 static boolean      GLstarted = false;
 
 static char         socketFile[ MAX_FILENAME_LENGTH ];
 static boolean      fileSocket = false;
+static char         shmName[ MAX_FILENAME_LENGTH ];
+static boolean      shmSocket = false;
+static char         replayFile[ MAX_FILENAME_LENGTH ];
+static boolean      replay = false;
+static boolean      realtime = false;
+
+#define MAX_COMMAND_LENGTH 1024
+
+static char         command[ MAX_COMMAND_LENGTH ];
+static int          commandLength = 0;
+static boolean      commandsClosed = false;
 
 /*
 ===============
@@ -67,10 +109,15 @@ static void parseOptions( int argc, char **argv )
       { "dotfile",      2, NULL, 'd' },
       { "disable-gl",   0, NULL, 'g' },
       { "socket",       1, NULL, 's' },
+      { "shm",          1, NULL, 'm' },
+      { "replay",       1, NULL, 'r' },
+      { "realtime",     0, NULL, 't' },
+      { "call-sites",   0, NULL, 'c' },
+      { "counters",     2, NULL, 'k' },
       { 0, 0, 0, 0 }
     };
 
-    if( ( c = getopt_long( argc, argv, "d::gs:",
+    if( ( c = getopt_long( argc, argv, "d::gs:m:r:tck::",
         longOptions, &optionIndex ) ) == -1 )
       break;
       
@@ -95,6 +142,35 @@ static void parseOptions( int argc, char **argv )
         strncpy( socketFile, optarg, MAX_FILENAME_LENGTH );
         break;
       
+      case 'm':
+        shmSocket = true;
+        
+        snprintf( shmName, sizeof( shmName ), "%s", optarg );
+        break;
+      
+      case 'r':
+        replay = true;
+        
+        snprintf( replayFile, sizeof( replayFile ), "%s", optarg );
+        break;
+      
+      case 't':
+        realtime = true;
+        break;
+      
+      case 'c':
+        dotCallSites = true;
+        break;
+      
+      case 'k':
+        writeCounterFile = true;
+        
+        if( optarg )
+          snprintf( counterFile, sizeof( counterFile ), "%s", optarg );
+        else
+          snprintf( counterFile, sizeof( counterFile ), "counters.csv" );
+        break;
+      
       case '?':
         fprintf( stderr, "rtprof: unrecognised option -- %c\n", optopt );
         break;
@@ -110,6 +186,382 @@ static void parseOptions( int argc, char **argv )
     resolveSymbols( argv[ optind++ ] );
 }
 
+/*
+===============
+foldProcess
+
+Make room by adding the oldest process that has gone to pastGraph
+Returns false if every process is still connected
+===============
+*/
+static boolean foldProcess( void )
+{
+  process_t *p;
+  int       i;
+
+  for( i = 0; i < numProcesses; i++ )
+  {
+    if( processes[ i ]->connection == NULL )
+      break;
+  }
+
+  if( i == numProcesses )
+    return false;
+
+  p = processes[ i ];
+  mergeGraph( &pastGraph, &p->graph );
+  folded = true;
+
+  if( viewProcess == p )
+    viewProcess = NULL;
+
+  shutdownGraph( &p->graph );
+  free( p );
+
+  memmove( processes + i, processes + i + 1,
+           ( numProcesses - i - 1 ) * sizeof( process_t * ) );
+  numProcesses--;
+
+  return true;
+}
+
+/*
+===============
+addProcess
+
+Start keeping track of a newly connected client
+===============
+*/
+static void addProcess( connection_t *c )
+{
+  process_t *p;
+
+  if( ( numProcesses == MAX_PROCESSES && !foldProcess( ) ) ||
+      ( p = (process_t *)malloc( sizeof( process_t ) ) ) == NULL )
+  {
+    fprintf( stderr, "rtprof: too many clients; ignoring one\n" );
+    closeConnection( c );
+    return;
+  }
+
+  p->connection = c;
+  p->pid = 0;
+  initGraph( &p->graph );
+
+  processes[ numProcesses++ ] = p;
+}
+
+/*
+===============
+retireProcess
+
+Forget the connection to a process, keeping its graph
+===============
+*/
+static void retireProcess( process_t *p )
+{
+  if( p->connection == NULL )
+    return;
+
+  closeConnection( p->connection );
+  p->connection = NULL;
+}
+
+/*
+===============
+acceptClients
+
+Take on any clients waiting to connect, such as the children of a
+fork or a process that has just exec'd, waiting up to msec for the first
+Returns true if there were any
+===============
+*/
+static boolean acceptClients( int msec )
+{
+  connection_t  *c;
+  boolean       accepted = false;
+
+  if( listener == NULL )
+    return false;
+
+  while( ( c = acceptConnection( listener, accepted ? 0 : msec ) ) != NULL )
+  {
+    addProcess( c );
+    fprintf( stderr, "rtprof: accepted client %d\n", numProcesses );
+    accepted = true;
+  }
+
+  return accepted;
+}
+
+/*
+===============
+serviceProcesses
+
+Service every connected client, filling in live with those still there
+Returns how many that is
+===============
+*/
+static int serviceProcesses( connection_t **live )
+{
+  process_t *p;
+  int       i, j, n = 0;
+
+  for( i = 0; i < numProcesses; i++ )
+  {
+    p = processes[ i ];
+
+    if( p->connection == NULL )
+      continue;
+
+    if( !serviceConnection( p->connection, &p->graph, 10000 ) )
+    {
+      retireProcess( p );
+      continue;
+    }
+
+    if( p->pid != 0 || ( p->pid = p->connection->pid ) == 0 )
+      continue;
+
+    //a second stream from a pid means the first one has exec'd, which
+    //shared memory gives no other sign of
+    for( j = 0; j < numProcesses; j++ )
+    {
+      if( j != i && processes[ j ]->pid == p->pid )
+        retireProcess( processes[ j ] );
+    }
+  }
+
+  for( i = 0; i < numProcesses; i++ )
+  {
+    if( processes[ i ]->connection != NULL )
+      live[ n++ ] = processes[ i ]->connection;
+  }
+
+  return n;
+}
+
+/*
+===============
+viewGraph
+
+Return the graph currently being looked at, bringing it up to date
+===============
+*/
+static graph_t *viewGraph( void )
+{
+  int i;
+
+  if( viewProcess != NULL )
+    return &viewProcess->graph;
+  else if( numProcesses == 1 && !folded )
+    return &processes[ 0 ]->graph;
+
+  clearGraph( &callGraph );
+
+  if( folded )
+    mergeGraph( &callGraph, &pastGraph );
+
+  for( i = 0; i < numProcesses; i++ )
+    mergeGraph( &callGraph, &processes[ i ]->graph );
+
+  updateGraph( &callGraph, getusecs( ) );
+
+  return &callGraph;
+}
+
+/*
+===============
+processName
+
+Name a process by pid if it said, otherwise by the order it connected
+===============
+*/
+static int processName( int i )
+{
+  return processes[ i ]->pid != 0 ? (int)processes[ i ]->pid : i + 1;
+}
+
+/*
+===============
+parseAddress
+
+Turn a function name or address typed by the user into an address
+===============
+*/
+static boolean parseAddress( char *text, unsigned long long *address )
+{
+  graphNode_t **nodes;
+  int         numNodes, i;
+  char        *end;
+  boolean     found = false;
+
+  *address = strtoull( text, &end, 0 );
+
+  if( end != text && *end == '\0' )
+    return true;
+
+  //otherwise it has to be something that has been seen already
+  nodes = listNodes( SF_NONE, &numNodes, viewGraph( ) );
+
+  for( i = 0; i < numNodes && !found; i++ )
+  {
+    if( !strcmp( nodes[ i ]->textSymbol, text ) )
+    {
+      *address = (unsigned long)nodes[ i ]->symbol;
+      found = true;
+    }
+  }
+
+  free( nodes );
+
+  return found;
+}
+
+/*
+===============
+runCommand
+
+Act on a line typed by the user:
+  filter <function> [<end address>]
+  resume [<function> [<end address>]]
+  detach
+  view [<pid>]
+  counters
+  threads
+Control messages go to the process being viewed, or to all of them
+===============
+*/
+static void runCommand( char *line )
+{
+  char                *verb, *from, *to;
+  control_t           type;
+  unsigned long long  start = 0, end = ~0ULL;
+  boolean             sent = false;
+  int                 i;
+
+  if( ( verb = strtok( line, " \t\r\n" ) ) == NULL )
+    return;
+
+  from = strtok( NULL, " \t\r\n" );
+  to = strtok( NULL, " \t\r\n" );
+
+  if( !strcmp( verb, "filter" ) && from != NULL )
+    type = CTL_FILTER;
+  else if( !strcmp( verb, "resume" ) )
+    type = CTL_RESUME;
+  else if( !strcmp( verb, "detach" ) )
+  {
+    type = CTL_DETACH;
+    from = NULL;
+  }
+  else if( !strcmp( verb, "view" ) )
+  {
+    viewProcess = NULL;
+
+    for( i = 0; from != NULL && i < numProcesses; i++ )
+    {
+      if( processName( i ) == atoi( from ) )
+        viewProcess = processes[ i ];
+    }
+
+    if( from != NULL && viewProcess == NULL )
+      fprintf( stderr, "rtprof: no process %s\n", from );
+
+    return;
+  }
+  else if( !strcmp( verb, "counters" ) )
+  {
+    counterSummary( viewGraph( ) );
+    return;
+  }
+  else if( !strcmp( verb, "threads" ) )
+  {
+    threadSummary( viewGraph( ) );
+    return;
+  }
+  else
+  {
+    fprintf( stderr, "rtprof: usage: filter <function> [<end address>] | "
+                     "resume [<function> [<end address>]] | detach | "
+                     "view [<pid>] | counters | threads\n" );
+    return;
+  }
+
+  if( from != NULL )
+  {
+    if( !parseAddress( from, &start ) ||
+        ( to != NULL && !parseAddress( to, &end ) ) )
+    {
+      fprintf( stderr, "rtprof: unknown function \"%s\"\n",
+               to != NULL ? to : from );
+      return;
+    }
+
+    if( to == NULL )
+      end = start;
+  }
+
+  for( i = 0; i < numProcesses; i++ )
+  {
+    if( processes[ i ]->connection != NULL &&
+        ( viewProcess == NULL || viewProcess == processes[ i ] ) &&
+        sendControl( processes[ i ]->connection, type, start, end ) )
+      sent = true;
+  }
+
+  if( !sent )
+    fprintf( stderr, "rtprof: no client accepts control messages\n" );
+}
+
+/*
+===============
+pollCommands
+
+Run any complete lines waiting on stdin
+===============
+*/
+static void pollCommands( void )
+{
+  struct pollfd pfd;
+  char          *line, *newline;
+  int           count;
+
+  if( commandsClosed )
+    return;
+
+  pfd.fd = STDIN_FILENO;
+  pfd.events = POLLIN;
+
+  if( poll( &pfd, 1, 0 ) <= 0 )
+    return;
+
+  if( ( count = read( STDIN_FILENO, command + commandLength,
+                      MAX_COMMAND_LENGTH - 1 - commandLength ) ) <= 0 )
+  {
+    commandsClosed = true;
+    return;
+  }
+
+  commandLength += count;
+  command[ commandLength ] = '\0';
+
+  for( line = command; ( newline = strchr( line, '\n' ) ) != NULL;
+       line = newline + 1 )
+  {
+    *newline = '\0';
+    runCommand( line );
+  }
+
+  //keep any partial line; throw away one that will never fit
+  commandLength = strlen( line );
+
+  if( commandLength == MAX_COMMAND_LENGTH - 1 )
+    commandLength = 0;
+
+  memmove( command, line, commandLength );
+}
+
 /*
 ===============
 cleanUp
@@ -119,8 +571,34 @@ Exit handler
 */
 static void cleanUp( int signal )
 {
+  char  name[ MAX_FILENAME_LENGTH + 16 ];
+  int   i;
+
   if( writeDotFile )
-    dotOutput( dotFile, &callGraph );
+  {
+    viewProcess = NULL;
+    dotOutput( dotFile, viewGraph( ), dotCallSites );
+
+    //and one for each process when there's more than one
+    for( i = 0; numProcesses > 1 && i < numProcesses; i++ )
+    {
+      snprintf( name, sizeof( name ), "%s.%d", dotFile, processName( i ) );
+      dotOutput( name, &processes[ i ]->graph, dotCallSites );
+    }
+  }
+
+  if( writeCounterFile )
+  {
+    viewProcess = NULL;
+    counterOutput( counterFile, viewGraph( ) );
+
+    for( i = 0; numProcesses > 1 && i < numProcesses; i++ )
+    {
+      snprintf( name, sizeof( name ), "%s.%d", counterFile,
+                processName( i ) );
+      counterOutput( name, &processes[ i ]->graph );
+    }
+  }
   
   if( !disableGL && GLstarted )
   {
@@ -129,7 +607,18 @@ static void cleanUp( int signal )
   }
 
   shutdownSymbolTable( );
-  shutdownStack( &callStack );
+
+  if( listener != NULL )
+    closeListener( listener );
+
+  for( i = 0; i < numProcesses; i++ )
+  {
+    retireProcess( processes[ i ] );
+    shutdownGraph( &processes[ i ]->graph );
+    free( processes[ i ] );
+  }
+
+  shutdownGraph( &pastGraph );
   shutdownGraph( &callGraph );
 
   exit( 0 );
@@ -148,7 +637,7 @@ static void startUp( int argc, char **argv )
   int i;
   
   initGraph( &callGraph );
-  initStack( &callStack );
+  initGraph( &pastGraph );
   initSymbolTable( );
 
   parseOptions( argc, argv );
@@ -164,24 +653,39 @@ Main program
 */
 int main( int argc, char **argv )
 {
-  int     connection = -1;
-  boolean quit = false;
-  boolean clientConnected = false;
+  connection_t  *live[ MAX_PROCESSES ];
+  connection_t  *c = NULL;
+  boolean       quit = false;
+  int           numLive = 0;
   
   startUp( argc, argv );
   signal( SIGINT, cleanUp );
   
-  fprintf( stderr, "rtprof: waiting for client connection... " );
+  if( replay )
+    fprintf( stderr, "rtprof: opening trace %s... ", replayFile );
+  else
+    fprintf( stderr, "rtprof: waiting for client connection... " );
 
-  if( fileSocket )
-    connection = acceptConnection( AF_UNIX, socketFile );
+  if( replay )
+    c = openReplay( replayFile, realtime );
   else
-    connection = acceptConnection( AF_INET, NULL );
+  {
+    if( shmSocket )
+      listener = listenForShmConnections( shmName );
+    else if( fileSocket )
+      listener = listenForConnections( AF_UNIX, socketFile );
+    else
+      listener = listenForConnections( AF_INET, NULL );
+
+    if( listener != NULL )
+      c = acceptConnection( listener, -1 );
+  }
 
-  if( connection >= 0 )
+  if( c != NULL )
   {
-    fprintf( stderr, "accepted\n" );
-    clientConnected = true;
+    fprintf( stderr, replay ? "opened\n" : "accepted\n" );
+    addProcess( c );
+    numLive = 1;
   }
   else
     fprintf( stderr, "failed\n" );
@@ -194,17 +698,23 @@ int main( int argc, char **argv )
   
   while( !quit )
   {
-    if( clientConnected )
-      clientConnected = serviceConnection( connection, &callStack, &callGraph, 10000 );
+    acceptClients( 0 );
+
+    if( numProcesses > 0 )
+    {
+      pollCommands( );
+      numLive = serviceProcesses( live );
+    }
 
     if( !disableGL )
-      quit = GLfrontend( &callGraph );
-    else if( !clientConnected )
-      quit = true;
+      quit = GLfrontend( viewGraph( ) );
+    else if( numLive == 0 )
+      quit = !acceptClients( LINGER_MSEC );
+    else
+      waitForConnections( listener, live, numLive, 100 );
   }
   
   cleanUp( 0 );
   
   return 0;
 }
-   
@@ -48,11 +48,13 @@ static void printPadded( char *s, int n )
 dotOutput
 
 Write a graphviz dot file
+With callSites, an edge whose call sites are known is written once for
+each of them, labelled with its offset into the caller
 ===============
 */
-void dotOutput( char *filename, graph_t *g )
+void dotOutput( char *filename, graph_t *g, boolean callSites )
 {
-  graphEdge_t **p;
+  graphEdge_t **p, *s;
   int         n, i, j;
   FILE        *f;
 
@@ -67,6 +69,19 @@ void dotOutput( char *filename, graph_t *g )
   
   for( i = 0; i < n; i++ )
   {
+    if( callSites && p[ i ]->sites != NULL )
+    {
+      for( s = p[ i ]->sites; s != NULL; s = s->next )
+      {
+        fprintf( f, "\t\"%s\" -> \"%s\" [label=\"+0x%lx (%ld)\"];\n",
+                 s->from->textSymbol, s->to->textSymbol,
+                 (unsigned long)s->callSite -
+                 (unsigned long)s->from->symbol, s->calls );
+      }
+
+      continue;
+    }
+
     if( p[ i ]->from->textSymbol )
       fprintf( f, "\t\"%s\" -> ", p[ i ]->from->textSymbol );
 
@@ -80,6 +95,136 @@ void dotOutput( char *filename, graph_t *g )
   free( p );
 }
 
+/*
+===============
+counterOutput
+
+Write the values kept for each counter as comma separated lines of
+name, seconds since the earliest of them and value
+===============
+*/
+void counterOutput( char *filename, graph_t *g )
+{
+  graphCounter_t  *k;
+  graphSample_t   *v;
+  timeStamp_t     start = ~0ULL;
+  long            n;
+  int             i;
+  FILE            *f;
+
+  if( !strcmp( filename, "-" ) )
+    f = stdout;
+  else if( ( f = fopen( filename, "w" ) ) == NULL )
+    return;
+
+  for( i = 0; i < g->numCounters; i++ )
+  {
+    k = &g->counters[ i ];
+
+    for( n = 0; n < keptSamples( k ); n++ )
+    {
+      if( listSample( k, n )->time < start )
+        start = listSample( k, n )->time;
+    }
+  }
+
+  fprintf( f, "counter,seconds,value\n" );
+
+  for( i = 0; i < g->numCounters; i++ )
+  {
+    k = &g->counters[ i ];
+
+    for( n = 0; n < keptSamples( k ); n++ )
+    {
+      v = listSample( k, n );
+      fprintf( f, "\"%s\",%.6f,%lld\n", k->name,
+               ( v->time - start ) / 1000000000.0, v->value );
+    }
+  }
+
+  if( f != stdout )
+    fclose( f );
+}
+
+/*
+===============
+counterSummary
+
+Print the latest value and the extremes of each counter
+===============
+*/
+void counterSummary( graph_t *g )
+{
+  graphCounter_t  *k;
+  char            buffer[ 32 ];
+  int             i;
+
+  printPadded( "latest", 14 );
+  printPadded( "min", 14 );
+  printPadded( "max", 14 );
+  printPadded( "samples", 10 );
+  printf( "counter\n" );
+
+  for( i = 0; i < g->numCounters; i++ )
+  {
+    k = &g->counters[ i ];
+
+    if( k->numSamples == 0 )
+      continue;
+
+    snprintf( buffer, sizeof( buffer ), "%lld", k->latest );
+    printPadded( buffer, 14 );
+    snprintf( buffer, sizeof( buffer ), "%lld", k->min );
+    printPadded( buffer, 14 );
+    snprintf( buffer, sizeof( buffer ), "%lld", k->max );
+    printPadded( buffer, 14 );
+    snprintf( buffer, sizeof( buffer ), "%ld", k->numSamples );
+    printPadded( buffer, 10 );
+    printf( "%s\n", k->name );
+  }
+}
+
+/*
+===============
+threadSummary
+
+Print the calls made and the time spent by each thread, in milliseconds
+===============
+*/
+void threadSummary( graph_t *g )
+{
+  graphThread_t *t;
+  char          buffer[ 32 ];
+  int           i;
+
+  printPadded( "thread", 8 );
+  printPadded( "calls", 12 );
+  printPadded( "local", 12 );
+  printPadded( "total", 12 );
+  printPadded( "local cpu", 12 );
+  printf( "total cpu\n" );
+
+  for( i = 0; i < g->numThreads; i++ )
+  {
+    t = &g->threads[ i ];
+
+    if( t->calls == 0 && t->totalTime == 0 )
+      continue;
+
+    snprintf( buffer, sizeof( buffer ), "%d", i );
+    printPadded( buffer, 8 );
+    snprintf( buffer, sizeof( buffer ), "%ld", t->calls );
+    printPadded( buffer, 12 );
+    snprintf( buffer, sizeof( buffer ), "%.3f", t->localTime / 1.0e6 );
+    printPadded( buffer, 12 );
+    snprintf( buffer, sizeof( buffer ), "%.3f", t->totalTime / 1.0e6 );
+    printPadded( buffer, 12 );
+    snprintf( buffer, sizeof( buffer ), "%.3f", t->localCpuTime / 1.0e6 );
+    printPadded( buffer, 12 );
+    printf( "%.3f\n", t->totalCpuTime / 1.0e6 );
+  }
+}
+
 /*
 ===============
 outputHack
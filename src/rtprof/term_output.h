@@ -22,6 +22,9 @@
 #include "adt_graph.h"
 
 void *outputHack( void *arg );
-void dotOutput( char *filename, graph_t *g );
+void dotOutput( char *filename, graph_t *g, boolean callSites );
+void counterOutput( char *filename, graph_t *g );
+void counterSummary( graph_t *g );
+void threadSummary( graph_t *g );
 
 #endif